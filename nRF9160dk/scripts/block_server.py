@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 IoTerop
+# SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+#
+"""CoAP block server stand-in for the firmware downloads of the IOWA client.
+
+Serves one file over CoAP/UDP with Block2 (RFC 7959), with an ETag and
+the Size2 option, at any path. The network latency and losses can be
+emulated without serializing the responses, so that the effect of the
+request window of the client shows in the download time, which is
+logged with the throughput when the last block is served.
+
+    python3 block_server.py zephyr/app_update.bin --delay 100 --loss 0.02
+
+Touch the file during a download to change its ETag. Stop it with
+Ctrl-C to print the traffic summary.
+"""
+
+import argparse
+import hashlib
+import heapq
+import os
+import random
+import select
+import socket
+import struct
+import sys
+import time
+from collections import Counter
+
+from lwm2m_server import (COAP_ACK, COAP_CON, COAP_NON, COAP_RST, CODE_CONTENT, CODE_GET, CODE_NOT_FOUND,
+                          Message, code, code_str, decode, encode, uint_option)
+
+OPT_ETAG = 4
+OPT_BLOCK2 = 23
+OPT_SIZE2 = 28
+
+CODE_BAD_OPTION = code(4, 2)
+CODE_METHOD_NOT_ALLOWED = code(4, 5)
+
+
+class BlockServer:
+    def __init__(self, args):
+        self.args = args
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind((args.address, args.port))
+        self.start = time.monotonic()
+        self.image = b""
+        self.etag = b""
+        self.mtime = None
+        # Delayed datagrams: (time, sequence, data, peer)
+        self.outgoing = []
+        self.sequence = 0
+        # Download in progress, by peer: start time and blocks served
+        self.downloads = {}
+        self.stats = Counter()
+        self.load()
+
+    def log(self, peer, text):
+        print("[%9.3f] %s:%u %s" % (time.monotonic() - self.start, peer[0], peer[1], text))
+        sys.stdout.flush()
+
+    def load(self):
+        mtime = os.stat(self.args.file).st_mtime_ns
+        if mtime == self.mtime:
+            return
+        with open(self.args.file, "rb") as image:
+            self.image = image.read()
+        self.etag = hashlib.sha256(self.image + struct.pack("!Q", mtime)).digest()[:8]
+        self.mtime = mtime
+        print("Serving %s: %u bytes, ETag %s" % (self.args.file, len(self.image), self.etag.hex()))
+
+    def send(self, msg, peer):
+        data = encode(msg)
+        self.stats["tx datagrams"] += 1
+        self.stats["tx bytes"] += len(data)
+        if self.args.delay:
+            self.sequence += 1
+            heapq.heappush(self.outgoing, (time.monotonic() + self.args.delay / 1000.0, self.sequence, data, peer))
+        else:
+            self.sock.sendto(data, peer)
+
+    def flush(self):
+        now = time.monotonic()
+        while self.outgoing and self.outgoing[0][0] <= now:
+            _, _, data, peer = heapq.heappop(self.outgoing)
+            self.sock.sendto(data, peer)
+
+    def reply(self, request, peer, mcode, options=None, payload=b""):
+        if request.type == COAP_CON:
+            response = Message(COAP_ACK, mcode, request.mid, request.token, options, payload)
+        else:
+            response = Message(COAP_NON, mcode, random.getrandbits(16), request.token, options, payload)
+        self.send(response, peer)
+
+    def handle_request(self, msg, peer):
+        if msg.code != CODE_GET:
+            self.reply(msg, peer, CODE_METHOD_NOT_ALLOWED)
+            return
+
+        self.load()
+        szx = 6
+        num = 0
+        block2 = msg.option_values(OPT_BLOCK2)
+        if block2:
+            value = int.from_bytes(block2[0], "big")
+            num = value >> 4
+            szx = min(value & 0x07, 6)
+        szx = min(szx, self.args.max_szx)
+        size = 16 << szx
+        offset = num * size
+        if offset >= len(self.image) and not (offset == 0 and not self.image):
+            self.stats["past the end"] += 1
+            self.reply(msg, peer, CODE_BAD_OPTION)
+            return
+
+        payload = self.image[offset:offset + size]
+        more = offset + size < len(self.image)
+        options = [(OPT_ETAG, self.etag), (OPT_BLOCK2, uint_option((num << 4) | (more << 3) | szx))]
+        if msg.option_values(OPT_SIZE2):
+            options.append((OPT_SIZE2, uint_option(len(self.image))))
+        self.reply(msg, peer, CODE_CONTENT, options, payload)
+        self.stats["blocks"] += 1
+
+        if num == 0 or peer not in self.downloads:
+            self.downloads[peer] = [time.monotonic(), 0, offset]
+            self.log(peer, "Download of %s from offset %u, %u-byte blocks" % (msg.path(), offset, size))
+        self.downloads[peer][1] += 1
+        if not more:
+            start, count, first = self.downloads.pop(peer)
+            elapsed = time.monotonic() - start
+            self.stats["downloads"] += 1
+            self.log(peer, "Last block served: %u bytes in %u requests, %.3f s, %.1f KB/s"
+                     % (len(self.image) - first, count, elapsed,
+                        (len(self.image) - first) / 1024.0 / elapsed if elapsed > 0 else 0.0))
+
+    def read_datagram(self):
+        data, peer = self.sock.recvfrom(2048)
+        if random.random() < self.args.loss:
+            self.stats["dropped"] += 1
+            return
+        self.stats["rx datagrams"] += 1
+        self.stats["rx bytes"] += len(data)
+        try:
+            msg = decode(data)
+        except (ValueError, IndexError, struct.error):
+            self.log(peer, "Malformed datagram (%u bytes)" % len(data))
+            return
+        if 1 <= msg.code < 32:
+            self.handle_request(msg, peer)
+        elif msg.type == COAP_CON:
+            self.send(Message(COAP_RST, 0, msg.mid), peer)
+
+    def run(self):
+        print("Block server stand-in listening on %s:%u (UDP)" % (self.args.address, self.args.port))
+        while True:
+            timeout = None
+            if self.outgoing:
+                timeout = max(0.0, self.outgoing[0][0] - time.monotonic())
+            readable, _, _ = select.select([self.sock], [], [], timeout)
+            if readable:
+                self.read_datagram()
+            self.flush()
+
+    def summary(self):
+        print("\n%.3f s:" % (time.monotonic() - self.start))
+        for key in sorted(self.stats):
+            print("  %-14s %u" % (key, self.stats[key]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", help="image served at any path")
+    parser.add_argument("--address", default="0.0.0.0", help="address to bind to")
+    parser.add_argument("--port", type=int, default=5693, help="UDP port to listen on")
+    parser.add_argument("--max-szx", type=int, default=6, choices=range(7), metavar="SZX",
+                        help="largest block size exponent served, 6 for 1024 bytes")
+    parser.add_argument("--delay", type=int, default=0, metavar="MS",
+                        help="delay before each outgoing datagram, to emulate the network latency")
+    parser.add_argument("--loss", type=float, default=0.0, metavar="RATIO",
+                        help="ratio of incoming datagrams to drop, to exercise retransmissions")
+    server = BlockServer(parser.parse_args())
+    try:
+        server.run()
+    except KeyboardInterrupt:
+        server.summary()
+
+
+if __name__ == "__main__":
+    main()
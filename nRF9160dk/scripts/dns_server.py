@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 IoTerop
+# SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+#
+"""Minimal DNS server stand-in for local runs of the IOWA client.
+
+Answers the A queries for the configured names, logs every query with
+its timestamp, and can stop answering on SIGUSR1 to emulate an
+unreachable DNS, so that the DNS cache of the client can be exercised.
+
+    python3 dns_server.py --host lwm2m.test=192.0.2.2 --ttl 60
+
+Send SIGUSR1 to toggle the answers, stop it with Ctrl-C to print the
+number of queries.
+"""
+
+import argparse
+import signal
+import socket
+import struct
+import sys
+import time
+from collections import Counter
+
+TYPE_A = 1
+CLASS_IN = 1
+
+RCODE_NOERROR = 0
+RCODE_FORMERR = 1
+RCODE_NXDOMAIN = 3
+
+
+def parse_query(data):
+    """Returns the id, the flags, the question bytes, the name and the type."""
+    mid, flags, qdcount = struct.unpack("!HHH", data[:6])
+    if qdcount != 1:
+        raise ValueError("%u questions" % qdcount)
+    labels = []
+    offset = 12
+    while data[offset] != 0:
+        length = data[offset]
+        labels.append(data[offset + 1:offset + 1 + length].decode("ascii"))
+        offset += 1 + length
+    qtype, qclass = struct.unpack("!HH", data[offset + 1:offset + 5])
+    question = data[12:offset + 5]
+    return mid, flags, question, ".".join(labels).lower(), qtype
+
+
+def build_response(mid, flags, question, rcode, address=None, ttl=0):
+    # QR, same opcode and RD, RA
+    flags = 0x8000 | (flags & 0x7900) | 0x0080 | rcode
+    ancount = 1 if address else 0
+    data = struct.pack("!HHHHHH", mid, flags, 1, ancount, 0, 0) + question
+    if address:
+        # Name as a pointer to the question
+        data += struct.pack("!HHHIH", 0xC00C, TYPE_A, CLASS_IN, ttl, 4)
+        data += socket.inet_aton(address)
+    return data
+
+
+class Server:
+    def __init__(self, args):
+        self.args = args
+        self.hosts = {}
+        for entry in args.host:
+            name, address = entry.split("=", 1)
+            self.hosts[name.lower().rstrip(".")] = address
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind((args.address, args.port))
+        self.start = time.monotonic()
+        self.answering = True
+        self.stats = Counter()
+
+    def log(self, peer, text):
+        print("[%9.3f] %s:%u %s" % (time.monotonic() - self.start, peer[0], peer[1], text))
+        sys.stdout.flush()
+
+    def toggle(self, signum, frame):
+        self.answering = not self.answering
+        print("DNS stand-in %s" % ("answering" if self.answering else "silent"))
+        sys.stdout.flush()
+
+    def run(self):
+        print("DNS stand-in listening on %s:%u" % (self.args.address, self.args.port))
+        while True:
+            try:
+                data, peer = self.sock.recvfrom(512)
+            except InterruptedError:
+                continue
+            self.stats["queries"] += 1
+            try:
+                mid, flags, question, name, qtype = parse_query(data)
+            except (ValueError, IndexError, struct.error, UnicodeDecodeError):
+                self.log(peer, "Malformed query (%u bytes)" % len(data))
+                continue
+            if not self.answering:
+                self.stats["ignored"] += 1
+                self.log(peer, "Ignored %s" % name)
+                continue
+            address = self.hosts.get(name) if qtype == TYPE_A else None
+            if address:
+                self.stats["answered"] += 1
+                self.log(peer, "%s -> %s (TTL %u s)" % (name, address, self.args.ttl))
+                response = build_response(mid, flags, question, RCODE_NOERROR, address, self.args.ttl)
+            else:
+                self.stats["unknown"] += 1
+                self.log(peer, "%s type %u: not found" % (name, qtype))
+                response = build_response(mid, flags, question, RCODE_NXDOMAIN)
+            self.sock.sendto(response, peer)
+
+    def summary(self):
+        print("\n%.3f s:" % (time.monotonic() - self.start))
+        for key in sorted(self.stats):
+            print("  %-10s %u" % (key, self.stats[key]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--address", default="0.0.0.0", help="address to bind to")
+    parser.add_argument("--port", type=int, default=53, help="UDP port to listen on")
+    parser.add_argument("--host", action="append", default=[], metavar="NAME=ADDRESS",
+                        help="name to resolve, e.g. lwm2m.test=192.0.2.2")
+    parser.add_argument("--ttl", type=int, default=300, metavar="S",
+                        help="time to live of the answers")
+    args = parser.parse_args()
+    if not args.host:
+        args.host = ["lwm2m.test=192.0.2.2"]
+    server = Server(args)
+    signal.signal(signal.SIGUSR1, server.toggle)
+    try:
+        server.run()
+    except KeyboardInterrupt:
+        server.summary()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,628 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 IoTerop
+# SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+#
+"""Minimal LwM2M server stand-in for local runs of the IOWA client.
+
+Answers the Register, Update, De-register and Send operations over
+CoAP/UDP or CoAP/TCP (RFC 8323), non-secure or protected with OSCORE,
+optionally observes some
+resources or starts a firmware update after each registration, emulates
+coverage gaps, and logs every exchange with its
+timestamp so that the client flows can be timed without a real LwM2M
+server.
+
+    python3 lwm2m_server.py --observe /3316/0/5700
+    python3 lwm2m_server.py --oscore --observe /3316/0/5700
+    python3 lwm2m_server.py --tcp --observe /3316/0/5700
+    python3 lwm2m_server.py --burst 8
+    python3 lwm2m_server.py --fota coap://192.0.2.2:5693/app_update.bin
+    python3 lwm2m_server.py --outage 60:300
+
+OSCORE needs the "cryptography" package, see oscore.py.
+
+Stop it with Ctrl-C to print the traffic summary.
+"""
+
+import argparse
+import random
+import select
+import socket
+import struct
+import sys
+import time
+from collections import Counter
+
+import oscore
+
+COAP_CON = 0
+COAP_NON = 1
+COAP_ACK = 2
+COAP_RST = 3
+
+OPT_URI_HOST = 3
+OPT_OBSERVE = 6
+OPT_URI_PORT = 7
+OPT_LOCATION_PATH = 8
+OPT_OSCORE = 9
+OPT_URI_PATH = 11
+OPT_CONTENT_FORMAT = 12
+OPT_URI_QUERY = 15
+OPT_ACCEPT = 17
+OPT_PROXY_URI = 35
+OPT_PROXY_SCHEME = 39
+
+# Options left in clear by OSCORE. Observe is both Inner and Outer.
+OUTER_OPTIONS = (OPT_URI_HOST, OPT_URI_PORT, OPT_OSCORE, OPT_PROXY_URI, OPT_PROXY_SCHEME)
+
+
+def code(cls, detail):
+    return (cls << 5) | detail
+
+
+CODE_GET = code(0, 1)
+CODE_POST = code(0, 2)
+CODE_PUT = code(0, 3)
+CODE_DELETE = code(0, 4)
+CODE_FETCH = code(0, 5)
+CODE_CREATED = code(2, 1)
+CODE_DELETED = code(2, 2)
+CODE_CHANGED = code(2, 4)
+CODE_CONTENT = code(2, 5)
+CODE_UNAUTHORIZED = code(4, 1)
+CODE_NOT_FOUND = code(4, 4)
+CODE_CSM = code(7, 1)
+CODE_PING = code(7, 2)
+CODE_PONG = code(7, 3)
+CODE_RELEASE = code(7, 4)
+CODE_ABORT = code(7, 5)
+
+# Firmware Update object: Package URI, Update and State resources
+FOTA_URI_PATH = "/5/0/1"
+FOTA_UPDATE_PATH = "/5/0/2"
+FOTA_STATE_PATH = "/5/0/3"
+FOTA_STATE_DOWNLOADED = 2
+
+# Extended length of the RFC 8323 framing: nibble, bytes, offset
+TCP_LENGTHS = ((13, 1, 13), (14, 2, 269), (15, 4, 65805))
+
+
+def code_str(value):
+    return "%u.%02u" % (value >> 5, value & 0x1F)
+
+
+class Message:
+    def __init__(self, mtype=COAP_CON, mcode=0, mid=0, token=b"", options=None, payload=b""):
+        self.type = mtype
+        self.code = mcode
+        self.mid = mid
+        self.token = token
+        self.options = options if options is not None else []
+        self.payload = payload
+        # (kid, Partial IV) of the OSCORE request
+        self.binding = None
+
+    def option_values(self, number):
+        return [value for (num, value) in self.options if num == number]
+
+    def path(self):
+        return "/" + "/".join(v.decode(errors="replace") for v in self.option_values(OPT_URI_PATH))
+
+    def query(self):
+        return [v.decode(errors="replace") for v in self.option_values(OPT_URI_QUERY)]
+
+
+def _ext(value):
+    if value < 13:
+        return value, b""
+    if value < 269:
+        return 13, struct.pack("!B", value - 13)
+    return 14, struct.pack("!H", value - 269)
+
+
+def encode(msg):
+    data = bytearray(struct.pack("!BBH", 0x40 | (msg.type << 4) | len(msg.token), msg.code, msg.mid))
+    data += msg.token
+    last = 0
+    for number, value in sorted(msg.options, key=lambda o: o[0]):
+        delta, delta_ext = _ext(number - last)
+        length, length_ext = _ext(len(value))
+        data.append((delta << 4) | length)
+        data += delta_ext + length_ext + value
+        last = number
+    if msg.payload:
+        data.append(0xFF)
+        data += msg.payload
+    return bytes(data)
+
+
+def decode(data):
+    if len(data) < 4 or data[0] >> 6 != 1:
+        raise ValueError("not a CoAP message")
+    tkl = data[0] & 0x0F
+    msg = Message((data[0] >> 4) & 0x03, data[1], struct.unpack("!H", data[2:4])[0], data[4:4 + tkl])
+    pos = 4 + tkl
+    number = 0
+    while pos < len(data):
+        if data[pos] == 0xFF:
+            msg.payload = data[pos + 1:]
+            break
+        delta = data[pos] >> 4
+        length = data[pos] & 0x0F
+        pos += 1
+        values = []
+        for nibble in (delta, length):
+            if nibble == 13:
+                values.append(data[pos] + 13)
+                pos += 1
+            elif nibble == 14:
+                values.append(struct.unpack("!H", data[pos:pos + 2])[0] + 269)
+                pos += 2
+            else:
+                values.append(nibble)
+        number += values[0]
+        msg.options.append((number, data[pos:pos + values[1]]))
+        pos += values[1]
+    return msg
+
+
+def encode_tcp(msg):
+    """Frames msg for a stream (RFC 8323 section 3.2): no type nor message ID."""
+    body = encode(msg)[4 + len(msg.token):]
+    head = bytes([(len(body) << 4) | len(msg.token)]) if len(body) < 13 else b""
+    for nibble, size, offset in reversed(TCP_LENGTHS):
+        if len(body) >= offset and not head:
+            head = bytes([(nibble << 4) | len(msg.token)]) + (len(body) - offset).to_bytes(size, "big")
+    return head + bytes([msg.code]) + msg.token + body
+
+
+def decode_tcp(data):
+    """Returns the first message framed in data and its length, or None if
+    data does not hold it whole yet. The message is typed NON."""
+    if not data:
+        return None
+    length = data[0] >> 4
+    tkl = data[0] & 0x0F
+    size = 0
+    for nibble, ext_size, offset in TCP_LENGTHS:
+        if length == nibble:
+            size = ext_size
+            if len(data) < 1 + size:
+                return None
+            length = int.from_bytes(data[1:1 + size], "big") + offset
+            break
+    end = 2 + size + tkl + length
+    if len(data) < end:
+        return None
+    datagram = bytes([0x40 | (COAP_NON << 4) | tkl, data[1 + size], 0, 0]) + bytes(data[2 + size:end])
+    return decode(datagram), end
+
+
+def uint_option(value):
+    if value == 0:
+        return b""
+    return value.to_bytes((value.bit_length() + 7) // 8, "big")
+
+
+class Server:
+    def __init__(self, args):
+        self.args = args
+        if args.tcp:
+            self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            self.sock.bind((args.address, args.port))
+            self.sock.listen()
+        else:
+            self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            self.sock.bind((args.address, args.port))
+        # Stream connections and their received bytes, by peer
+        self.connections = {}
+        self.buffers = {}
+        self.start = time.monotonic()
+        self.next_mid = random.randint(0, 0xFFFF)
+        self.next_location = 1
+        self.clients = {}
+        self.observations = {}
+        # Burst of reads in progress, by peer: pending tokens and start time
+        self.bursts = {}
+        # Requests sent to the clients, by token: description and OSCORE binding
+        self.requests = {}
+        self.stats = Counter()
+        # Coverage gaps: (start, end) in seconds from the start
+        self.outages = sorted((start, start + duration) for start, duration in args.outage)
+        self.in_outage = False
+        self.oscore = None
+        if args.oscore:
+            self.oscore = oscore.Context(bytes.fromhex(args.oscore_secret),
+                                         bytes.fromhex(args.oscore_salt),
+                                         bytes.fromhex(args.oscore_server_id),
+                                         bytes.fromhex(args.oscore_client_id))
+
+    def log(self, peer, text):
+        print("[%9.3f] %s:%u %s" % (time.monotonic() - self.start, peer[0], peer[1], text))
+        sys.stdout.flush()
+
+    def send(self, msg, peer):
+        if self.args.delay:
+            time.sleep(self.args.delay / 1000.0)
+        if peer in self.connections:
+            data = encode_tcp(msg)
+            self.stats["tx messages"] += 1
+            self.stats["tx bytes"] += len(data)
+            try:
+                self.connections[peer].sendall(data)
+            except OSError as error:
+                self.close(peer, "Sending failed: %s" % error)
+            return
+        data = encode(msg)
+        self.stats["tx datagrams"] += 1
+        self.stats["tx bytes"] += len(data)
+        self.sock.sendto(data, peer)
+
+    def reply(self, request, peer, mcode, options=None):
+        if request.type == COAP_CON:
+            response = Message(COAP_ACK, mcode, request.mid, request.token, options)
+        else:
+            response = Message(COAP_NON, mcode, self.new_mid(), request.token, options)
+        if request.binding is not None:
+            response = self.protect(response, request.binding)
+        self.send(response, peer)
+
+    def protect(self, msg, request=None):
+        """Returns the OSCORE message carrying msg, a request if no request
+        binding is given."""
+        if request is None:
+            inner = [o for o in msg.options if o[0] not in OUTER_OPTIONS]
+            outer = [o for o in msg.options if o[0] in OUTER_OPTIONS or o[0] == OPT_OBSERVE]
+            outer_code = CODE_FETCH if msg.option_values(OPT_OBSERVE) else CODE_POST
+        else:
+            inner = [o for o in msg.options if o[0] not in OUTER_OPTIONS and o[0] != OPT_OBSERVE]
+            outer = [o for o in msg.options if o[0] in OUTER_OPTIONS or o[0] == OPT_OBSERVE]
+            outer_code = CODE_CHANGED
+        # Code, then the options and the payload without the header
+        plaintext = bytes([msg.code]) + encode(Message(options=inner, payload=msg.payload))[4:]
+        option, ciphertext, binding = self.oscore.protect(plaintext, request)
+        protected = Message(msg.type, outer_code, msg.mid, msg.token, outer + [(OPT_OSCORE, option)], ciphertext)
+        protected.binding = binding
+        return protected
+
+    def unprotect(self, msg, request=None):
+        """Returns the message carried by the OSCORE message msg, a request
+        if no request binding is given."""
+        if not msg.option_values(OPT_OSCORE):
+            raise oscore.OscoreError("no OSCORE option")
+        option = msg.option_values(OPT_OSCORE)[0]
+        plaintext, binding = self.oscore.unprotect(option, msg.payload, request)
+        inner = decode(b"\x40" + plaintext[:1] + b"\0\0" + plaintext[1:])
+        outer = [o for o in msg.options if o[0] == OPT_OBSERVE]
+        if request is None:
+            outer = []
+        clear = Message(msg.type, inner.code, msg.mid, msg.token, outer + inner.options, inner.payload)
+        clear.binding = binding
+        return clear
+
+    def new_mid(self):
+        self.next_mid = (self.next_mid + 1) & 0xFFFF
+        return self.next_mid
+
+    def observe(self, peer):
+        for path in self.args.observe:
+            token = struct.pack("!I", random.getrandbits(32))
+            options = [(OPT_OBSERVE, b"")]
+            options += [(OPT_URI_PATH, p.encode()) for p in path.strip("/").split("/")]
+            msg = Message(COAP_CON, CODE_GET, self.new_mid(), token, options)
+            if self.oscore is not None:
+                msg = self.protect(msg)
+            self.observations[token] = [path, None, msg.binding]
+            self.send(msg, peer)
+            self.log(peer, "Observe %s" % path)
+
+    def request(self, peer, mcode, path, text, options=None, payload=b""):
+        """Sends a request to the client and logs its response."""
+        token = struct.pack("!I", random.getrandbits(32))
+        options = [(OPT_URI_PATH, p.encode()) for p in path.strip("/").split("/")] + (options or [])
+        msg = Message(COAP_CON, mcode, self.new_mid(), token, options, payload)
+        if self.oscore is not None:
+            msg = self.protect(msg)
+        self.requests[token] = ["%s %s" % (text, path), msg.binding]
+        self.send(msg, peer)
+        self.log(peer, "%s %s" % (text, path))
+
+    def fota(self, peer):
+        """Writes the --fota Package URI and observes the update State, to
+        execute the Update once the image is downloaded."""
+        token = struct.pack("!I", random.getrandbits(32))
+        options = [(OPT_OBSERVE, b"")]
+        options += [(OPT_URI_PATH, p.encode()) for p in FOTA_STATE_PATH.strip("/").split("/")]
+        options.append((OPT_ACCEPT, b""))
+        msg = Message(COAP_CON, CODE_GET, self.new_mid(), token, options)
+        if self.oscore is not None:
+            msg = self.protect(msg)
+        self.observations[token] = [FOTA_STATE_PATH, None, msg.binding]
+        self.send(msg, peer)
+        self.log(peer, "Observe %s" % FOTA_STATE_PATH)
+        self.request(peer, CODE_PUT, FOTA_URI_PATH, "Write", [(OPT_CONTENT_FORMAT, b"")], self.args.fota.encode())
+
+    def handle_fota_state(self, msg, peer):
+        try:
+            state = int(msg.payload)
+        except ValueError:
+            return
+        self.log(peer, "Firmware update state %u" % state)
+        if state == FOTA_STATE_DOWNLOADED:
+            self.stats["fota"] += 1
+            self.request(peer, CODE_POST, FOTA_UPDATE_PATH, "Execute")
+
+    def burst(self, peer):
+        """Sends --burst reads at once, as a server would after the device
+        sleep, and times their responses."""
+        path = self.args.burst_path
+        options = [(OPT_URI_PATH, p.encode()) for p in path.strip("/").split("/")]
+        messages = []
+        for _ in range(self.args.burst):
+            token = struct.pack("!I", random.getrandbits(32))
+            msg = Message(COAP_CON, CODE_GET, self.new_mid(), token, options)
+            if self.oscore is not None:
+                msg = self.protect(msg)
+            messages.append(msg)
+        self.bursts[peer] = [{msg.token: msg.binding for msg in messages}, time.monotonic()]
+        for msg in messages:
+            self.send(msg, peer)
+        self.log(peer, "Burst of %u reads of %s" % (self.args.burst, path))
+
+    def handle_burst_response(self, msg, peer):
+        tokens, start = self.bursts[peer]
+        binding = tokens.pop(msg.token)
+        if binding is not None:
+            try:
+                msg = self.unprotect(msg, binding)
+            except (IndexError, ValueError, struct.error, oscore.OscoreError) as error:
+                self.stats["oscore errors"] += 1
+                self.log(peer, "Unprotecting the response failed: %s" % error)
+        self.stats["burst reads"] += 1
+        if not tokens:
+            del self.bursts[peer]
+            elapsed = time.monotonic() - start
+            self.stats["bursts"] += 1
+            self.log(peer, "Burst answered in %.3f s (%.1f ms per read), last %s"
+                     % (elapsed, elapsed * 1000 / self.args.burst, code_str(msg.code)))
+        if msg.type == COAP_CON:
+            self.send(Message(COAP_ACK, 0, msg.mid), peer)
+
+    def handle_request(self, msg, peer):
+        path = msg.path()
+        if msg.code == CODE_POST and path == "/rd":
+            location = str(self.next_location)
+            self.next_location += 1
+            endpoint = next((q[3:] for q in msg.query() if q.startswith("ep=")), "?")
+            self.clients[location] = endpoint
+            self.stats["register"] += 1
+            self.log(peer, "Register ep=%s as /rd/%s (%u bytes payload)" % (endpoint, location, len(msg.payload)))
+            self.reply(msg, peer, CODE_CREATED, [(OPT_LOCATION_PATH, b"rd"), (OPT_LOCATION_PATH, location.encode())])
+            self.observe(peer)
+            if self.args.burst:
+                self.burst(peer)
+            if self.args.fota:
+                self.fota(peer)
+        elif msg.code == CODE_POST and path.startswith("/rd/"):
+            self.stats["update"] += 1
+            self.log(peer, "Update %s %s" % (path, " ".join(msg.query())))
+            self.reply(msg, peer, CODE_CHANGED if path[4:] in self.clients else CODE_NOT_FOUND)
+        elif msg.code == CODE_DELETE and path.startswith("/rd/"):
+            self.stats["deregister"] += 1
+            self.log(peer, "De-register %s" % path)
+            self.clients.pop(path[4:], None)
+            self.reply(msg, peer, CODE_DELETED)
+        elif msg.code == CODE_POST and path == "/dp":
+            self.stats["send"] += 1
+            self.log(peer, "Send (%u bytes payload)" % len(msg.payload))
+            self.reply(msg, peer, CODE_CHANGED)
+        else:
+            self.stats["unknown"] += 1
+            self.log(peer, "Unhandled %s %s" % (code_str(msg.code), path))
+            self.reply(msg, peer, CODE_NOT_FOUND)
+
+    def handle_response(self, msg, peer):
+        if msg.type == COAP_ACK and msg.code == 0:
+            return
+        if peer in self.bursts and msg.token in self.bursts[peer][0]:
+            self.handle_burst_response(msg, peer)
+            return
+        request = self.requests.pop(msg.token, None)
+        if request is not None:
+            if request[1] is not None:
+                try:
+                    msg = self.unprotect(msg, request[1])
+                except (IndexError, ValueError, struct.error, oscore.OscoreError) as error:
+                    self.stats["oscore errors"] += 1
+                    self.log(peer, "Unprotecting the response failed: %s" % error)
+                    return
+            self.log(peer, "%s: %s" % (request[0], code_str(msg.code)))
+            if msg.type == COAP_CON:
+                self.send(Message(COAP_ACK, 0, msg.mid), peer)
+            return
+        observation = self.observations.get(msg.token)
+        if observation is None:
+            if msg.type == COAP_CON:
+                self.send(Message(COAP_RST, 0, msg.mid), peer)
+            return
+        if observation[2] is not None:
+            try:
+                msg = self.unprotect(msg, observation[2])
+            except (IndexError, ValueError, struct.error, oscore.OscoreError) as error:
+                self.stats["oscore errors"] += 1
+                self.log(peer, "Unprotecting the notification failed: %s" % error)
+                return
+        now = time.monotonic()
+        interval = "" if observation[1] is None else " (+%.3f s)" % (now - observation[1])
+        observation[1] = now
+        self.stats["notify"] += 1
+        self.log(peer, "Notify %s %s (%u bytes payload)%s" % (observation[0], code_str(msg.code), len(msg.payload), interval))
+        if observation[0] == FOTA_STATE_PATH:
+            self.handle_fota_state(msg, peer)
+        if msg.type == COAP_CON:
+            self.send(Message(COAP_ACK, 0, msg.mid), peer)
+
+    def handle_message(self, msg, peer):
+        if 1 <= msg.code < 32:
+            if self.oscore is not None:
+                try:
+                    msg = self.unprotect(msg)
+                except (IndexError, ValueError, struct.error, oscore.OscoreError) as error:
+                    self.stats["oscore errors"] += 1
+                    self.log(peer, "Unprotecting the request failed: %s" % error)
+                    self.reply(msg, peer, CODE_UNAUTHORIZED)
+                    return
+            self.handle_request(msg, peer)
+        else:
+            self.handle_response(msg, peer)
+
+    def handle_signal(self, msg, peer):
+        if msg.code == CODE_CSM:
+            self.log(peer, "CSM")
+        elif msg.code == CODE_PING:
+            self.stats["ping"] += 1
+            self.send(Message(COAP_NON, CODE_PONG, 0, msg.token), peer)
+        elif msg.code in (CODE_RELEASE, CODE_ABORT):
+            self.close(peer, "%s: %s" % ("Release" if msg.code == CODE_RELEASE else "Abort", msg.payload))
+
+    def accept(self):
+        conn, peer = self.sock.accept()
+        self.connections[peer] = conn
+        self.buffers[peer] = bytearray()
+        self.stats["connections"] += 1
+        self.log(peer, "Connected")
+        # The Capabilities and Settings Message opens the connection
+        self.send(Message(COAP_NON, CODE_CSM), peer)
+
+    def close(self, peer, reason):
+        conn = self.connections.pop(peer, None)
+        if conn is None:
+            return
+        del self.buffers[peer]
+        conn.close()
+        self.log(peer, reason)
+
+    def read_stream(self, peer):
+        try:
+            data = self.connections[peer].recv(4096)
+        except OSError:
+            data = b""
+        if not data:
+            self.close(peer, "Connection closed")
+            return
+        self.stats["rx bytes"] += len(data)
+        self.buffers[peer] += data
+        while peer in self.connections:
+            try:
+                framed = decode_tcp(self.buffers[peer])
+            except (ValueError, IndexError, struct.error):
+                self.close(peer, "Malformed message")
+                return
+            if framed is None:
+                return
+            msg, length = framed
+            del self.buffers[peer][:length]
+            self.stats["rx messages"] += 1
+            if msg.code >= CODE_CSM:
+                self.handle_signal(msg, peer)
+            else:
+                self.handle_message(msg, peer)
+
+    def outage(self, peer):
+        elapsed = time.monotonic() - self.start
+        in_outage = any(start <= elapsed < end for start, end in self.outages)
+        if in_outage != self.in_outage:
+            self.in_outage = in_outage
+            self.log(peer, "Coverage gap started" if in_outage else "Coverage gap ended")
+        return in_outage
+
+    def read_datagram(self):
+        data, peer = self.sock.recvfrom(2048)
+        if self.outage(peer):
+            # Nothing goes through, the client can only notice the timeouts
+            self.stats["outage dropped"] += 1
+            return
+        if random.random() < self.args.loss:
+            self.stats["dropped"] += 1
+            self.log(peer, "Dropped %u bytes" % len(data))
+            return
+        self.stats["rx datagrams"] += 1
+        self.stats["rx bytes"] += len(data)
+        try:
+            msg = decode(data)
+        except (ValueError, IndexError, struct.error):
+            self.log(peer, "Malformed datagram (%u bytes)" % len(data))
+            return
+        self.handle_message(msg, peer)
+
+    def run(self):
+        print("LwM2M server stand-in listening on %s:%u (%s)"
+              % (self.args.address, self.args.port, "TCP" if self.args.tcp else "UDP"))
+        while True:
+            readable, _, _ = select.select([self.sock] + list(self.connections.values()), [], [])
+            for sock in readable:
+                if sock is not self.sock:
+                    peer = next((p for p, c in self.connections.items() if c is sock), None)
+                    if peer is not None:
+                        self.read_stream(peer)
+                elif self.args.tcp:
+                    self.accept()
+                else:
+                    self.read_datagram()
+
+    def summary(self):
+        print("\n%.3f s:" % (time.monotonic() - self.start))
+        for key in sorted(self.stats):
+            print("  %-14s %u" % (key, self.stats[key]))
+
+
+def parse_outage(text):
+    try:
+        start, duration = (float(value) for value in text.split(":"))
+    except ValueError:
+        raise argparse.ArgumentTypeError("expected START:DURATION in seconds, not %r" % text)
+    return start, duration
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--address", default="0.0.0.0", help="address to bind to")
+    parser.add_argument("--port", type=int, default=5683, help="UDP or TCP port to listen on")
+    parser.add_argument("--tcp", action="store_true",
+                        help="serve CoAP over TCP (RFC 8323) instead of UDP")
+    parser.add_argument("--observe", action="append", default=[], metavar="PATH",
+                        help="resource to observe after each registration, e.g. /3316/0/5700")
+    parser.add_argument("--burst", type=int, default=0, metavar="COUNT",
+                        help="reads sent at once after each registration, timed until all are answered")
+    parser.add_argument("--burst-path", default="/3/0", metavar="PATH",
+                        help="resource read by the bursts")
+    parser.add_argument("--fota", metavar="URI",
+                        help="Package URI written after each registration, the Update is executed once downloaded")
+    parser.add_argument("--delay", type=int, default=0, metavar="MS",
+                        help="delay before each outgoing datagram, to emulate the network latency")
+    parser.add_argument("--loss", type=float, default=0.0, metavar="RATIO",
+                        help="ratio of incoming datagrams to drop, to exercise retransmissions (UDP only)")
+    parser.add_argument("--outage", action="append", default=[], type=parse_outage, metavar="START:DURATION",
+                        help="drop all the datagrams for DURATION seconds from START seconds after the start,"
+                             " to emulate a coverage gap (UDP only)")
+    parser.add_argument("--oscore", action="store_true",
+                        help="require the requests to be protected with OSCORE")
+    parser.add_argument("--oscore-secret", default="0102030405060708090a0b0c0d0e0f10", metavar="HEX",
+                        help="OSCORE master secret")
+    parser.add_argument("--oscore-salt", default="9e7ca92223786340", metavar="HEX",
+                        help="OSCORE master salt")
+    parser.add_argument("--oscore-client-id", default="00", metavar="HEX",
+                        help="OSCORE sender ID of the client")
+    parser.add_argument("--oscore-server-id", default="01", metavar="HEX",
+                        help="OSCORE sender ID of the server")
+    server = Server(parser.parse_args())
+    try:
+        server.run()
+    except KeyboardInterrupt:
+        server.summary()
+
+
+if __name__ == "__main__":
+    main()
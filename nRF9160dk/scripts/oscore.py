@@ -0,0 +1,204 @@
+#
+# Copyright (c) 2021 IoTerop
+# SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+#
+"""OSCORE (RFC 8613) message protection for the LwM2M server stand-in.
+
+Only the default algorithms are supported: AES-CCM-16-64-128 and
+HKDF-SHA256, without ID Context. The messages are handled as their
+plaintext (code, Inner options and payload, see RFC 8613 section 5.3):
+the CoAP encoding is left to the caller.
+
+Needs the "cryptography" package for AES-CCM. Running this file checks
+the implementation against the test vectors of RFC 8613 appendix C.
+"""
+
+import hashlib
+import hmac
+
+ALG_AES_CCM_16_64_128 = 10
+KEY_LENGTH = 16
+NONCE_LENGTH = 13
+TAG_LENGTH = 8
+
+FLAG_KID = 0x08
+FLAG_KID_CONTEXT = 0x10
+PIV_LENGTH_MASK = 0x07
+
+
+class OscoreError(Exception):
+    pass
+
+
+def _cbor_head(major, value):
+    if value < 24:
+        return bytes([(major << 5) | value])
+    if value < 256:
+        return bytes([(major << 5) | 24, value])
+    return bytes([(major << 5) | 25]) + value.to_bytes(2, "big")
+
+
+def _bstr(value):
+    return _cbor_head(2, len(value)) + value
+
+
+def _tstr(value):
+    return _cbor_head(3, len(value)) + value.encode()
+
+
+def _hkdf(salt, secret, info, length):
+    prk = hmac.new(salt, secret, hashlib.sha256).digest()
+    # One block is enough for the key and IV lengths
+    return hmac.new(prk, info + b"\x01", hashlib.sha256).digest()[:length]
+
+
+def _piv(sequence):
+    return sequence.to_bytes(max(1, (sequence.bit_length() + 7) // 8), "big")
+
+
+class Context:
+    """Security context of one endpoint, derived as in RFC 8613 section 3.2."""
+
+    def __init__(self, secret, salt, sender_id, recipient_id):
+        from cryptography.hazmat.primitives.ciphers.aead import AESCCM
+
+        if len(sender_id) > NONCE_LENGTH - 6 or len(recipient_id) > NONCE_LENGTH - 6:
+            raise OscoreError("sender and recipient IDs are limited to %u bytes" % (NONCE_LENGTH - 6))
+        self.sender_id = sender_id
+        self.recipient_id = recipient_id
+        self.sender_key = self._derive(salt, secret, sender_id, "Key", KEY_LENGTH)
+        self.recipient_key = self._derive(salt, secret, recipient_id, "Key", KEY_LENGTH)
+        self.common_iv = self._derive(salt, secret, b"", "IV", NONCE_LENGTH)
+        self.sender_aead = AESCCM(self.sender_key, tag_length=TAG_LENGTH)
+        self.recipient_aead = AESCCM(self.recipient_key, tag_length=TAG_LENGTH)
+        self.sequence = 0
+        self.seen = set()
+
+    @staticmethod
+    def _derive(salt, secret, identifier, kind, length):
+        # info = [id, id_context (nil), alg_aead, type, L]
+        info = b"\x85" + _bstr(identifier) + b"\xf6" + _cbor_head(0, ALG_AES_CCM_16_64_128) \
+            + _tstr(kind) + _cbor_head(0, length)
+        return _hkdf(salt, secret, info, length)
+
+    def _nonce(self, identifier, piv):
+        padded = bytes([len(identifier)]) + identifier.rjust(NONCE_LENGTH - 6, b"\0") + piv.rjust(5, b"\0")
+        return bytes(a ^ b for (a, b) in zip(padded, self.common_iv))
+
+    @staticmethod
+    def _aad(request_kid, request_piv):
+        external = b"\x85\x01\x81" + _cbor_head(0, ALG_AES_CCM_16_64_128) \
+            + _bstr(request_kid) + _bstr(request_piv) + _bstr(b"")
+        return b"\x83" + _tstr("Encrypt0") + _bstr(b"") + _bstr(external)
+
+    def _next_piv(self):
+        piv = _piv(self.sequence)
+        self.sequence += 1
+        return piv
+
+    def protect(self, plaintext, request=None, partial_iv=False, sequence=None):
+        """Encrypts a plaintext.
+
+        Without request, the plaintext is a request: returns the OSCORE option
+        value, the ciphertext and the (kid, piv) binding of the request.
+        With the binding of the request, the plaintext is a response, with
+        its own Partial IV if partial_iv is set (Observe notifications).
+        """
+        if request is None or partial_iv:
+            piv = _piv(sequence) if sequence is not None else self._next_piv()
+            nonce = self._nonce(self.sender_id, piv)
+        else:
+            piv = b""
+            nonce = self._nonce(request[0], request[1])
+
+        if request is None:
+            request = (self.sender_id, piv)
+            option = bytes([len(piv) | FLAG_KID]) + piv + self.sender_id
+        elif piv:
+            option = bytes([len(piv)]) + piv
+        else:
+            option = b""
+
+        ciphertext = self.sender_aead.encrypt(nonce, plaintext, self._aad(*request))
+        return option, ciphertext, request
+
+    def unprotect(self, option, ciphertext, request=None):
+        """Decrypts a ciphertext and returns the plaintext and the (kid, piv)
+        binding of the request, see protect()."""
+        if option:
+            flags = option[0]
+            pos = 1 + (flags & PIV_LENGTH_MASK)
+            piv = option[1:pos]
+            if flags & FLAG_KID_CONTEXT:
+                pos += 1 + option[pos]
+            kid = option[pos:] if flags & FLAG_KID else None
+        else:
+            piv = b""
+            kid = None
+
+        if request is None:
+            if kid is None or not piv:
+                raise OscoreError("request without kid or Partial IV")
+            if kid != self.recipient_id:
+                raise OscoreError("unknown kid %s" % kid.hex())
+            request = (kid, piv)
+        if piv:
+            sequence = int.from_bytes(piv, "big")
+            if sequence in self.seen:
+                raise OscoreError("replayed Partial IV %u" % sequence)
+            nonce = self._nonce(self.recipient_id, piv)
+        else:
+            nonce = self._nonce(request[0], request[1])
+
+        try:
+            plaintext = self.recipient_aead.decrypt(nonce, ciphertext, self._aad(*request))
+        except Exception as error:
+            raise OscoreError("decryption failed") from error
+        if piv:
+            self.seen.add(sequence)
+        return plaintext, request
+
+
+def _self_test():
+    secret = bytes.fromhex("0102030405060708090a0b0c0d0e0f10")
+    salt = bytes.fromhex("9e7ca92223786340")
+    client = Context(secret, salt, b"", b"\x01")
+    server = Context(secret, salt, b"\x01", b"")
+
+    # C.1.1
+    assert client.sender_key.hex() == "f0910ed7295e6ad4b54fc793154302ff"
+    assert client.recipient_key.hex() == "ffb14e093c94c9cac9471648b4f98710"
+    assert client.common_iv.hex() == "4622d4dd6d944168eefb54987c"
+
+    # C.4: GET /tv1, plaintext is the code and the Uri-Path option
+    option, ciphertext, request = client.protect(bytes.fromhex("01b3747631"), sequence=20)
+    assert option.hex() == "0914"
+    assert ciphertext.hex() == "612f1092f1776f1c1668b3825e"
+    plaintext, binding = server.unprotect(option, ciphertext)
+    assert plaintext.hex() == "01b3747631" and binding == request
+
+    # C.7: 2.05 "Hello World!"
+    option, ciphertext, _ = server.protect(bytes.fromhex("45ff48656c6c6f20576f726c6421"), request)
+    assert option == b""
+    assert ciphertext.hex() == "dbaad1e9a7e7b2a813d3c31524378303cdafae119106"
+    plaintext, _ = client.unprotect(option, ciphertext, request)
+    assert plaintext.hex() == "45ff48656c6c6f20576f726c6421"
+
+    # C.8: same with a Partial IV
+    option, ciphertext, _ = server.protect(bytes.fromhex("45ff48656c6c6f20576f726c6421"), request,
+                                           partial_iv=True, sequence=0)
+    assert option.hex() == "0100"
+    assert ciphertext.hex() == "4d4c13669384b67354b2b6175ff4b8658c666a6cf88e"
+
+    try:
+        server.unprotect(bytes.fromhex("0914"), bytes.fromhex("612f1092f1776f1c1668b3825e"))
+    except OscoreError:
+        pass
+    else:
+        raise AssertionError("replay not detected")
+
+    print("RFC 8613 test vectors: OK")
+
+
+if __name__ == "__main__":
+    _self_test()
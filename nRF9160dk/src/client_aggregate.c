@@ -0,0 +1,73 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the running statistics
+ * of a sensor over a time window.
+ *
+ **********************************************/
+
+#include "client_aggregate.h"
+
+#include <zephyr.h>
+#include <string.h>
+
+void client_aggregate_init(client_aggregate_t *aggregateP)
+{
+    memset(aggregateP, 0, sizeof(client_aggregate_t));
+}
+
+void client_aggregate_add(client_aggregate_t *aggregateP,
+                          float value)
+{
+    if (aggregateP->count == 0)
+    {
+        aggregateP->min = value;
+        aggregateP->max = value;
+    }
+    else if (value < aggregateP->min)
+    {
+        aggregateP->min = value;
+    }
+    else if (value > aggregateP->max)
+    {
+        aggregateP->max = value;
+    }
+
+    aggregateP->count++;
+    aggregateP->sum += value;
+    aggregateP->last = value;
+    aggregateP->sampleCount++;
+}
+
+size_t client_aggregate_close(client_aggregate_t *aggregateP,
+                              int32_t timestamp,
+                              iowa_ipso_timed_value_t *valueP,
+                              float *minP,
+                              float *maxP)
+{
+    if (aggregateP->count == 0)
+    {
+        return 0;
+    }
+
+#if defined(CONFIG_IOWA_AGGREGATE_PUBLISH_LAST)
+    valueP->value = aggregateP->last;
+#else
+    valueP->value = aggregateP->sum / aggregateP->count;
+#endif
+    valueP->timestamp = timestamp;
+    *minP = aggregateP->min;
+    *maxP = aggregateP->max;
+
+    aggregateP->count = 0;
+    aggregateP->sum = 0;
+    aggregateP->windowCount++;
+
+    return 1;
+}
@@ -0,0 +1,58 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Windowed aggregation of sensor samples.
+ *
+ * Samples are reduced to their minimum, maximum,
+ * mean and last value over a window closed every
+ * CONFIG_IOWA_AGGREGATE_WINDOW seconds. Only the
+ * window result reaches the IOWA stack: the mean,
+ * or the last value, as the Sensor Value, the
+ * extremes as the Min and Max Measured Values.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_AGGREGATE_INCLUDE_
+#define _CLIENT_AGGREGATE_INCLUDE_
+
+#include "iowa_ipso.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t count;
+    float sum;
+    float last;
+    float min;
+    float max;
+
+    uint32_t sampleCount;
+    uint32_t windowCount;
+} client_aggregate_t;
+
+void client_aggregate_init(client_aggregate_t *aggregateP);
+
+// Adds a sample to the current window.
+void client_aggregate_add(client_aggregate_t *aggregateP,
+                          float value);
+
+// Closes the current window, called by the window timer.
+// The window result is written in valueP, with timestamp as its time,
+// and the extremes of the window in minP and maxP.
+// Returns the number of values written in valueP, 0 when no sample came
+// during the window.
+size_t client_aggregate_close(client_aggregate_t *aggregateP,
+                              int32_t timestamp,
+                              iowa_ipso_timed_value_t *valueP,
+                              float *minP,
+                              float *maxP);
+
+#endif
@@ -0,0 +1,139 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the sample queue used to
+ * report several measures in one message instead
+ * of one message per measure.
+ *
+ **********************************************/
+
+#include "client_batch.h"
+
+#include <zephyr.h>
+#include <string.h>
+
+// The samples of a batch, or of a store drain
+#if defined(CONFIG_IOWA_STORE)
+#define PRV_SEND_SIZE MAX(CONFIG_IOWA_BATCH_SIZE, CONFIG_IOWA_STORE_DRAIN_SAMPLES)
+#else
+#define PRV_SEND_SIZE CONFIG_IOWA_BATCH_SIZE
+#endif
+
+static iowa_lwm2m_data_t prv_dataArray[PRV_SEND_SIZE];
+
+void client_batch_init(client_batch_t *batchP)
+{
+    memset(batchP, 0, sizeof(client_batch_t));
+}
+
+bool client_batch_add(client_batch_t *batchP,
+                      float value,
+                      int32_t timestamp)
+{
+    if (batchP->count == CONFIG_IOWA_BATCH_SIZE)
+    {
+        // A previous flush failed: keep the most recent samples
+        memmove(batchP->valueArray, batchP->valueArray + 1, (CONFIG_IOWA_BATCH_SIZE - 1) * sizeof(iowa_ipso_timed_value_t));
+        batchP->count--;
+        batchP->droppedCount++;
+    }
+
+    batchP->valueArray[batchP->count].value = value;
+    batchP->valueArray[batchP->count].timestamp = timestamp;
+    batchP->count++;
+    batchP->sampleCount++;
+    atomic_set(&(batchP->dueTime), batchP->valueArray[0].timestamp + CONFIG_IOWA_BATCH_MAX_AGE);
+
+    return batchP->count == CONFIG_IOWA_BATCH_SIZE
+           || client_batch_is_due(batchP, timestamp);
+}
+
+bool client_batch_is_due(client_batch_t *batchP,
+                         int32_t now)
+{
+    atomic_val_t dueTime;
+
+    dueTime = atomic_get(&(batchP->dueTime));
+
+    return dueTime != 0
+           && now >= dueTime;
+}
+
+void client_batch_clear(client_batch_t *batchP)
+{
+    batchP->count = 0;
+    atomic_clear(&(batchP->dueTime));
+}
+
+iowa_status_t client_batch_send(iowa_context_t contextP,
+                                uint16_t shortId,
+                                const iowa_lwm2m_uri_t *uriP,
+                                const iowa_ipso_timed_value_t *valueArray,
+                                size_t count,
+                                iowa_response_callback_t responseCb,
+                                void *userDataP)
+{
+    int32_t now;
+    size_t i;
+
+    if (count > PRV_SEND_SIZE)
+    {
+        return IOWA_COAP_413_REQUEST_ENTITY_TOO_LARGE;
+    }
+
+    now = iowa_system_gettime();
+
+    memset(prv_dataArray, 0, count * sizeof(iowa_lwm2m_data_t));
+    for (i = 0; i < count; i++)
+    {
+        prv_dataArray[i].objectID = uriP->objectId;
+        prv_dataArray[i].instanceID = uriP->instanceId;
+        prv_dataArray[i].resourceID = uriP->resourceId;
+        prv_dataArray[i].resInstanceID = IOWA_LWM2M_ID_ALL;
+        prv_dataArray[i].type = IOWA_LWM2M_TYPE_FLOAT;
+        prv_dataArray[i].value.asFloat = valueArray[i].value;
+
+        // An uptime means nothing to the server: it is made relative to
+        // the time the message is built
+        if (valueArray[i].timestamp >= CLIENT_BATCH_UNIX_TIME_MIN)
+        {
+            prv_dataArray[i].timestamp = valueArray[i].timestamp;
+        }
+        else
+        {
+            prv_dataArray[i].timestamp = MIN(valueArray[i].timestamp - now, 0);
+        }
+    }
+
+    return iowa_client_send_data(contextP, shortId, prv_dataArray, count, responseCb, userDataP);
+}
+
+iowa_status_t client_batch_flush(client_batch_t *batchP,
+                                 iowa_context_t contextP,
+                                 uint16_t shortId,
+                                 const iowa_lwm2m_uri_t *uriP,
+                                 iowa_response_callback_t responseCb,
+                                 void *userDataP)
+{
+    iowa_status_t result;
+
+    if (batchP->count == 0)
+    {
+        return IOWA_COAP_NO_ERROR;
+    }
+
+    result = client_batch_send(contextP, shortId, uriP, batchP->valueArray, batchP->count, responseCb, userDataP);
+    if (result == IOWA_COAP_NO_ERROR)
+    {
+        client_batch_clear(batchP);
+        batchP->flushCount++;
+    }
+
+    return result;
+}
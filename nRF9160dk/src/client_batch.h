@@ -0,0 +1,84 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Queue of timestamped sensor samples, flushed
+ * to the server in a single LwM2M Send.
+ *
+ * The timestamps are Unix times once the real
+ * time is known, uptimes in seconds before.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_BATCH_INCLUDE_
+#define _CLIENT_BATCH_INCLUDE_
+
+#include "iowa_client.h"
+#include "iowa_ipso.h"
+
+#include <zephyr.h>
+#include <stdbool.h>
+
+// A timestamp from this value on is a Unix time, below it an uptime, as
+// for the SenML times (RFC 8428)
+#define CLIENT_BATCH_UNIX_TIME_MIN (1 << 28)
+
+typedef struct
+{
+    iowa_ipso_timed_value_t valueArray[CONFIG_IOWA_BATCH_SIZE];
+    size_t count;
+    // time the oldest sample reaches CONFIG_IOWA_BATCH_MAX_AGE, 0 when
+    // empty, readable from another thread
+    atomic_t dueTime;
+
+    uint32_t sampleCount;
+    uint32_t droppedCount;
+    uint32_t flushCount;
+} client_batch_t;
+
+void client_batch_init(client_batch_t *batchP);
+
+// Queues a sample. When the queue is full, the oldest sample is dropped.
+// Returns true if the queue is due for a flush, either because it reached
+// CONFIG_IOWA_BATCH_SIZE samples or because its oldest sample is
+// CONFIG_IOWA_BATCH_MAX_AGE seconds old.
+bool client_batch_add(client_batch_t *batchP,
+                      float value,
+                      int32_t timestamp);
+
+// Returns true if the oldest queued sample is CONFIG_IOWA_BATCH_MAX_AGE
+// seconds old at now. Can be called from any thread.
+bool client_batch_is_due(client_batch_t *batchP,
+                         int32_t now);
+
+// Empties the queue.
+void client_batch_clear(client_batch_t *batchP);
+
+// Sends count samples to the server shortId as timestamped values of the
+// resource uriP, in a LwM2M Send. The sensor object is not updated, so that
+// its observers do not get the samples a second time. The Unix timestamps
+// are sent as they are, the uptimes as negative times relative to now.
+// Called by a single thread: the message is built in a static buffer.
+iowa_status_t client_batch_send(iowa_context_t contextP,
+                                uint16_t shortId,
+                                const iowa_lwm2m_uri_t *uriP,
+                                const iowa_ipso_timed_value_t *valueArray,
+                                size_t count,
+                                iowa_response_callback_t responseCb,
+                                void *userDataP);
+
+// Sends all the queued samples with client_batch_send(). The queue is
+// emptied on success only.
+iowa_status_t client_batch_flush(client_batch_t *batchP,
+                                 iowa_context_t contextP,
+                                 uint16_t shortId,
+                                 const iowa_lwm2m_uri_t *uriP,
+                                 iowa_response_callback_t responseCb,
+                                 void *userDataP);
+
+#endif
@@ -0,0 +1,166 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the command queue
+ * drained by the IOWA thread.
+ *
+ **********************************************/
+
+#include "client_command.h"
+
+#include <string.h>
+#include <errno.h>
+
+void client_command_init(client_command_queue_t *queueP,
+                         iowa_context_t contextP)
+{
+    memset(queueP, 0, sizeof(client_command_queue_t));
+
+    queueP->contextP = contextP;
+    k_msgq_init(&(queueP->msgq), queueP->buffer, sizeof(client_command_t), CONFIG_IOWA_COMMAND_QUEUE_DEPTH);
+}
+
+int client_command_post(client_command_queue_t *queueP,
+                        const client_command_t *commandP)
+{
+    atomic_val_t depth;
+    atomic_val_t maxDepth;
+
+    if (k_msgq_put(&(queueP->msgq), commandP, K_NO_WAIT) != 0)
+    {
+        atomic_inc(&(queueP->droppedCount));
+        return -ENOMSG;
+    }
+
+    atomic_inc(&(queueP->postedCount));
+    depth = (atomic_val_t)k_msgq_num_used_get(&(queueP->msgq));
+    do
+    {
+        maxDepth = atomic_get(&(queueP->maxDepth));
+    } while (depth > maxDepth
+             && !atomic_cas(&(queueP->maxDepth), maxDepth, depth));
+
+    // Make the running iowa_step() return so that the IOWA thread drains
+    // the queue. Every post does it: a stop skipped because another one
+    // looked pending could be the one arriving between the drain and the
+    // next iowa_step(), and be lost.
+    iowa_stop(queueP->contextP);
+
+    return 0;
+}
+
+void client_command_process(client_command_queue_t *queueP)
+{
+    client_command_t command;
+
+    while (k_msgq_get(&(queueP->msgq), &command, K_NO_WAIT) == 0)
+    {
+        command.handler(queueP->contextP, &command);
+    }
+}
+
+bool client_command_pending(client_command_queue_t *queueP)
+{
+    return k_msgq_num_used_get(&(queueP->msgq)) != 0;
+}
+
+#if defined(CONFIG_IOWA_COMMAND_STRESS)
+
+#define PRV_STRESS_STACK_SIZE KB(1)
+#define PRV_STRESS_PRIORITY K_PRIO_COOP(CONFIG_NUM_COOP_PRIORITIES - 1)
+
+static K_KERNEL_STACK_ARRAY_DEFINE(prv_stressStackArray, CONFIG_IOWA_COMMAND_STRESS_THREADS, PRV_STRESS_STACK_SIZE);
+static struct k_thread prv_stressThreadArray[CONFIG_IOWA_COMMAND_STRESS_THREADS];
+
+static atomic_t prv_stressPostedCount;
+static atomic_t prv_stressDroppedCount;
+// Only updated by the IOWA thread
+static uint32_t prv_stressExecutedCount;
+static int64_t prv_stressMaxDelay;
+
+static void prv_stressHandler(iowa_context_t contextP,
+                              const client_command_t *commandP)
+{
+    int64_t delay;
+
+    (void)contextP;
+
+    prv_stressExecutedCount++;
+    delay = k_uptime_get() - commandP->postTime;
+    if (delay > prv_stressMaxDelay)
+    {
+        prv_stressMaxDelay = delay;
+    }
+}
+
+static void prv_stressFn(void *arg1,
+                         void *arg2,
+                         void *arg3)
+{
+    client_command_queue_t *queueP;
+    client_command_t command;
+    uint32_t index;
+
+    queueP = (client_command_queue_t *)arg1;
+    index = (uint32_t)(uintptr_t)arg2;
+    (void)arg3;
+
+    memset(&command, 0, sizeof(client_command_t));
+    command.handler = prv_stressHandler;
+
+    // Spread the producers over the period, so that their posts fall at
+    // any point of the IOWA thread loop
+    k_msleep(index * CONFIG_IOWA_COMMAND_STRESS_PERIOD / CONFIG_IOWA_COMMAND_STRESS_THREADS);
+
+    while (1)
+    {
+        command.postTime = k_uptime_get();
+        if (client_command_post(queueP, &command) == 0)
+        {
+            atomic_inc(&prv_stressPostedCount);
+        }
+        else
+        {
+            atomic_inc(&prv_stressDroppedCount);
+        }
+        k_msleep(CONFIG_IOWA_COMMAND_STRESS_PERIOD);
+    }
+}
+
+void client_command_stress_start(client_command_queue_t *queueP)
+{
+    uint32_t i;
+
+    for (i = 0; i < CONFIG_IOWA_COMMAND_STRESS_THREADS; i++)
+    {
+        k_thread_create(prv_stressThreadArray + i,
+                        prv_stressStackArray[i],
+                        K_KERNEL_STACK_SIZEOF(prv_stressStackArray[i]),
+                        prv_stressFn,
+                        queueP, (void *)(uintptr_t)i, NULL,
+                        PRV_STRESS_PRIORITY, 0, K_NO_WAIT);
+    }
+}
+
+void client_command_stress_print_stats(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < CONFIG_IOWA_COMMAND_STRESS_THREADS; i++)
+    {
+        k_thread_abort(prv_stressThreadArray + i);
+    }
+
+    // A lost stop shows as a delay of a whole iowa_step() timeout
+    printk("Command stress: %u posted, %u executed, %u dropped, delay up to %u ms\n",
+           (uint32_t)atomic_get(&prv_stressPostedCount), prv_stressExecutedCount,
+           (uint32_t)atomic_get(&prv_stressDroppedCount), (uint32_t)prv_stressMaxDelay);
+}
+
+#endif
@@ -0,0 +1,87 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Command queue from the application threads to
+ * the thread running iowa_step().
+ *
+ * Application threads post commands without
+ * touching the IOWA stack. The IOWA thread
+ * executes them between two calls to iowa_step().
+ *
+ **********************************************/
+
+#ifndef _CLIENT_COMMAND_INCLUDE_
+#define _CLIENT_COMMAND_INCLUDE_
+
+#include "iowa_client.h"
+#include "iowa_ipso.h"
+
+#include <zephyr.h>
+
+// A sample, the result of an aggregation window, or its minimum and
+// maximum
+#define CLIENT_COMMAND_MAX_VALUES 2
+
+typedef struct _client_command_t client_command_t;
+
+// Executed on the IOWA thread.
+typedef void (*client_command_handler_t)(iowa_context_t contextP,
+                                         const client_command_t *commandP);
+
+struct _client_command_t
+{
+    client_command_handler_t handler;
+    iowa_sensor_t sensorId;
+    size_t valueCount;
+    iowa_ipso_timed_value_t valueArray[CLIENT_COMMAND_MAX_VALUES];
+#if defined(CONFIG_IOWA_COMMAND_STRESS)
+    int64_t postTime;
+#endif
+};
+
+typedef struct
+{
+    iowa_context_t contextP;
+    struct k_msgq msgq;
+    char buffer[CONFIG_IOWA_COMMAND_QUEUE_DEPTH * sizeof(client_command_t)] __aligned(8);
+
+    // Posted from several threads
+    atomic_t postedCount;
+    atomic_t droppedCount;
+    atomic_t maxDepth;
+} client_command_queue_t;
+
+void client_command_init(client_command_queue_t *queueP,
+                         iowa_context_t contextP);
+
+// Can be called from any thread. Returns 0 or -ENOMSG if the queue is full.
+int client_command_post(client_command_queue_t *queueP,
+                        const client_command_t *commandP);
+
+// Executes all the queued commands. To be called by the thread running
+// iowa_step(), outside of it.
+void client_command_process(client_command_queue_t *queueP);
+
+// Returns true if commands are queued. A command posted while the IOWA
+// thread is outside of iowa_step() may not stop the next one: this is
+// checked before entering it.
+bool client_command_pending(client_command_queue_t *queueP);
+
+#if defined(CONFIG_IOWA_COMMAND_STRESS)
+// Starts CONFIG_IOWA_COMMAND_STRESS_THREADS threads posting empty
+// commands every CONFIG_IOWA_COMMAND_STRESS_PERIOD ms, and measures the
+// delay until the IOWA thread executes them.
+void client_command_stress_start(client_command_queue_t *queueP);
+
+// Prints the stress commands posted, executed and dropped, and their
+// longest delay.
+void client_command_stress_print_stats(void);
+#endif
+
+#endif
@@ -0,0 +1,317 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the saved IOWA context.
+ *
+ * The context is saved as a single settings
+ * record, prefixed by a hash of the layout given
+ * by the application. It is saved after each
+ * new registration, as the location changes, and
+ * when the client stops. The registration
+ * updates only change its timers: an identical
+ * context is not written again.
+ *
+ * Everything runs on the IOWA thread, but for
+ * the statistics printed once the stack is
+ * closed.
+ *
+ **********************************************/
+
+#include "client_context.h"
+#include "client_platform.h"
+#include "iowa_platform.h"
+
+#include <zephyr.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <settings/settings.h>
+
+#define PRV_SETTINGS_TREE "iowa/context"
+#define PRV_SETTINGS_KEY  PRV_SETTINGS_TREE "/data"
+
+// FNV-1a
+#define PRV_HASH_BASIS 2166136261u
+#define PRV_HASH_PRIME 16777619u
+
+typedef struct
+{
+    uint32_t layoutHash;
+    uint8_t data[CONFIG_IOWA_WARM_START_MAX_SIZE];
+} context_record_t;
+
+#define PRV_RECORD_HEADER_SIZE offsetof(context_record_t, data)
+
+// Last context loaded or saved, prv_recordLength is 0 when none
+static context_record_t prv_record;
+static size_t prv_recordLength;
+static uint32_t prv_layoutHash;
+
+static void *prv_platformDataP;
+static bool prv_restored;
+static bool prv_fellBack;
+static bool prv_newRegistration;
+static bool prv_registered;
+static bool prv_savePending;
+
+static int64_t prv_startTime;
+static int64_t prv_registeredTime;
+static int64_t prv_reportedTime;
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+static platform_traffic_t prv_registeredTraffic;
+#endif
+static size_t prv_contextSize;
+static uint32_t prv_saveCount;
+static uint32_t prv_unchangedCount;
+static uint32_t prv_failureCount;
+
+static uint32_t prv_hash(const char *textP)
+{
+    uint32_t hash;
+
+    hash = PRV_HASH_BASIS;
+    while (*textP != 0)
+    {
+        hash ^= (uint8_t)*textP;
+        hash *= PRV_HASH_PRIME;
+        textP++;
+    }
+
+    return hash;
+}
+
+static int prv_settingsSet(const char *key,
+                           size_t len,
+                           settings_read_cb readCb,
+                           void *cbArg)
+{
+    if (strcmp(key, "data") != 0)
+    {
+        return -ENOENT;
+    }
+    if (len <= PRV_RECORD_HEADER_SIZE
+        || len > sizeof(context_record_t))
+    {
+        // Saved by a build with a different size limit
+        return 0;
+    }
+    if (readCb(cbArg, &prv_record, len) != len)
+    {
+        return -EIO;
+    }
+    prv_recordLength = len - PRV_RECORD_HEADER_SIZE;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(iowa_context, PRV_SETTINGS_TREE, NULL, prv_settingsSet, NULL, NULL);
+
+static void prv_save(iowa_context_t contextP)
+{
+    iowa_status_t result;
+
+    // Calls iowa_system_store_context()
+    result = iowa_save_context_snapshot(contextP);
+    if (result != IOWA_COAP_NO_ERROR)
+    {
+        printk("Warm start: saving the context failed (%u.%02u)\n", (result & 0xFF) >> 5, (result & 0x1F));
+    }
+}
+
+iowa_status_t client_context_load(iowa_context_t contextP,
+                                  void *platformDataP,
+                                  const char *layoutP)
+{
+    iowa_status_t result;
+    int err;
+
+    prv_platformDataP = platformDataP;
+    prv_startTime = k_uptime_get();
+    prv_layoutHash = prv_hash(layoutP);
+
+    err = settings_subsys_init();
+    if (err == 0)
+    {
+        err = settings_load_subtree(PRV_SETTINGS_TREE);
+    }
+    if (err != 0)
+    {
+        printk("Warm start: loading the settings failed (%d)\n", err);
+    }
+
+    if (prv_recordLength == 0)
+    {
+        return IOWA_COAP_404_NOT_FOUND;
+    }
+    if (prv_record.layoutHash != prv_layoutHash)
+    {
+        printk("Warm start: the saved context is for another server or object list\n");
+        prv_recordLength = 0;
+        return IOWA_COAP_404_NOT_FOUND;
+    }
+
+    // Calls iowa_system_retrieve_context()
+    result = iowa_load_context(contextP);
+    if (result != IOWA_COAP_NO_ERROR)
+    {
+        printk("Warm start: loading the context failed (%u.%02u)\n", (result & 0xFF) >> 5, (result & 0x1F));
+        prv_recordLength = 0;
+        return result;
+    }
+
+    prv_restored = true;
+    prv_contextSize = prv_recordLength;
+    printk("Warm start: context restored (%u bytes)\n", (uint32_t)prv_recordLength);
+
+    return IOWA_COAP_NO_ERROR;
+}
+
+void client_context_registering(void)
+{
+    // A full Register: the location changes
+    prv_newRegistration = true;
+    if (prv_restored)
+    {
+        prv_fellBack = true;
+    }
+}
+
+void client_context_registered(iowa_context_t contextP)
+{
+    prv_registered = true;
+    if (prv_registeredTime == 0)
+    {
+        prv_registeredTime = k_uptime_get();
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+        platform_get_traffic(prv_platformDataP, &prv_registeredTraffic);
+#endif
+    }
+
+    if (prv_newRegistration)
+    {
+        // The stack can not be saved from its own callback
+        prv_newRegistration = false;
+        prv_savePending = true;
+        iowa_stop(contextP);
+    }
+}
+
+void client_context_reported(void)
+{
+    if (prv_reportedTime == 0)
+    {
+        prv_reportedTime = k_uptime_get();
+    }
+}
+
+void client_context_process(iowa_context_t contextP)
+{
+    if (!prv_savePending)
+    {
+        return;
+    }
+    prv_savePending = false;
+
+    prv_save(contextP);
+}
+
+void client_context_save(iowa_context_t contextP)
+{
+    if (contextP == NULL
+        || !prv_registered)
+    {
+        return;
+    }
+
+    prv_save(contextP);
+}
+
+size_t client_context_store(const uint8_t *bufferP,
+                            size_t length)
+{
+    int err;
+
+    prv_contextSize = length;
+    if (length == 0
+        || length > CONFIG_IOWA_WARM_START_MAX_SIZE)
+    {
+        printk("Warm start: the context (%u bytes) does not fit in CONFIG_IOWA_WARM_START_MAX_SIZE\n", (uint32_t)length);
+        prv_failureCount++;
+        return 0;
+    }
+
+    if (prv_recordLength == length
+        && prv_record.layoutHash == prv_layoutHash
+        && memcmp(prv_record.data, bufferP, length) == 0)
+    {
+        prv_unchangedCount++;
+        return length;
+    }
+
+    prv_record.layoutHash = prv_layoutHash;
+    memcpy(prv_record.data, bufferP, length);
+    prv_recordLength = length;
+
+    err = settings_save_one(PRV_SETTINGS_KEY, &prv_record, PRV_RECORD_HEADER_SIZE + length);
+    if (err != 0)
+    {
+        printk("Warm start: writing the context failed (%d)\n", err);
+        prv_recordLength = 0;
+        prv_failureCount++;
+        return 0;
+    }
+    prv_saveCount++;
+
+    return length;
+}
+
+size_t client_context_retrieve(uint8_t **bufferP)
+{
+    uint8_t *dataP;
+
+    if (prv_recordLength == 0)
+    {
+        return 0;
+    }
+
+    // Freed by the stack
+    dataP = (uint8_t *)iowa_system_malloc(prv_recordLength);
+    if (dataP == NULL)
+    {
+        return 0;
+    }
+    memcpy(dataP, prv_record.data, prv_recordLength);
+    *bufferP = dataP;
+
+    return prv_recordLength;
+}
+
+void client_context_print_stats(void)
+{
+    printk("Warm start: %s, context %u bytes, %u saves, %u unchanged, %u failed\n",
+           prv_fellBack ? "context restored but registered again"
+                        : (prv_restored ? "context restored" : "cold start"),
+           (uint32_t)prv_contextSize, prv_saveCount, prv_unchangedCount, prv_failureCount);
+    if (prv_registeredTime != 0)
+    {
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+        printk("Warm start: registered %u ms after the start of the stack, %u datagrams and %u bytes sent\n",
+               (uint32_t)(prv_registeredTime - prv_startTime),
+               prv_registeredTraffic.txDatagrams, prv_registeredTraffic.txBytes);
+#else
+        printk("Warm start: registered %u ms after the start of the stack\n",
+               (uint32_t)(prv_registeredTime - prv_startTime));
+#endif
+    }
+    if (prv_reportedTime != 0)
+    {
+        printk("Warm start: first report acknowledged %u ms after the start of the stack\n",
+               (uint32_t)(prv_reportedTime - prv_startTime));
+    }
+}
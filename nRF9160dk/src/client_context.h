@@ -0,0 +1,66 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Saved IOWA context, for warm starts.
+ *
+ * Once registered, the IOWA context, with the
+ * server configuration and the registration
+ * location, is saved with the settings
+ * subsystem. At the next start, a context saved
+ * by a build with the same endpoint, server and
+ * objects is loaded back instead of adding the
+ * server, and the client resumes with a
+ * Registration Update instead of a full
+ * Register. When the server no longer knows the
+ * location, the stack falls back to a Register.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_CONTEXT_INCLUDE_
+#define _CLIENT_CONTEXT_INCLUDE_
+
+#include "iowa_client.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Loads the context saved by the last run in the IOWA context, once its
+// objects are added. layoutP describes the endpoint, the server and the
+// objects: a context saved with another layout is ignored. Returns
+// IOWA_COAP_NO_ERROR when the registration was restored, in which case
+// the server must not be added again.
+iowa_status_t client_context_load(iowa_context_t contextP,
+                                  void *platformDataP,
+                                  const char *layoutP);
+
+// Called from the IOWA event callback.
+void client_context_registering(void);
+void client_context_registered(iowa_context_t contextP);
+
+// Called on the first report acknowledged by the server.
+void client_context_reported(void);
+
+// Saves the context after a new registration. Called on the IOWA thread,
+// after iowa_step().
+void client_context_process(iowa_context_t contextP);
+
+// Saves the context before iowa_close(), instead of de-registering.
+void client_context_save(iowa_context_t contextP);
+
+// Back-end of iowa_system_store_context() and
+// iowa_system_retrieve_context().
+size_t client_context_store(const uint8_t *bufferP,
+                            size_t length);
+size_t client_context_retrieve(uint8_t **bufferP);
+
+// Prints whether the context was restored, the time to the registration
+// and to the first report, and the bytes sent until registered.
+void client_context_print_stats(void);
+
+#endif
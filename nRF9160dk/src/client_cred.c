@@ -0,0 +1,349 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the provisioning of the
+ * DTLS credentials.
+ *
+ * The PSK can not be read back from the modem:
+ * the hash saved at the last write stands for
+ * the content of the tag, and the modem is only
+ * asked whether the tag still holds a PSK and
+ * an identity. The host credential store is in
+ * RAM and empty at each boot: its tags are
+ * always written.
+ *
+ **********************************************/
+
+#include "client_cred.h"
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#if defined(CONFIG_NRF_MODEM_LIB)
+#include <modem/modem_key_mgmt.h>
+#include <modem/lte_lc.h>
+#else
+#include <net/tls_credentials.h>
+#endif
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+#include <settings/settings.h>
+#include <tinycrypt/sha256.h>
+#include <tinycrypt/constants.h>
+#endif
+
+#if !defined(CONFIG_NRF_MODEM_LIB)
+#define PRV_PSK_MAX_SIZE 64
+
+// The credential store keeps a reference to the keys
+static uint8_t prv_pskArray[CLIENT_CRED_MAX_TAGS][PRV_PSK_MAX_SIZE];
+#endif
+
+static uint32_t prv_writtenCount;
+static uint32_t prv_unchangedCount;
+static uint32_t prv_failedCount;
+static uint32_t prv_duration;
+static uint32_t prv_offlineDuration;
+
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+#define PRV_SETTINGS_TREE "iowa/cred"
+
+typedef struct
+{
+    bool valid;
+    uint32_t secTag;
+    uint8_t hash[TC_SHA256_DIGEST_SIZE];
+} cred_hash_t;
+
+static cred_hash_t prv_hashArray[CLIENT_CRED_MAX_TAGS];
+
+static cred_hash_t * prv_findHash(uint32_t secTag,
+                                  bool allocate)
+{
+    size_t i;
+
+    for (i = 0; i < CLIENT_CRED_MAX_TAGS; i++)
+    {
+        if (prv_hashArray[i].valid
+            && prv_hashArray[i].secTag == secTag)
+        {
+            return prv_hashArray + i;
+        }
+    }
+    if (!allocate)
+    {
+        return NULL;
+    }
+    for (i = 0; i < CLIENT_CRED_MAX_TAGS; i++)
+    {
+        if (!prv_hashArray[i].valid)
+        {
+            return prv_hashArray + i;
+        }
+    }
+
+    // Hashes of tags no longer provisioned
+    return prv_hashArray + CLIENT_CRED_MAX_TAGS - 1;
+}
+
+static int prv_settingsSet(const char *key,
+                           size_t len,
+                           settings_read_cb readCb,
+                           void *cbArg)
+{
+    unsigned long secTag;
+    char *endP;
+    cred_hash_t *hashP;
+
+    secTag = strtoul(key, &endP, 10);
+    if (endP == key || *endP != 0)
+    {
+        return -ENOENT;
+    }
+    if (len != TC_SHA256_DIGEST_SIZE)
+    {
+        return 0;
+    }
+    hashP = prv_findHash((uint32_t)secTag, true);
+    if (readCb(cbArg, hashP->hash, TC_SHA256_DIGEST_SIZE) != TC_SHA256_DIGEST_SIZE)
+    {
+        return -EIO;
+    }
+    hashP->secTag = (uint32_t)secTag;
+    hashP->valid = true;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(iowa_cred, PRV_SETTINGS_TREE, NULL, prv_settingsSet, NULL, NULL);
+
+static void prv_hash(const client_cred_t *credP,
+                     uint8_t *hashP)
+{
+    struct tc_sha256_state_struct state;
+
+    // The terminating zeros separate the fields
+    (void)tc_sha256_init(&state);
+    (void)tc_sha256_update(&state, (const uint8_t *)&(credP->secTag), sizeof(credP->secTag));
+    (void)tc_sha256_update(&state, (const uint8_t *)credP->identity, strlen(credP->identity) + 1);
+    (void)tc_sha256_update(&state, (const uint8_t *)credP->pskHex, strlen(credP->pskHex) + 1);
+    (void)tc_sha256_final(hashP, &state);
+}
+
+static int prv_saveHash(uint32_t secTag,
+                        const uint8_t *hashP)
+{
+    char key[sizeof(PRV_SETTINGS_TREE) + 11];
+    cred_hash_t *entryP;
+
+    entryP = prv_findHash(secTag, true);
+    entryP->valid = true;
+    entryP->secTag = secTag;
+    memcpy(entryP->hash, hashP, TC_SHA256_DIGEST_SIZE);
+
+    snprintf(key, sizeof(key), PRV_SETTINGS_TREE "/%u", secTag);
+    return settings_save_one(key, hashP, TC_SHA256_DIGEST_SIZE);
+}
+#endif
+
+#if defined(CONFIG_NRF_MODEM_LIB)
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+static bool prv_isStored(uint32_t secTag)
+{
+    bool exists;
+    uint8_t flags;
+
+    if (modem_key_mgmt_exists(secTag, MODEM_KEY_MGMT_CRED_TYPE_PSK, &exists, &flags) != 0
+        || !exists)
+    {
+        return false;
+    }
+    if (modem_key_mgmt_exists(secTag, MODEM_KEY_MGMT_CRED_TYPE_IDENTITY, &exists, &flags) != 0
+        || !exists)
+    {
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+static int prv_write(const client_cred_t *credP,
+                     size_t index)
+{
+    int err;
+
+    (void)index;
+
+    err = modem_key_mgmt_write(credP->secTag, MODEM_KEY_MGMT_CRED_TYPE_IDENTITY,
+                               credP->identity, strlen(credP->identity));
+    if (err == 0)
+    {
+        err = modem_key_mgmt_write(credP->secTag, MODEM_KEY_MGMT_CRED_TYPE_PSK,
+                                   credP->pskHex, strlen(credP->pskHex));
+    }
+
+    return err;
+}
+#else
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+static bool prv_isStored(uint32_t secTag)
+{
+    (void)secTag;
+
+    return false;
+}
+#endif
+
+static int prv_write(const client_cred_t *credP,
+                     size_t index)
+{
+    size_t length;
+    int err;
+
+    length = hex2bin(credP->pskHex, strlen(credP->pskHex), prv_pskArray[index], PRV_PSK_MAX_SIZE);
+    if (length == 0)
+    {
+        printk("Credentials: invalid PSK for tag %u\n", credP->secTag);
+        return -EINVAL;
+    }
+
+    (void)tls_credential_delete(credP->secTag, TLS_CREDENTIAL_PSK);
+    (void)tls_credential_delete(credP->secTag, TLS_CREDENTIAL_PSK_ID);
+    err = tls_credential_add(credP->secTag, TLS_CREDENTIAL_PSK, prv_pskArray[index], length);
+    if (err == 0)
+    {
+        err = tls_credential_add(credP->secTag, TLS_CREDENTIAL_PSK_ID,
+                                 credP->identity, strlen(credP->identity));
+    }
+
+    return err;
+}
+#endif
+
+size_t client_cred_provision(const client_cred_t *credArray,
+                             size_t credCount,
+                             int *resultArray)
+{
+    int64_t start;
+    int64_t offlineStart;
+    bool offline;
+    size_t failedCount;
+    size_t i;
+    int err;
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+    uint8_t hash[TC_SHA256_DIGEST_SIZE];
+    cred_hash_t *hashP;
+#endif
+
+    start = k_uptime_get();
+    offlineStart = 0;
+    offline = false;
+    failedCount = 0;
+
+    for (i = CLIENT_CRED_MAX_TAGS; i < credCount; i++)
+    {
+        printk("Credentials: only %u tags are provisioned, not tag %u\n", CLIENT_CRED_MAX_TAGS, credArray[i].secTag);
+        resultArray[i] = -ENOSPC;
+        failedCount++;
+    }
+    credCount = MIN(credCount, CLIENT_CRED_MAX_TAGS);
+
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+    err = settings_subsys_init();
+    if (err == 0)
+    {
+        err = settings_load_subtree(PRV_SETTINGS_TREE);
+    }
+    if (err != 0)
+    {
+        printk("Credentials: loading the settings failed (%d)\n", err);
+    }
+#endif
+
+    for (i = 0; i < credCount; i++)
+    {
+        resultArray[i] = 0;
+
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+        prv_hash(credArray + i, hash);
+        hashP = prv_findHash(credArray[i].secTag, false);
+        if (hashP != NULL
+            && memcmp(hashP->hash, hash, TC_SHA256_DIGEST_SIZE) == 0
+            && prv_isStored(credArray[i].secTag))
+        {
+            prv_unchangedCount++;
+            continue;
+        }
+#endif
+
+#if defined(CONFIG_NRF_MODEM_LIB)
+        // The modem only takes credentials while offline, which it is
+        // until the attach
+        if (!offline
+            && IS_ENABLED(CONFIG_LTE_AUTO_INIT_AND_CONNECT))
+        {
+            offlineStart = k_uptime_get();
+            err = lte_lc_offline();
+            if (err != 0)
+            {
+                printk("Credentials: setting the modem offline failed (%d)\n", err);
+            }
+            offline = true;
+        }
+#endif
+
+        err = prv_write(credArray + i, i);
+        if (err != 0)
+        {
+            printk("Credentials: writing tag %u failed (%d)\n", credArray[i].secTag, err);
+            prv_failedCount++;
+            resultArray[i] = err;
+            failedCount++;
+            continue;
+        }
+        prv_writtenCount++;
+
+#if defined(CONFIG_IOWA_CREDENTIALS_HASH)
+        err = prv_saveHash(credArray[i].secTag, hash);
+        if (err != 0)
+        {
+            printk("Credentials: saving the hash of tag %u failed (%d)\n", credArray[i].secTag, err);
+        }
+#endif
+    }
+
+#if defined(CONFIG_NRF_MODEM_LIB)
+    if (offline)
+    {
+        err = lte_lc_normal();
+        if (err != 0)
+        {
+            printk("Credentials: setting the modem online failed (%d)\n", err);
+        }
+        prv_offlineDuration = (uint32_t)(k_uptime_get() - offlineStart);
+    }
+#else
+    (void)offline;
+    (void)offlineStart;
+#endif
+
+    prv_duration = (uint32_t)(k_uptime_get() - start);
+    printk("Credentials: %u tags written, %u unchanged, %u failed in %u ms\n",
+           prv_writtenCount, prv_unchangedCount, prv_failedCount, prv_duration);
+
+    return failedCount;
+}
+
+void client_cred_print_stats(void)
+{
+    printk("Credentials: %u tags written, %u unchanged, %u failed, %u ms at boot (modem offline %u ms)\n",
+           prv_writtenCount, prv_unchangedCount, prv_failedCount, prv_duration, prv_offlineDuration);
+}
@@ -0,0 +1,57 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Provisioning of the DTLS credentials.
+ *
+ * Each security tag receives a PSK identity and
+ * a PSK, in the modem on the nRF9160 and in the
+ * Zephyr credential store on the host targets.
+ * Several tags can be provisioned at once, so
+ * that the credentials of the next server are
+ * in place before a rotation.
+ *
+ * Writing to the modem is slow, wears its flash
+ * and needs the modem offline. With
+ * CONFIG_IOWA_CREDENTIALS_HASH, a SHA-256 of the
+ * credentials of each tag is saved with the
+ * settings subsystem when they are written, and
+ * a tag whose credentials are still in the
+ * modem with the same hash is left untouched.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_CRED_INCLUDE_
+#define _CLIENT_CRED_INCLUDE_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The main tag and the rotation tag
+#define CLIENT_CRED_MAX_TAGS 2
+
+typedef struct
+{
+    uint32_t secTag;
+    const char *identity;
+    const char *pskHex;     // in hexadecimal, as the modem takes it
+} client_cred_t;
+
+// Makes the security tags hold their credentials, writing only the ones
+// which changed or are missing. On the nRF9160, call it before the
+// attach: the modem is set offline around the writes otherwise. A failed
+// tag does not stop the others: resultArray receives 0 or a negative
+// error code for each tag. Returns the number of tags which failed.
+size_t client_cred_provision(const client_cred_t *credArray,
+                             size_t credCount,
+                             int *resultArray);
+
+// Prints the tags written, left untouched and failed, and the time spent.
+void client_cred_print_stats(void);
+
+#endif
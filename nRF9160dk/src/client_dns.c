@@ -0,0 +1,340 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the cache of the server
+ * address resolutions.
+ *
+ * getaddrinfo() does not return the TTL of the
+ * DNS records: the entries live for
+ * CONFIG_IOWA_DNS_CACHE_TTL seconds.
+ *
+ **********************************************/
+
+#include "client_dns.h"
+#include "client_platform.h"
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#if defined(CONFIG_IOWA_DNS_CACHE_PERSIST)
+#include <settings/settings.h>
+#endif
+
+#define PRV_PORT_SIZE 8
+
+typedef struct
+{
+    char hostname[CONFIG_IOWA_DNS_CACHE_HOSTNAME_SIZE];
+    char port[PRV_PORT_SIZE];
+    struct sockaddr_in addr;
+    int64_t expiry;     // in platform_gettime_ms() time
+} dns_entry_t;
+
+// A cached result, released by client_dns_freeaddrinfo()
+typedef struct
+{
+    struct addrinfo info;
+    struct sockaddr_in addr;
+} dns_result_t;
+
+static K_MUTEX_DEFINE(prv_cacheMutex);
+static dns_entry_t prv_cacheArray[CONFIG_IOWA_DNS_CACHE_SIZE];
+
+static uint32_t prv_hitCount;
+static uint32_t prv_missCount;
+static uint32_t prv_staleCount;
+static uint32_t prv_failureCount;
+
+#if defined(CONFIG_IOWA_DNS_CACHE_PERSIST)
+#define PRV_SETTINGS_TREE "iowa/dns"
+
+// The uptime restarts at each boot: the remaining time to live is saved
+// at each resolution, and counted again from the boot. The time spent off
+// is not known: a reloaded entry can outlive its TTL by that much, at most
+// by one TTL since the save.
+typedef struct
+{
+    char hostname[CONFIG_IOWA_DNS_CACHE_HOSTNAME_SIZE];
+    char port[PRV_PORT_SIZE];
+    struct sockaddr_in addr;
+    uint32_t remainingTtl;  // in seconds
+} dns_record_t;
+
+static bool prv_loaded;
+
+static int prv_settingsSet(const char *key,
+                           size_t len,
+                           settings_read_cb readCb,
+                           void *cbArg)
+{
+    dns_record_t record;
+    unsigned long index;
+    char *endP;
+    dns_entry_t *entryP;
+
+    index = strtoul(key, &endP, 10);
+    if (endP == key || *endP != 0 || index >= CONFIG_IOWA_DNS_CACHE_SIZE)
+    {
+        return -ENOENT;
+    }
+    if (len != sizeof(dns_record_t))
+    {
+        // Saved by a build with a different layout
+        return 0;
+    }
+    if (readCb(cbArg, &record, sizeof(dns_record_t)) != sizeof(dns_record_t))
+    {
+        return -EIO;
+    }
+
+    entryP = prv_cacheArray + index;
+    memcpy(entryP->hostname, record.hostname, sizeof(entryP->hostname));
+    entryP->hostname[sizeof(entryP->hostname) - 1] = 0;
+    memcpy(entryP->port, record.port, sizeof(entryP->port));
+    entryP->port[sizeof(entryP->port) - 1] = 0;
+    entryP->addr = record.addr;
+    entryP->expiry = platform_gettime_ms() + (int64_t)record.remainingTtl * MSEC_PER_SEC;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(iowa_dns, PRV_SETTINGS_TREE, NULL, prv_settingsSet, NULL, NULL);
+
+// Called with the cache mutex held.
+static void prv_load(void)
+{
+    int err;
+
+    if (prv_loaded)
+    {
+        return;
+    }
+    prv_loaded = true;
+
+    err = settings_subsys_init();
+    if (err == 0)
+    {
+        err = settings_load_subtree(PRV_SETTINGS_TREE);
+    }
+    if (err != 0)
+    {
+        printk("DNS cache: loading the settings failed (%d)\n", err);
+    }
+}
+
+// Called with the cache mutex held.
+static void prv_save(size_t index)
+{
+    dns_record_t record;
+    char key[sizeof(PRV_SETTINGS_TREE) + 4];
+    int64_t remaining;
+    int err;
+
+    memset(&record, 0, sizeof(dns_record_t));
+    memcpy(record.hostname, prv_cacheArray[index].hostname, sizeof(record.hostname));
+    memcpy(record.port, prv_cacheArray[index].port, sizeof(record.port));
+    record.addr = prv_cacheArray[index].addr;
+    remaining = (prv_cacheArray[index].expiry - platform_gettime_ms()) / MSEC_PER_SEC;
+    record.remainingTtl = (uint32_t)MAX(remaining, 0);
+
+    snprintf(key, sizeof(key), PRV_SETTINGS_TREE "/%u", (unsigned int)index);
+    err = settings_save_one(key, &record, sizeof(dns_record_t));
+    if (err != 0)
+    {
+        printk("DNS cache: saving %s failed (%d)\n", key, err);
+    }
+}
+#endif
+
+// Called with the cache mutex held. Returns NULL if the host is not cached.
+static dns_entry_t * prv_find(const char *hostname,
+                              const char *port)
+{
+    size_t i;
+
+    for (i = 0; i < CONFIG_IOWA_DNS_CACHE_SIZE; i++)
+    {
+        if (prv_cacheArray[i].hostname[0] != 0
+            && strcmp(prv_cacheArray[i].hostname, hostname) == 0
+            && strcmp(prv_cacheArray[i].port, port) == 0)
+        {
+            return prv_cacheArray + i;
+        }
+    }
+
+    return NULL;
+}
+
+// Called with the cache mutex held. Returns the index of a free entry, or
+// of the one expiring first.
+static size_t prv_findSlot(void)
+{
+    size_t i;
+    size_t oldest;
+
+    oldest = 0;
+    for (i = 0; i < CONFIG_IOWA_DNS_CACHE_SIZE; i++)
+    {
+        if (prv_cacheArray[i].hostname[0] == 0)
+        {
+            return i;
+        }
+        if (prv_cacheArray[i].expiry < prv_cacheArray[oldest].expiry)
+        {
+            oldest = i;
+        }
+    }
+
+    return oldest;
+}
+
+static struct addrinfo * prv_newResult(const struct sockaddr_in *addrP,
+                                       const struct addrinfo *hints)
+{
+    dns_result_t *resultP;
+
+    resultP = (dns_result_t *)k_malloc(sizeof(dns_result_t));
+    if (resultP == NULL)
+    {
+        return NULL;
+    }
+    memset(resultP, 0, sizeof(dns_result_t));
+
+    resultP->addr = *addrP;
+    resultP->info.ai_family = AF_INET;
+    resultP->info.ai_socktype = hints->ai_socktype;
+    resultP->info.ai_protocol = hints->ai_protocol;
+    resultP->info.ai_addr = (struct sockaddr *)&(resultP->addr);
+    resultP->info.ai_addrlen = sizeof(struct sockaddr_in);
+
+    return &(resultP->info);
+}
+
+int client_dns_getaddrinfo(const char *hostname,
+                           const char *port,
+                           const struct addrinfo *hints,
+                           struct addrinfo **resultP)
+{
+    dns_entry_t *entryP;
+    struct addrinfo *servinfo;
+    struct addrinfo *p;
+    struct sockaddr_in addr;
+    bool cacheable;
+    bool resolved;
+    size_t index;
+    int result;
+
+    *resultP = NULL;
+
+    // Names which do not fit are resolved each time
+    cacheable = strlen(hostname) < CONFIG_IOWA_DNS_CACHE_HOSTNAME_SIZE
+                && strlen(port) < PRV_PORT_SIZE;
+
+    k_mutex_lock(&prv_cacheMutex, K_FOREVER);
+#if defined(CONFIG_IOWA_DNS_CACHE_PERSIST)
+    prv_load();
+#endif
+
+    entryP = cacheable ? prv_find(hostname, port) : NULL;
+    if (entryP != NULL && platform_gettime_ms() < entryP->expiry)
+    {
+        prv_hitCount++;
+        addr = entryP->addr;
+        k_mutex_unlock(&prv_cacheMutex);
+
+        *resultP = prv_newResult(&addr, hints);
+        return (*resultP != NULL) ? 0 : EAI_MEMORY;
+    }
+    prv_missCount++;
+    k_mutex_unlock(&prv_cacheMutex);
+
+    // The resolution may take seconds: the cache is not locked meanwhile
+    servinfo = NULL;
+    result = getaddrinfo(hostname, port, hints, &servinfo);
+
+    resolved = false;
+    if (result == 0)
+    {
+        for (p = servinfo; p != NULL && !resolved; p = p->ai_next)
+        {
+            if (p->ai_family == AF_INET)
+            {
+                memcpy(&addr, p->ai_addr, sizeof(struct sockaddr_in));
+                resolved = true;
+            }
+        }
+    }
+    if (servinfo != NULL)
+    {
+        freeaddrinfo(servinfo);
+    }
+
+    k_mutex_lock(&prv_cacheMutex, K_FOREVER);
+    entryP = cacheable ? prv_find(hostname, port) : NULL;
+    if (resolved && cacheable)
+    {
+        if (entryP != NULL)
+        {
+            index = entryP - prv_cacheArray;
+        }
+        else
+        {
+            index = prv_findSlot();
+            entryP = prv_cacheArray + index;
+            memset(entryP, 0, sizeof(dns_entry_t));
+            strcpy(entryP->hostname, hostname);
+            strcpy(entryP->port, port);
+        }
+        entryP->addr = addr;
+        entryP->expiry = platform_gettime_ms() + (int64_t)CONFIG_IOWA_DNS_CACHE_TTL * MSEC_PER_SEC;
+#if defined(CONFIG_IOWA_DNS_CACHE_PERSIST)
+        // Saved at each refresh, at most once per TTL, so that a reboot
+        // does not bring back the time to live of an older save
+        prv_save(index);
+#endif
+    }
+    else if (!resolved && entryP != NULL)
+    {
+        // The DNS can not be reached: the last known address is better
+        // than none
+        prv_staleCount++;
+        addr = entryP->addr;
+        resolved = true;
+    }
+    else if (!resolved)
+    {
+        prv_failureCount++;
+    }
+    k_mutex_unlock(&prv_cacheMutex);
+
+    if (!resolved)
+    {
+        return (result != 0) ? result : EAI_NONAME;
+    }
+
+    *resultP = prv_newResult(&addr, hints);
+    return (*resultP != NULL) ? 0 : EAI_MEMORY;
+}
+
+void client_dns_freeaddrinfo(struct addrinfo *addrInfoP)
+{
+    // info is the first member of dns_result_t
+    k_free(addrInfoP);
+}
+
+void client_dns_print_stats(void)
+{
+    printk("DNS cache: %u hits, %u misses, %u stale entries used, %u failures\n",
+           prv_hitCount,
+           prv_missCount,
+           prv_staleCount,
+           prv_failureCount);
+}
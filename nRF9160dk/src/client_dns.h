@@ -0,0 +1,41 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Cache of the server address resolutions.
+ *
+ * A resolved host and port is reused until its
+ * time to live expires, saving a DNS exchange,
+ * and thus a radio wakeup, each time a connection
+ * is opened. An expired entry is still used when
+ * the DNS can not be reached.
+ *
+ * With CONFIG_IOWA_DNS_CACHE_PERSIST, the entries
+ * are saved with the settings subsystem at each
+ * resolution and reloaded after a reboot.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_DNS_INCLUDE_
+#define _CLIENT_DNS_INCLUDE_
+
+#include <net/socket.h>
+
+// Same contract as getaddrinfo(), for IPv4 only. The result holds a single
+// address and must be released with client_dns_freeaddrinfo().
+int client_dns_getaddrinfo(const char *hostname,
+                           const char *port,
+                           const struct addrinfo *hints,
+                           struct addrinfo **resultP);
+
+void client_dns_freeaddrinfo(struct addrinfo *addrInfoP);
+
+// Prints the hit, miss, stale and failure counters.
+void client_dns_print_stats(void);
+
+#endif
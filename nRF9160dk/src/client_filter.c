@@ -0,0 +1,77 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the deadband filter
+ * applied to the sensor samples before they
+ * reach the IOWA stack.
+ *
+ **********************************************/
+
+#include "client_filter.h"
+
+#include <string.h>
+#include <math.h>
+
+void client_filter_init(client_filter_t *filterP,
+                        float absoluteDeadband,
+                        float relativeDeadband,
+                        int32_t minInterval,
+                        float hysteresis)
+{
+    memset(filterP, 0, sizeof(client_filter_t));
+
+    filterP->absoluteDeadband = absoluteDeadband;
+    filterP->relativeDeadband = relativeDeadband;
+    filterP->minInterval = minInterval;
+    filterP->hysteresis = hysteresis;
+}
+
+bool client_filter_accept(client_filter_t *filterP,
+                          float value,
+                          int32_t timestamp)
+{
+    float delta;
+    float band;
+
+    if (filterP->hasReference)
+    {
+        if (timestamp - filterP->referenceTime < filterP->minInterval)
+        {
+            filterP->suppressedCount++;
+            return false;
+        }
+
+        delta = value - filterP->reference;
+
+        band = filterP->relativeDeadband * fabsf(filterP->reference);
+        if (band < filterP->absoluteDeadband)
+        {
+            band = filterP->absoluteDeadband;
+        }
+        if (delta * filterP->direction < 0)
+        {
+            band += filterP->hysteresis;
+        }
+
+        if (fabsf(delta) <= band)
+        {
+            filterP->suppressedCount++;
+            return false;
+        }
+
+        filterP->direction = (delta > 0) ? 1 : -1;
+    }
+
+    filterP->hasReference = true;
+    filterP->reference = value;
+    filterP->referenceTime = timestamp;
+    filterP->forwardedCount++;
+
+    return true;
+}
@@ -0,0 +1,59 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Change-threshold filter of sensor samples.
+ *
+ * A sample is forwarded to the IOWA stack only if
+ * it differs enough from the last forwarded one.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_FILTER_INCLUDE_
+#define _CLIENT_FILTER_INCLUDE_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    // configuration
+    float absoluteDeadband;
+    float relativeDeadband;
+    int32_t minInterval;
+    float hysteresis;
+
+    // last forwarded sample
+    bool hasReference;
+    float reference;
+    int32_t referenceTime;
+    int direction;
+
+    uint32_t forwardedCount;
+    uint32_t suppressedCount;
+} client_filter_t;
+
+// absoluteDeadband: smallest change forwarded, in the sensor unit.
+// relativeDeadband: smallest change forwarded, as a fraction of the last
+//                   forwarded value. The largest of the two bands applies.
+// minInterval: minimum time between two forwarded samples, in seconds.
+// hysteresis: added to the band when the change goes in the opposite
+//             direction of the previous forwarded change, to ignore noise
+//             around a value.
+void client_filter_init(client_filter_t *filterP,
+                        float absoluteDeadband,
+                        float relativeDeadband,
+                        int32_t minInterval,
+                        float hysteresis);
+
+// Returns true if the sample must be forwarded to the stack.
+bool client_filter_accept(client_filter_t *filterP,
+                          float value,
+                          int32_t timestamp);
+
+#endif
@@ -0,0 +1,1075 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the pull mode download
+ * of the Firmware Update object.
+ *
+ * The download runs in its own thread with its
+ * own UDP socket, the IOWA thread is never
+ * blocked. Up to CONFIG_IOWA_FOTA_WINDOW Block2
+ * requests are in flight: each one uses the
+ * slot (block number % window) of the reorder
+ * window, and the blocks leave the window in
+ * order, through the stream_flash buffer, to
+ * the secondary slot. The RAM used does not
+ * depend on the image size.
+ *
+ * The progress saved in the settings is the
+ * offset of the last CONFIG_IOWA_FOTA_RESUME_ALIGN
+ * boundary written to the flash, rounded up to
+ * a multiple of the flash page size, with the
+ * URI and the ETag of the image. The page at
+ * this offset is erased again when the download
+ * resumes.
+ *
+ * A server may answer with smaller blocks than
+ * requested (RFC 7959 section 2.4): the download
+ * goes on with its block size.
+ *
+ * A new image is confirmed at its first
+ * registration, not at boot: MCUboot reverts an
+ * image which can not reach the server.
+ *
+ **********************************************/
+
+#include "client_fota.h"
+#if defined(CONFIG_IOWA_DNS_CACHE)
+#include "client_dns.h"
+#endif
+
+#include <zephyr.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <net/socket.h>
+#include <net/coap.h>
+#include <random/rand32.h>
+#include <sys/byteorder.h>
+#include <sys/reboot.h>
+#include <storage/flash_map.h>
+#include <storage/stream_flash.h>
+#include <drivers/flash.h>
+#include <dfu/mcuboot.h>
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+#include <settings/settings.h>
+#endif
+
+#define PRV_URI_SIZE        128
+#define PRV_HOSTNAME_SIZE   64
+#define PRV_PORT_SIZE       8
+#define PRV_ETAG_SIZE       8
+// The token carries the block number
+#define PRV_TOKEN_SIZE      4
+// CoAP header, token and options around a block
+#define PRV_HEADER_SIZE     64
+
+// RFC 7252 transmission parameters
+#define PRV_ACK_TIMEOUT     2000
+#define PRV_MAX_RETRANSMIT  4
+
+// The stop request is checked at least this often (ms)
+#define PRV_POLL_SLICE      1000
+
+#define PRV_NO_BLOCK        UINT32_MAX
+
+#if defined(CONFIG_IOWA_DNS_CACHE)
+#define PRV_GETADDRINFO client_dns_getaddrinfo
+#define PRV_FREEADDRINFO client_dns_freeaddrinfo
+#else
+#define PRV_GETADDRINFO getaddrinfo
+#define PRV_FREEADDRINFO freeaddrinfo
+#endif
+
+BUILD_ASSERT((CONFIG_IOWA_FOTA_BLOCK_SIZE & (CONFIG_IOWA_FOTA_BLOCK_SIZE - 1)) == 0,
+             "The block size is a power of two");
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+BUILD_ASSERT(CONFIG_IOWA_FOTA_RESUME_ALIGN % CONFIG_IOWA_FOTA_BLOCK_SIZE == 0,
+             "The resume offsets are block boundaries");
+#endif
+
+typedef struct
+{
+    char uri[PRV_URI_SIZE];
+    uint8_t etag[PRV_ETAG_SIZE];
+    uint8_t etagLen;
+    uint32_t offset;    // bytes written in the secondary slot
+} fota_progress_t;
+
+typedef struct
+{
+    bool used;
+    bool received;
+    uint8_t retransmitCount;
+    uint8_t code;       // response code, when not 2.05
+    uint16_t messageId;
+    uint16_t length;
+    uint32_t num;
+    int64_t deadline;   // of the next retransmission
+    uint8_t data[CONFIG_IOWA_FOTA_BLOCK_SIZE];
+} fota_slot_t;
+
+typedef struct
+{
+    int sock;
+    const char *path;
+    uint8_t szx;
+    uint8_t requestedSzx;
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+    uint32_t resumeAlign;   // multiple of the flash page size
+#endif
+    uint16_t messageId;
+    uint32_t writeNum;  // next block to write to the flash
+    uint32_t nextNum;   // next block to request
+    uint32_t lastNum;   // PRV_NO_BLOCK until known
+    uint32_t resumeOffset;
+    bool etagChecked;
+} fota_download_t;
+
+static iowa_context_t prv_contextP;
+// A test image waits for its first registration to be confirmed
+static bool prv_confirmPending;
+
+static K_THREAD_STACK_DEFINE(prv_stack, CONFIG_IOWA_FOTA_STACK_SIZE);
+static struct k_thread prv_thread;
+static atomic_t prv_running;
+static atomic_t prv_stopRequested;
+
+static char prv_uri[PRV_URI_SIZE];
+static fota_progress_t prv_progress;
+static fota_slot_t prv_slotArray[CONFIG_IOWA_FOTA_WINDOW];
+static uint8_t prv_packet[CONFIG_IOWA_FOTA_BLOCK_SIZE + PRV_HEADER_SIZE];
+static uint8_t prv_writeBuffer[CONFIG_IOWA_FOTA_WRITE_BUFFER_SIZE];
+static struct stream_flash_ctx prv_stream;
+
+// Statistics of the last download
+static uint32_t prv_byteCount;
+static uint32_t prv_blockCount;
+static uint32_t prv_requestCount;
+static uint32_t prv_retransmitCount;
+static uint32_t prv_duplicateCount;
+static uint32_t prv_resumedAt;
+static int64_t prv_duration;
+static size_t prv_stackUsed;
+
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+#define PRV_SETTINGS_TREE "iowa/fota"
+#define PRV_SETTINGS_KEY  PRV_SETTINGS_TREE "/progress"
+
+static int prv_settingsSet(const char *key,
+                           size_t len,
+                           settings_read_cb read_cb,
+                           void *cb_arg)
+{
+    fota_progress_t progress;
+
+    if (strcmp(key, "progress") != 0
+        || len != sizeof(progress))
+    {
+        return -EINVAL;
+    }
+    if (read_cb(cb_arg, &progress, sizeof(progress)) != sizeof(progress))
+    {
+        return -EIO;
+    }
+    progress.uri[sizeof(progress.uri) - 1] = 0;
+    if (progress.etagLen > sizeof(progress.etag))
+    {
+        return -EINVAL;
+    }
+    prv_progress = progress;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(iowa_fota, PRV_SETTINGS_TREE, NULL, prv_settingsSet, NULL, NULL);
+
+static void prv_load(void)
+{
+    int err;
+
+    err = settings_subsys_init();
+    if (err == 0)
+    {
+        err = settings_load_subtree(PRV_SETTINGS_TREE);
+    }
+    if (err != 0)
+    {
+        printk("Firmware update: loading the settings failed (%d)\n", err);
+    }
+}
+
+static void prv_save(void)
+{
+    int err;
+
+    err = settings_save_one(PRV_SETTINGS_KEY, &prv_progress, sizeof(prv_progress));
+    if (err != 0)
+    {
+        printk("Firmware update: saving the progress failed (%d)\n", err);
+    }
+}
+#endif
+
+// Saves the progress when the flash writes crossed a resume boundary.
+static void prv_saveProgress(fota_download_t *downloadP)
+{
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+    uint32_t offset;
+
+    offset = downloadP->resumeOffset + stream_flash_bytes_written(&prv_stream);
+    offset -= offset % downloadP->resumeAlign;
+    if (offset > prv_progress.offset)
+    {
+        prv_progress.offset = offset;
+        prv_save();
+    }
+#endif
+}
+
+// Splits "coap://host[:port]/path". The path points in the URI.
+static iowa_fw_status_t prv_parseUri(const char *uri,
+                                     char *hostname,
+                                     char *port,
+                                     const char **pathP)
+{
+    const char *hostP;
+    const char *endP;
+    const char *portP;
+    size_t length;
+
+    if (strncmp(uri, "coap://", 7) != 0)
+    {
+        if (strstr(uri, "://") != NULL)
+        {
+            return IOWA_FW_STATUS_UNSUPPORTED_PROTOCOL;
+        }
+        return IOWA_FW_STATUS_INVALID_URI;
+    }
+    hostP = uri + 7;
+
+    endP = strchr(hostP, '/');
+    if (endP == NULL)
+    {
+        endP = hostP + strlen(hostP);
+    }
+    portP = memchr(hostP, ':', endP - hostP);
+
+    length = (portP != NULL ? portP : endP) - hostP;
+    if (length == 0
+        || length >= PRV_HOSTNAME_SIZE)
+    {
+        return IOWA_FW_STATUS_INVALID_URI;
+    }
+    memcpy(hostname, hostP, length);
+    hostname[length] = 0;
+
+    if (portP != NULL)
+    {
+        portP++;
+        length = endP - portP;
+        if (length == 0
+            || length >= PRV_PORT_SIZE)
+        {
+            return IOWA_FW_STATUS_INVALID_URI;
+        }
+        memcpy(port, portP, length);
+        port[length] = 0;
+    }
+    else
+    {
+        strcpy(port, "5683");
+    }
+
+    *pathP = endP;
+
+    return IOWA_FW_STATUS_SUCCESSFUL;
+}
+
+static int prv_connect(const char *hostname,
+                       const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *servinfo;
+    int sock;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if (0 != PRV_GETADDRINFO(hostname, port, &hints, &servinfo)
+        || servinfo == NULL)
+    {
+        return -EHOSTUNREACH;
+    }
+
+    sock = socket(servinfo->ai_family, servinfo->ai_socktype, IPPROTO_UDP);
+    if (sock >= 0
+        && connect(sock, servinfo->ai_addr, servinfo->ai_addrlen) != 0)
+    {
+        close(sock);
+        sock = -errno;
+    }
+    PRV_FREEADDRINFO(servinfo);
+
+    return sock;
+}
+
+// Builds and sends the request of a slot. A retransmission reuses the
+// message ID.
+static int prv_sendRequest(fota_download_t *downloadP,
+                           fota_slot_t *slotP)
+{
+    struct coap_packet request;
+    uint8_t token[PRV_TOKEN_SIZE];
+    const char *segmentP;
+    const char *endP;
+    int result;
+
+    sys_put_be32(slotP->num, token);
+
+    // CoAP version 1
+    result = coap_packet_init(&request, prv_packet, sizeof(prv_packet), 1, COAP_TYPE_CON,
+                              sizeof(token), token, COAP_METHOD_GET, slotP->messageId);
+
+    // The options are appended in their number order
+    segmentP = downloadP->path;
+    while (result == 0
+           && *segmentP != 0)
+    {
+        segmentP++;
+        endP = strchr(segmentP, '/');
+        if (endP == NULL)
+        {
+            endP = segmentP + strlen(segmentP);
+        }
+        if (endP != segmentP)
+        {
+            result = coap_packet_append_option(&request, COAP_OPTION_URI_PATH, (const uint8_t *)segmentP, endP - segmentP);
+        }
+        segmentP = endP;
+    }
+    if (result == 0)
+    {
+        result = coap_append_option_int(&request, COAP_OPTION_BLOCK2, (slotP->num << 4) | downloadP->szx);
+    }
+    if (result == 0
+        && downloadP->lastNum == PRV_NO_BLOCK)
+    {
+        // Asks for the image size (RFC 7959 section 4)
+        result = coap_append_option_int(&request, COAP_OPTION_SIZE2, 0);
+    }
+    if (result != 0)
+    {
+        return result;
+    }
+
+    if (send(downloadP->sock, request.data, request.offset, 0) < 0)
+    {
+        return -errno;
+    }
+    prv_requestCount++;
+
+    return 0;
+}
+
+static void prv_sendAck(fota_download_t *downloadP,
+                        uint16_t messageId)
+{
+    struct coap_packet ack;
+    uint8_t buffer[4];
+
+    if (coap_packet_init(&ack, buffer, sizeof(buffer), 1, COAP_TYPE_ACK, 0, NULL, COAP_CODE_EMPTY, messageId) == 0)
+    {
+        (void)send(downloadP->sock, ack.data, ack.offset, 0);
+    }
+}
+
+// Checks the ETag of the first response against the one of the
+// interrupted download. Returns 0 or -ESTALE when the image changed.
+static int prv_checkEtag(fota_download_t *downloadP,
+                         const struct coap_packet *replyP)
+{
+    struct coap_option option;
+    int count;
+
+    downloadP->etagChecked = true;
+
+    count = coap_find_options(replyP, COAP_OPTION_ETAG, &option, 1);
+    if (count <= 0
+        || option.len > PRV_ETAG_SIZE)
+    {
+        // Nothing to compare: MCUboot checks the image at the end
+        return 0;
+    }
+
+    if (downloadP->resumeOffset != 0
+        && prv_progress.etagLen != 0
+        && (prv_progress.etagLen != option.len
+            || memcmp(prv_progress.etag, option.value, option.len) != 0))
+    {
+        return -ESTALE;
+    }
+
+    memcpy(prv_progress.etag, option.value, option.len);
+    prv_progress.etagLen = option.len;
+
+    return 0;
+}
+
+// Goes on with the smaller blocks chosen by the server: the blocks in
+// flight are requested again with the new size.
+static void prv_setBlockSize(fota_download_t *downloadP,
+                             uint8_t szx)
+{
+    uint8_t shift;
+
+    shift = downloadP->szx - szx;
+    downloadP->szx = szx;
+    downloadP->writeNum <<= shift;
+    downloadP->nextNum = downloadP->writeNum;
+    // Known again from the next responses
+    downloadP->lastNum = PRV_NO_BLOCK;
+    memset(prv_slotArray, 0, sizeof(prv_slotArray));
+
+    printk("Firmware update: the server uses blocks of %u bytes\n", 16 << szx);
+}
+
+// Stores a response in its slot. Returns 0, -ESTALE when the image
+// changed since the interrupted download, or another negative error
+// code when the server does not follow the Block2 option.
+static int prv_handleResponse(fota_download_t *downloadP,
+                              int length)
+{
+    struct coap_packet reply;
+    uint8_t token[8];
+    const uint8_t *payloadP;
+    uint16_t payloadLen;
+    fota_slot_t *slotP;
+    uint32_t num;
+    uint32_t blockSize;
+    uint8_t code;
+    uint8_t szx;
+    int block2;
+    int size2;
+    int result;
+
+    if (coap_packet_parse(&reply, prv_packet, length, NULL, 0) != 0)
+    {
+        return 0;
+    }
+    if (coap_header_get_type(&reply) == COAP_TYPE_CON)
+    {
+        // Separate response
+        prv_sendAck(downloadP, coap_header_get_id(&reply));
+    }
+    if (coap_header_get_token(&reply, token) != PRV_TOKEN_SIZE)
+    {
+        return 0;
+    }
+    num = sys_get_be32(token);
+
+    slotP = prv_slotArray + (num % CONFIG_IOWA_FOTA_WINDOW);
+    if (num < downloadP->writeNum
+        || !slotP->used
+        || slotP->num != num
+        || slotP->received)
+    {
+        prv_duplicateCount++;
+        return 0;
+    }
+
+    code = coap_header_get_code(&reply);
+    block2 = coap_get_option_int(&reply, COAP_OPTION_BLOCK2);
+    if (code == COAP_RESPONSE_CODE_CONTENT
+        && block2 >= 0)
+    {
+        szx = block2 & 0x07;
+        if (szx < downloadP->szx)
+        {
+            // RFC 7959 section 2.4: the server chose a smaller size
+            prv_setBlockSize(downloadP, szx);
+            return 0;
+        }
+        if (szx != downloadP->szx
+            || ((uint32_t)block2 >> 4) != num)
+        {
+            if (downloadP->szx != downloadP->requestedSzx)
+            {
+                // Answer to a request sent before the size changed
+                prv_duplicateCount++;
+                return 0;
+            }
+            return -EPROTO;
+        }
+    }
+
+    slotP->received = true;
+    slotP->length = 0;
+    slotP->code = code;
+    if (code != COAP_RESPONSE_CODE_CONTENT)
+    {
+        return 0;
+    }
+
+    blockSize = 16 << downloadP->szx;
+    if (block2 >= 0)
+    {
+        if ((block2 & 0x08) == 0)
+        {
+            downloadP->lastNum = num;
+        }
+    }
+    else if (num == 0)
+    {
+        // The whole image in one response
+        downloadP->lastNum = 0;
+    }
+    else
+    {
+        return -EPROTO;
+    }
+
+    if (!downloadP->etagChecked)
+    {
+        result = prv_checkEtag(downloadP, &reply);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+
+    size2 = coap_get_option_int(&reply, COAP_OPTION_SIZE2);
+    if (size2 > 0
+        && downloadP->lastNum == PRV_NO_BLOCK)
+    {
+        downloadP->lastNum = (size2 - 1) / blockSize;
+    }
+
+    payloadP = coap_packet_get_payload(&reply, &payloadLen);
+    if (payloadLen > blockSize
+        || (payloadLen != blockSize && num != downloadP->lastNum))
+    {
+        return -EPROTO;
+    }
+    if (payloadP != NULL)
+    {
+        memcpy(slotP->data, payloadP, payloadLen);
+    }
+    slotP->length = payloadLen;
+
+    return 0;
+}
+
+// Requests the next blocks and retransmits the expired requests. Returns
+// the time to wait for the next retransmission, or a negative error code.
+static int prv_sendRequests(fota_download_t *downloadP)
+{
+    fota_slot_t *slotP;
+    int64_t now;
+    int64_t deadline;
+    size_t i;
+    int result;
+
+    now = k_uptime_get();
+
+    while (downloadP->nextNum < downloadP->writeNum + CONFIG_IOWA_FOTA_WINDOW
+           && (downloadP->lastNum == PRV_NO_BLOCK || downloadP->nextNum <= downloadP->lastNum))
+    {
+        slotP = prv_slotArray + (downloadP->nextNum % CONFIG_IOWA_FOTA_WINDOW);
+        memset(slotP, 0, offsetof(fota_slot_t, data));
+        slotP->used = true;
+        slotP->num = downloadP->nextNum;
+        slotP->messageId = downloadP->messageId++;
+        slotP->deadline = now + PRV_ACK_TIMEOUT;
+
+        result = prv_sendRequest(downloadP, slotP);
+        if (result != 0)
+        {
+            return result;
+        }
+        downloadP->nextNum++;
+    }
+
+    deadline = now + PRV_POLL_SLICE;
+    for (i = 0; i < CONFIG_IOWA_FOTA_WINDOW; i++)
+    {
+        slotP = prv_slotArray + i;
+        if (!slotP->used
+            || slotP->received)
+        {
+            continue;
+        }
+        if (downloadP->lastNum != PRV_NO_BLOCK
+            && slotP->num > downloadP->lastNum)
+        {
+            // Past the end of the image
+            slotP->used = false;
+            continue;
+        }
+        if (slotP->deadline <= now)
+        {
+            if (slotP->retransmitCount == PRV_MAX_RETRANSMIT)
+            {
+                return -ETIMEDOUT;
+            }
+            slotP->retransmitCount++;
+            slotP->deadline = now + (PRV_ACK_TIMEOUT << slotP->retransmitCount);
+            prv_retransmitCount++;
+
+            result = prv_sendRequest(downloadP, slotP);
+            if (result != 0)
+            {
+                return result;
+            }
+        }
+        if (slotP->deadline < deadline)
+        {
+            deadline = slotP->deadline;
+        }
+    }
+
+    return (int)(deadline - now);
+}
+
+// Writes the blocks received in order. Returns IOWA_FW_STATUS_SUCCESSFUL
+// or the failure reported to the server.
+static iowa_fw_status_t prv_writeBlocks(fota_download_t *downloadP)
+{
+    fota_slot_t *slotP;
+    int result;
+
+    while (downloadP->lastNum == PRV_NO_BLOCK
+           || downloadP->writeNum <= downloadP->lastNum)
+    {
+        slotP = prv_slotArray + (downloadP->writeNum % CONFIG_IOWA_FOTA_WINDOW);
+        if (!slotP->used
+            || slotP->num != downloadP->writeNum
+            || !slotP->received)
+        {
+            break;
+        }
+        if (slotP->code != COAP_RESPONSE_CODE_CONTENT)
+        {
+            printk("Firmware update: block %u failed with %u.%02u\n",
+                   slotP->num, slotP->code >> 5, slotP->code & 0x1F);
+            return slotP->code == COAP_RESPONSE_CODE_NOT_FOUND ? IOWA_FW_STATUS_INVALID_URI : IOWA_FW_STATUS_CONNECTION_LOST;
+        }
+
+        result = stream_flash_buffered_write(&prv_stream, slotP->data, slotP->length,
+                                             downloadP->writeNum == downloadP->lastNum);
+        if (result != 0)
+        {
+            printk("Firmware update: writing block %u failed (%d)\n", slotP->num, result);
+            return result == -ENOMEM ? IOWA_FW_STATUS_OUT_OF_STORAGE : IOWA_FW_STATUS_UPDATE_FAILED;
+        }
+
+        prv_byteCount += slotP->length;
+        prv_blockCount++;
+        slotP->used = false;
+        downloadP->writeNum++;
+
+        prv_saveProgress(downloadP);
+    }
+
+    return IOWA_FW_STATUS_SUCCESSFUL;
+}
+
+// Receives all the pending responses. Returns 0 or a negative error code.
+static int prv_receive(fota_download_t *downloadP)
+{
+    int length;
+    int result;
+
+    while (true)
+    {
+        length = recv(downloadP->sock, prv_packet, sizeof(prv_packet), MSG_DONTWAIT);
+        if (length < 0)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
+        }
+        result = prv_handleResponse(downloadP, length);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+}
+
+static iowa_fw_status_t prv_fetch(fota_download_t *downloadP)
+{
+    struct pollfd pfd;
+    iowa_fw_status_t status;
+    int timeout;
+    int result;
+
+    downloadP->writeNum = downloadP->resumeOffset / (16 << downloadP->szx);
+    downloadP->nextNum = downloadP->writeNum;
+    downloadP->lastNum = PRV_NO_BLOCK;
+    downloadP->etagChecked = false;
+    memset(prv_slotArray, 0, sizeof(prv_slotArray));
+
+    pfd.fd = downloadP->sock;
+    pfd.events = POLLIN;
+
+    while (downloadP->lastNum == PRV_NO_BLOCK
+           || downloadP->writeNum <= downloadP->lastNum)
+    {
+        if (atomic_get(&prv_stopRequested))
+        {
+            return IOWA_FW_STATUS_CONNECTION_LOST;
+        }
+
+        timeout = prv_sendRequests(downloadP);
+        if (timeout < 0)
+        {
+            printk("Firmware update: requesting block %u failed (%d)\n", downloadP->writeNum, timeout);
+            return IOWA_FW_STATUS_CONNECTION_LOST;
+        }
+
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) < 0)
+        {
+            return IOWA_FW_STATUS_CONNECTION_LOST;
+        }
+        if (pfd.revents & POLLIN)
+        {
+            result = prv_receive(downloadP);
+            if (result == -ESTALE)
+            {
+                return IOWA_FW_STATUS_INTEGRITY_CHECK_FAILURE;
+            }
+            if (result != 0)
+            {
+                printk("Firmware update: invalid response (%d)\n", result);
+                return IOWA_FW_STATUS_UNSUPPORTED_PROTOCOL;
+            }
+        }
+
+        status = prv_writeBlocks(downloadP);
+        if (status != IOWA_FW_STATUS_SUCCESSFUL)
+        {
+            return status;
+        }
+    }
+
+    return IOWA_FW_STATUS_SUCCESSFUL;
+}
+
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+// Rounds CONFIG_IOWA_FOTA_RESUME_ALIGN up to a multiple of the flash page
+// size, which stays a block boundary, and the resume offset down to it: the
+// page at the resume offset must not hold data of a previous boundary.
+static int prv_alignResume(fota_download_t *downloadP,
+                           const struct device *flashDev,
+                           off_t slotOffset)
+{
+    struct flash_pages_info info;
+    uint32_t align;
+    int result;
+
+    result = flash_get_page_info_by_offs(flashDev, slotOffset, &info);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    align = ROUND_UP(CONFIG_IOWA_FOTA_RESUME_ALIGN, info.size);
+    while (align % CONFIG_IOWA_FOTA_BLOCK_SIZE != 0)
+    {
+        align += info.size;
+    }
+    downloadP->resumeAlign = align;
+    downloadP->resumeOffset -= downloadP->resumeOffset % align;
+
+    return 0;
+}
+#endif
+
+static int prv_openSlot(fota_download_t *downloadP)
+{
+    const struct flash_area *areaP;
+    const struct device *flashDev;
+    int result;
+
+    result = flash_area_open(FLASH_AREA_ID(image_1), &areaP);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    flashDev = device_get_binding(areaP->fa_dev_name);
+    if (flashDev == NULL)
+    {
+        result = -ENODEV;
+    }
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+    else
+    {
+        result = prv_alignResume(downloadP, flashDev, areaP->fa_off);
+    }
+#endif
+    if (result == 0
+        && downloadP->resumeOffset >= areaP->fa_size)
+    {
+        result = -ENOSPC;
+    }
+    if (result == 0)
+    {
+        result = stream_flash_init(&prv_stream, flashDev, prv_writeBuffer, sizeof(prv_writeBuffer),
+                                   areaP->fa_off + downloadP->resumeOffset, areaP->fa_size - downloadP->resumeOffset, NULL);
+    }
+    flash_area_close(areaP);
+
+    return result;
+}
+
+static iowa_fw_status_t prv_download(void)
+{
+    fota_download_t download;
+    char hostname[PRV_HOSTNAME_SIZE];
+    char port[PRV_PORT_SIZE];
+    iowa_fw_status_t status;
+    int64_t startTime;
+
+    memset(&download, 0, sizeof(download));
+
+    status = prv_parseUri(prv_uri, hostname, port, &download.path);
+    if (status != IOWA_FW_STATUS_SUCCESSFUL)
+    {
+        return status;
+    }
+    while ((16 << download.szx) < CONFIG_IOWA_FOTA_BLOCK_SIZE)
+    {
+        download.szx++;
+    }
+    download.requestedSzx = download.szx;
+    download.messageId = (uint16_t)sys_rand32_get();
+
+    if (strcmp(prv_progress.uri, prv_uri) == 0)
+    {
+        download.resumeOffset = prv_progress.offset;
+    }
+    else
+    {
+        memset(&prv_progress, 0, sizeof(prv_progress));
+        strcpy(prv_progress.uri, prv_uri);
+    }
+
+    download.sock = prv_connect(hostname, port);
+    if (download.sock < 0)
+    {
+        printk("Firmware update: connecting to %s:%s failed (%d)\n", hostname, port, download.sock);
+        return IOWA_FW_STATUS_CONNECTION_LOST;
+    }
+
+    prv_byteCount = 0;
+    prv_blockCount = 0;
+    prv_requestCount = 0;
+    prv_retransmitCount = 0;
+    prv_duplicateCount = 0;
+    startTime = k_uptime_get();
+
+    do
+    {
+        if (prv_openSlot(&download) != 0)
+        {
+            status = IOWA_FW_STATUS_OUT_OF_STORAGE;
+            break;
+        }
+        prv_resumedAt = download.resumeOffset;
+        if (download.resumeOffset != 0)
+        {
+            printk("Firmware update: resuming at %u bytes\n", download.resumeOffset);
+        }
+
+        status = prv_fetch(&download);
+        if (status == IOWA_FW_STATUS_INTEGRITY_CHECK_FAILURE
+            && download.resumeOffset != 0)
+        {
+            // The image changed since the interrupted download
+            printk("Firmware update: the image changed, restarting\n");
+            download.resumeOffset = 0;
+            prv_progress.offset = 0;
+            prv_progress.etagLen = 0;
+            continue;
+        }
+        break;
+    } while (true);
+
+    prv_duration = k_uptime_get() - startTime;
+    close(download.sock);
+
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+    if (status == IOWA_FW_STATUS_SUCCESSFUL)
+    {
+        // A new download of the same URI starts from the beginning
+        memset(&prv_progress, 0, sizeof(prv_progress));
+        prv_save();
+    }
+#endif
+
+    return status;
+}
+
+static void prv_download_fn(void *p1, void *p2, void *p3)
+{
+    iowa_fw_status_t status;
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    size_t unused;
+#endif
+
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    printk("Firmware update: downloading %s\n", prv_uri);
+    status = prv_download();
+    printk("Firmware update: download %s (%u bytes in %u ms)\n",
+           status == IOWA_FW_STATUS_SUCCESSFUL ? "complete" : "failed",
+           prv_byteCount, (uint32_t)prv_duration);
+
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    if (k_thread_stack_space_get(k_current_get(), &unused) == 0)
+    {
+        prv_stackUsed = CONFIG_IOWA_FOTA_STACK_SIZE - unused;
+    }
+#endif
+
+    if (!atomic_get(&prv_stopRequested))
+    {
+        iowa_client_firmware_update_set_status(prv_contextP, status);
+    }
+    atomic_clear(&prv_running);
+}
+
+static void prv_downloadCb(char *uri,
+                           void *userData,
+                           iowa_context_t contextP)
+{
+    ARG_UNUSED(userData);
+    ARG_UNUSED(contextP);
+
+    if (!atomic_cas(&prv_running, 0, 1))
+    {
+        // A download is already running
+        return;
+    }
+    if (strlen(uri) >= sizeof(prv_uri))
+    {
+        atomic_clear(&prv_running);
+        iowa_client_firmware_update_set_status(prv_contextP, IOWA_FW_STATUS_INVALID_URI);
+        return;
+    }
+    strcpy(prv_uri, uri);
+
+    k_thread_create(&prv_thread,
+                    prv_stack,
+                    K_THREAD_STACK_SIZEOF(prv_stack),
+                    prv_download_fn,
+                    NULL, NULL, NULL,
+                    K_LOWEST_APPLICATION_THREAD_PRIO, 0, K_NO_WAIT);
+}
+
+static void prv_updateCb(void *userData,
+                         iowa_context_t contextP)
+{
+    int err;
+
+    ARG_UNUSED(userData);
+
+    err = boot_request_upgrade(BOOT_UPGRADE_TEST);
+    if (err != 0)
+    {
+        printk("Firmware update: marking the image failed (%d)\n", err);
+        iowa_client_firmware_update_set_status(contextP, IOWA_FW_STATUS_UPDATE_FAILED);
+        return;
+    }
+
+    printk("Firmware update: rebooting on the new image\n");
+    sys_reboot(SYS_REBOOT_WARM);
+}
+
+iowa_status_t client_fota_init(iowa_context_t contextP)
+{
+    iowa_status_t result;
+
+    prv_contextP = contextP;
+#if defined(CONFIG_IOWA_FOTA_RESUME)
+    prv_load();
+#endif
+
+    // Pull mode only: no write callback for the Package resource
+    result = iowa_client_firmware_update_configure(contextP, NULL, NULL,
+                                                   prv_downloadCb, NULL, prv_updateCb,
+                                                   NULL);
+    if (result != IOWA_COAP_NO_ERROR)
+    {
+        return result;
+    }
+
+    // First boot of a test image: confirmed once it reached the server
+    prv_confirmPending = !boot_is_img_confirmed();
+
+    return IOWA_COAP_NO_ERROR;
+}
+
+void client_fota_registered(iowa_context_t contextP)
+{
+    int err;
+
+    if (!prv_confirmPending)
+    {
+        return;
+    }
+    prv_confirmPending = false;
+
+    // Keep the image and report the update
+    err = boot_write_img_confirmed();
+    if (err != 0)
+    {
+        printk("Firmware update: confirming the image failed (%d)\n", err);
+        return;
+    }
+    printk("Firmware update: image confirmed\n");
+    iowa_client_firmware_update_set_status(contextP, IOWA_FW_STATUS_SUCCESSFUL);
+}
+
+void client_fota_close(iowa_context_t contextP)
+{
+    ARG_UNUSED(contextP);
+
+    if (atomic_get(&prv_running))
+    {
+        atomic_set(&prv_stopRequested, 1);
+        k_thread_join(&prv_thread, K_FOREVER);
+        atomic_clear(&prv_stopRequested);
+    }
+}
+
+void client_fota_print_stats(void)
+{
+    uint32_t rate;
+
+    // In tenths of KB/s
+    rate = 0;
+    if (prv_duration > 0)
+    {
+        rate = (uint32_t)((uint64_t)prv_byteCount * 10000 / 1024 / prv_duration);
+    }
+
+    printk("Firmware update: %u bytes in %u blocks from offset %u, %u.%u KB/s\n",
+           prv_byteCount, prv_blockCount, prv_resumedAt, rate / 10, rate % 10);
+    printk("Firmware update: %u requests, %u retransmitted, %u duplicates, window of %u\n",
+           prv_requestCount, prv_retransmitCount, prv_duplicateCount, CONFIG_IOWA_FOTA_WINDOW);
+    printk("Firmware update: RAM %u bytes static (window %u, packet %u, flash buffer %u), stack %u of %u bytes\n",
+           (uint32_t)(sizeof(prv_slotArray) + sizeof(prv_packet) + sizeof(prv_writeBuffer) + sizeof(prv_stream) + sizeof(prv_progress)),
+           (uint32_t)sizeof(prv_slotArray), (uint32_t)sizeof(prv_packet), (uint32_t)sizeof(prv_writeBuffer),
+           (uint32_t)prv_stackUsed, CONFIG_IOWA_FOTA_STACK_SIZE);
+}
@@ -0,0 +1,51 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Firmware Update object (LwM2M object 5), in
+ * pull mode.
+ *
+ * The server writes the Package URI, a
+ * "coap://" URI, and the client downloads the
+ * image with CoAP Block2 requests, several of
+ * them in flight, into the MCUboot secondary
+ * slot. The blocks are written to the flash as
+ * they arrive in order: the image is never held
+ * in RAM. With CONFIG_IOWA_FOTA_RESUME, the
+ * download progress is saved in the settings
+ * and a download of the same URI interrupted by
+ * a reset restarts where it stopped.
+ *
+ * The Update resource marks the image for a
+ * test boot and reboots. The new image is
+ * confirmed at its first registration: MCUboot
+ * reverts an image which resets before.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_FOTA_INCLUDE_
+#define _CLIENT_FOTA_INCLUDE_
+
+#include "iowa_client.h"
+
+// Adds the Firmware Update object to the IOWA context. Returns an IOWA
+// status.
+iowa_status_t client_fota_init(iowa_context_t contextP);
+
+// Confirms a test image, at the first IOWA_EVENT_REG_REGISTERED after
+// client_fota_init().
+void client_fota_registered(iowa_context_t contextP);
+
+// Stops a running download, before iowa_close().
+void client_fota_close(iowa_context_t contextP);
+
+// Prints the last download statistics: throughput, retransmissions and
+// RAM used.
+void client_fota_print_stats(void);
+
+#endif
@@ -0,0 +1,379 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the registration
+ * lifetime following the LTE timers.
+ *
+ * With PSM, the modem wakes at least once per
+ * periodic TAU, counted from the end of its last
+ * RRC connection. The lifetime covers a whole
+ * number of TAU periods, at least
+ * CONFIG_IOWA_SERVER_LIFETIME, plus one period
+ * and CONFIG_IOWA_LIFETIME_MARGIN for the wait
+ * of the next wake: the update is sent at the
+ * first wake after which the registration would
+ * not last until the next TAU. Without PSM, or
+ * when such a lifetime exceeds
+ * CONFIG_IOWA_LIFETIME_MAX, the update is sent
+ * at the first wake past half the lifetime.
+ *
+ * The lifetime given to the stack is computed
+ * again when the network changes the timers: a
+ * different one is set on the server and sent
+ * with the next Registration Update, right away.
+ *
+ * The network events come from another thread or
+ * an interrupt: the state is under a spinlock.
+ *
+ **********************************************/
+
+#include "client_lifetime.h"
+
+#include <zephyr.h>
+
+#define PRV_MARGIN_MS ((int64_t)CONFIG_IOWA_LIFETIME_MARGIN * 1000)
+
+static struct k_spinlock prv_lock;
+static K_SEM_DEFINE(prv_grantSem, 0, 1);
+static struct k_poll_signal prv_wakeSignal = K_POLL_SIGNAL_INITIALIZER(prv_wakeSignal);
+
+static void prv_tauTimerFn(struct k_timer *timerP);
+static K_TIMER_DEFINE(prv_tauTimer, prv_tauTimerFn, NULL);
+
+// Granted timers
+static int32_t prv_tau = -1;
+static int32_t prv_activeTime = -1;
+static int32_t prv_edrx;
+static int32_t prv_ptw;
+
+static bool prv_rrcConnected;
+static int64_t prv_lastIdle;
+
+static int32_t prv_lifetime;
+// Lifetime following new timers, not set on the server yet, 0 when none
+static int32_t prv_newLifetime;
+static bool prv_registered;
+static int64_t prv_lastRenewal;
+// client_lifetime_update_due() returned true, the update is not sent yet
+static bool prv_updatePending;
+// The next IOWA_EVENT_REG_UPDATING is ours
+static bool prv_heartbeatSent;
+
+static uint32_t prv_wakeupCount;
+static uint32_t prv_alignedCount;
+static uint32_t prv_stackCount;
+static uint32_t prv_stackWakeupCount;
+static uint32_t prv_failedCount;
+static uint32_t prv_changedCount;
+
+static void prv_tauTimerFn(struct k_timer *timerP)
+{
+    (void)timerP;
+
+    k_poll_signal_raise(&prv_wakeSignal, 0);
+}
+
+// Called under the lock
+static bool prv_isTauAligned(int32_t lifetime)
+{
+    return prv_tau > 0
+           && (int64_t)lifetime * 1000 >= 2 * (int64_t)prv_tau * 1000 + PRV_MARGIN_MS;
+}
+
+// Called under the lock
+static int32_t prv_computeLifetime(void)
+{
+    int32_t lifetime;
+    int64_t alignedLifetime;
+    int32_t count;
+
+    lifetime = CONFIG_IOWA_SERVER_LIFETIME;
+
+    if (prv_tau > 0)
+    {
+        // Renewed every count periods, one more covers the wait for the
+        // next periodic TAU
+        count = MAX((lifetime + prv_tau - 1) / prv_tau, 1);
+        alignedLifetime = (int64_t)(count + 1) * prv_tau + CONFIG_IOWA_LIFETIME_MARGIN;
+        if (alignedLifetime <= CONFIG_IOWA_LIFETIME_MAX)
+        {
+            return (int32_t)alignedLifetime;
+        }
+    }
+    else if (prv_edrx > 0)
+    {
+        // The server must be able to reach the device in a paging window
+        lifetime = MAX(lifetime, (prv_edrx + prv_ptw) / 1000 + 1 + CONFIG_IOWA_LIFETIME_MARGIN);
+    }
+
+    return MIN(lifetime, CONFIG_IOWA_LIFETIME_MAX);
+}
+
+// Called under the lock, when the granted timers changed. Once the lifetime
+// is given to the stack, a different one is pushed to the server by the
+// next client_lifetime_update().
+static void prv_checkLifetime(void)
+{
+    int32_t lifetime;
+
+    if (prv_lifetime <= 0)
+    {
+        // Computed by client_lifetime_get()
+        return;
+    }
+
+    lifetime = prv_computeLifetime();
+    prv_newLifetime = (lifetime != prv_lifetime) ? lifetime : 0;
+    if (prv_newLifetime != 0)
+    {
+        k_poll_signal_raise(&prv_wakeSignal, 0);
+    }
+}
+
+void client_lifetime_set_psm(int32_t tau,
+                             int32_t activeTime)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    prv_tau = tau;
+    prv_activeTime = activeTime;
+    prv_checkLifetime();
+    k_spin_unlock(&prv_lock, key);
+
+    k_sem_give(&prv_grantSem);
+}
+
+void client_lifetime_set_edrx(int32_t edrx,
+                              int32_t ptw)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    prv_edrx = edrx;
+    prv_ptw = ptw;
+    prv_checkLifetime();
+    k_spin_unlock(&prv_lock, key);
+
+    k_sem_give(&prv_grantSem);
+}
+
+void client_lifetime_set_rrc(bool connected)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    if (connected
+        && !prv_rrcConnected)
+    {
+        prv_wakeupCount++;
+        k_timer_stop(&prv_tauTimer);
+        k_poll_signal_raise(&prv_wakeSignal, 0);
+    }
+    else if (!connected
+             && prv_rrcConnected)
+    {
+        // The periodic TAU timer of the modem starts
+        prv_lastIdle = k_uptime_get();
+        if (prv_tau > 0)
+        {
+            k_timer_start(&prv_tauTimer,
+                          K_MSEC(MAX((int64_t)prv_tau * 1000 - CONFIG_IOWA_LIFETIME_TAU_LEAD, 0)),
+                          K_NO_WAIT);
+        }
+    }
+    prv_rrcConnected = connected;
+    k_spin_unlock(&prv_lock, key);
+}
+
+struct k_poll_signal * client_lifetime_get_signal(void)
+{
+    return &prv_wakeSignal;
+}
+
+int32_t client_lifetime_get(int32_t waitMs)
+{
+    k_spinlock_key_t key;
+    int32_t lifetime;
+    int32_t tau;
+    int32_t edrx;
+
+    // The timers come with the network registration, shortly after the
+    // link is reported up
+    (void)k_sem_take(&prv_grantSem, K_MSEC(waitMs));
+
+    key = k_spin_lock(&prv_lock);
+    lifetime = prv_computeLifetime();
+    prv_lifetime = lifetime;
+    tau = prv_tau;
+    edrx = prv_edrx;
+    k_spin_unlock(&prv_lock, key);
+
+    printk("Lifetime: %d s (TAU %d s, eDRX %d ms)\n", lifetime, tau, edrx);
+
+    return lifetime;
+}
+
+void client_lifetime_registered(void)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    prv_registered = true;
+    prv_lastRenewal = k_uptime_get();
+    k_spin_unlock(&prv_lock, key);
+}
+
+void client_lifetime_updating(void)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    if (prv_heartbeatSent)
+    {
+        prv_heartbeatSent = false;
+    }
+    else
+    {
+        prv_stackCount++;
+        if (!prv_rrcConnected)
+        {
+            prv_stackWakeupCount++;
+        }
+    }
+    prv_lastRenewal = k_uptime_get();
+    k_spin_unlock(&prv_lock, key);
+}
+
+void client_lifetime_unregistered(void)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    prv_registered = false;
+    k_spin_unlock(&prv_lock, key);
+}
+
+bool client_lifetime_update_due(int64_t now)
+{
+    k_spinlock_key_t key;
+    int64_t lifetimeMs;
+    int64_t tauMs;
+    bool due;
+
+    due = false;
+
+    key = k_spin_lock(&prv_lock);
+    if (prv_registered
+        && !prv_updatePending
+        && prv_lifetime > 0)
+    {
+        lifetimeMs = (int64_t)prv_lifetime * 1000;
+        if (prv_newLifetime != 0)
+        {
+            // The registered lifetime no longer matches the timers
+            due = true;
+        }
+        else if (prv_isTauAligned(prv_lifetime))
+        {
+            // The radio is up, or about to be for the periodic TAU: the
+            // next wake is at most a TAU away
+            tauMs = (int64_t)prv_tau * 1000;
+            if (prv_rrcConnected
+                || (prv_lastIdle != 0 && now + CONFIG_IOWA_LIFETIME_TAU_LEAD >= prv_lastIdle + tauMs))
+            {
+                due = (now + tauMs >= prv_lastRenewal + lifetimeMs - PRV_MARGIN_MS);
+            }
+        }
+        else
+        {
+            due = prv_rrcConnected
+                  && now >= prv_lastRenewal + lifetimeMs / 2;
+        }
+        prv_updatePending = due;
+    }
+    k_spin_unlock(&prv_lock, key);
+
+    return due;
+}
+
+void client_lifetime_update(iowa_context_t contextP,
+                            uint16_t shortId)
+{
+    k_spinlock_key_t key;
+    iowa_status_t result;
+    int32_t lifetime;
+
+    key = k_spin_lock(&prv_lock);
+    prv_heartbeatSent = true;
+    lifetime = prv_newLifetime;
+    k_spin_unlock(&prv_lock, key);
+
+    result = IOWA_COAP_NO_ERROR;
+    if (lifetime != 0)
+    {
+        // Sent to the server with the Registration Update below
+        result = iowa_client_set_server_configuration(contextP, shortId, IOWA_SERVER_SETTING_LIFETIME, &lifetime);
+    }
+    if (result == IOWA_COAP_NO_ERROR)
+    {
+        result = iowa_client_send_heartbeat(contextP, shortId);
+    }
+
+    key = k_spin_lock(&prv_lock);
+    prv_updatePending = false;
+    if (result == IOWA_COAP_NO_ERROR)
+    {
+        prv_alignedCount++;
+        prv_lastRenewal = k_uptime_get();
+        if (lifetime != 0)
+        {
+            prv_lifetime = lifetime;
+            prv_changedCount++;
+            // Unless the timers changed again meanwhile
+            if (prv_newLifetime == lifetime)
+            {
+                prv_newLifetime = 0;
+            }
+        }
+    }
+    else
+    {
+        prv_heartbeatSent = false;
+        prv_failedCount++;
+    }
+    k_spin_unlock(&prv_lock, key);
+
+    if (result != IOWA_COAP_NO_ERROR)
+    {
+        printk("Lifetime: sending the update failed (%u.%02u)\n", (result & 0xFF) >> 5, (result & 0x1F));
+    }
+    else if (lifetime != 0)
+    {
+        printk("Lifetime: changed to %d s\n", lifetime);
+    }
+}
+
+void client_lifetime_update_dropped(void)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    prv_updatePending = false;
+    k_spin_unlock(&prv_lock, key);
+}
+
+void client_lifetime_print_stats(void)
+{
+    printk("Lifetime: %d s, TAU %d s, active time %d s, eDRX %d ms, PTW %d ms\n",
+           prv_lifetime, prv_tau, prv_activeTime, prv_edrx, prv_ptw);
+    printk("Lifetime: %u updates on a wake of the radio, %u by the stack (%u waking the radio), %u failed, %u radio wakeups\n",
+           prv_alignedCount, prv_stackCount, prv_stackWakeupCount, prv_failedCount, prv_wakeupCount);
+    printk("Lifetime: changed %u times with the timers\n", prv_changedCount);
+}
@@ -0,0 +1,82 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Registration lifetime following the LTE
+ * power saving timers.
+ *
+ * The lifetime registered with the server is
+ * derived from the periodic TAU and active time
+ * granted for PSM, or from the eDRX cycle, and
+ * the Registration Updates are sent when the
+ * modem is awake anyway: while its RRC
+ * connection is up, or just before its periodic
+ * TAU. An update is sent at the last of these
+ * opportunities before the registration would
+ * expire, so that the stack has no update of
+ * its own to send on a sleeping radio.
+ *
+ * When the network grants other timers later
+ * on, the lifetime is computed again and a
+ * different one is sent to the server with a
+ * Registration Update.
+ *
+ * The network events come from the LTE handler
+ * on the nRF9160 and from client_lte_sim.c on
+ * the host targets.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_LIFETIME_INCLUDE_
+#define _CLIENT_LIFETIME_INCLUDE_
+
+#include "iowa_client.h"
+
+#include <zephyr.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Network events, from any context. Times not granted are negative for
+// PSM and 0 for eDRX. A change of the lifetime raises the signal below.
+void client_lifetime_set_psm(int32_t tau,           // in seconds
+                             int32_t activeTime);   // in seconds
+void client_lifetime_set_edrx(int32_t edrx,         // in ms
+                              int32_t ptw);         // in ms
+void client_lifetime_set_rrc(bool connected);
+
+// Returns the lifetime to register with, in seconds, waiting up to waitMs
+// for the timers granted by the attach.
+int32_t client_lifetime_get(int32_t waitMs);
+
+// Called from the IOWA event callback.
+void client_lifetime_registered(void);
+void client_lifetime_updating(void);
+void client_lifetime_unregistered(void);
+
+// Signal raised when the radio wakes up, and shortly before the periodic
+// TAU: the time to call client_lifetime_update_due().
+struct k_poll_signal * client_lifetime_get_signal(void);
+
+// Returns true when a Registration Update should be sent now, the radio
+// being awake anyway, or the lifetime having changed with the timers.
+// Called periodically, the update is then sent with
+// client_lifetime_update(), which sets the new lifetime first.
+bool client_lifetime_update_due(int64_t now);
+void client_lifetime_update(iowa_context_t contextP,
+                            uint16_t shortId);
+
+// Called instead of client_lifetime_update() when the update could not be
+// handed to the IOWA thread: it is due again at the next call.
+void client_lifetime_update_dropped(void);
+
+// Prints the lifetime, the granted timers, the updates sent on a wake of
+// the radio and by the stack, and the radio wakeups.
+void client_lifetime_print_stats(void);
+
+#endif
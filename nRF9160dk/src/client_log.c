@@ -0,0 +1,390 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the routing of the IOWA
+ * traces to the deferred Zephyr logging.
+ *
+ * IOWA outputs a trace line in several calls to
+ * iowa_system_trace(). The pieces are formatted
+ * by the calling thread in its own line buffer,
+ * so that the lines of several IOWA threads do
+ * not mix; complete lines are copied in the log
+ * buffer and output by the logging thread. The
+ * part and the level of a line are read from the
+ * tags of its header, its first piece: the rest
+ * of a line filtered out by the level of its part
+ * is not formatted.
+ *
+ **********************************************/
+
+#include "client_log.h"
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <logging/log.h>
+#include <logging/log_ctrl.h>
+
+// The stack only outputs the traces up to CONFIG_IOWA_TRACE_LEVEL_*: all of
+// them are compiled in, the parts are filtered at runtime.
+LOG_MODULE_REGISTER(iowa, LOG_LEVEL_DBG);
+
+LOG_INSTANCE_REGISTER(iowa, base, LOG_LEVEL_DBG);
+LOG_INSTANCE_REGISTER(iowa, coap, LOG_LEVEL_DBG);
+LOG_INSTANCE_REGISTER(iowa, comm, LOG_LEVEL_DBG);
+LOG_INSTANCE_REGISTER(iowa, data, LOG_LEVEL_DBG);
+LOG_INSTANCE_REGISTER(iowa, lwm2m, LOG_LEVEL_DBG);
+LOG_INSTANCE_REGISTER(iowa, object, LOG_LEVEL_DBG);
+LOG_INSTANCE_REGISTER(iowa, security, LOG_LEVEL_DBG);
+LOG_INSTANCE_REGISTER(iowa, system, LOG_LEVEL_DBG);
+
+// The tags are only looked for in the beginning of the line
+#define PRV_HEADER_LENGTH 40
+
+// LOG_INSTANCE_PTR() points to the dynamic data of the instance when the
+// levels can be changed at runtime
+#if defined(CONFIG_LOG_RUNTIME_FILTERING)
+typedef struct log_source_dynamic_data log_instance_t;
+#else
+typedef const struct log_source_const_data log_instance_t;
+#endif
+
+typedef struct
+{
+    const char *tag;
+    log_instance_t *instanceP;
+} log_part_t;
+
+static const log_part_t prv_partArray[] =
+{
+    { "BASE",     LOG_INSTANCE_PTR(iowa, base) },
+    { "COAP",     LOG_INSTANCE_PTR(iowa, coap) },
+    { "COMM",     LOG_INSTANCE_PTR(iowa, comm) },
+    { "DATA",     LOG_INSTANCE_PTR(iowa, data) },
+    { "LWM2M",    LOG_INSTANCE_PTR(iowa, lwm2m) },
+    { "OBJECT",   LOG_INSTANCE_PTR(iowa, object) },
+    { "SECURITY", LOG_INSTANCE_PTR(iowa, security) },
+    { "SYSTEM",   LOG_INSTANCE_PTR(iowa, system) },
+};
+
+typedef struct
+{
+    const char *tag;
+    uint8_t level;
+} log_level_t;
+
+static const log_level_t prv_levelArray[] =
+{
+    { "ERROR",   LOG_LEVEL_ERR },
+    { "WARNING", LOG_LEVEL_WRN },
+    { "INFO",    LOG_LEVEL_INF },
+    { "TRACE",   LOG_LEVEL_DBG },
+};
+
+typedef struct
+{
+    k_tid_t threadId;   // NULL when free
+    bool filtered;      // the rest of the line is skipped
+    size_t length;
+    char buffer[CONFIG_IOWA_LOG_LINE_SIZE];
+} log_line_t;
+
+// The mutex only guards the ownership of the buffers: each one is filled
+// by its thread alone.
+static K_MUTEX_DEFINE(prv_lineMutex);
+static log_line_t prv_lineArray[CONFIG_IOWA_LOG_THREADS];
+
+// Returns true if the tag appears in the first headerLength bytes of line.
+static bool prv_hasTag(const char *line,
+                       size_t headerLength,
+                       const char *tag)
+{
+    size_t tagLength;
+    size_t i;
+
+    tagLength = strlen(tag);
+
+    for (i = 0; i + tagLength <= headerLength; i++)
+    {
+        if (memcmp(line + i, tag, tagLength) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Reads the part and the level of a line from the tags of its header.
+// instanceP is NULL for a line without a known part.
+static void prv_parseHeader(const char *line,
+                            size_t length,
+                            log_instance_t **instancePP,
+                            uint8_t *levelP)
+{
+    size_t headerLength;
+    size_t i;
+
+    headerLength = MIN(length, PRV_HEADER_LENGTH);
+
+    *instancePP = NULL;
+    for (i = 0; i < ARRAY_SIZE(prv_partArray) && *instancePP == NULL; i++)
+    {
+        if (prv_hasTag(line, headerLength, prv_partArray[i].tag))
+        {
+            *instancePP = prv_partArray[i].instanceP;
+        }
+    }
+
+    *levelP = LOG_LEVEL_INF;
+    for (i = 0; i < ARRAY_SIZE(prv_levelArray); i++)
+    {
+        if (prv_hasTag(line, headerLength, prv_levelArray[i].tag))
+        {
+            *levelP = prv_levelArray[i].level;
+            break;
+        }
+    }
+}
+
+// Returns true if a line of this part and level would be output by at
+// least one log backend, as checked by the LOG_INST_* macros.
+static bool prv_isEnabled(log_instance_t *instanceP,
+                          uint8_t level)
+{
+#if defined(CONFIG_LOG_RUNTIME_FILTERING)
+    const struct log_backend *backendP;
+    uint32_t sourceId;
+    int i;
+#endif
+
+    if (level > CONFIG_LOG_MAX_LEVEL)
+    {
+        return false;
+    }
+
+#if defined(CONFIG_LOG_RUNTIME_FILTERING)
+    sourceId = (instanceP != NULL) ? log_dynamic_source_id(instanceP) : LOG_CURRENT_MODULE_ID();
+
+    for (i = 0; i < log_backend_count_get(); i++)
+    {
+        backendP = log_backend_get(i);
+        if (log_backend_is_active(backendP)
+            && level <= log_filter_get(backendP, CONFIG_LOG_DOMAIN_ID, sourceId, true))
+        {
+            return true;
+        }
+    }
+
+    return false;
+#else
+    // The parts are registered at LOG_LEVEL_DBG
+    (void)instanceP;
+
+    return true;
+#endif
+}
+
+// Hands a complete line to the logging subsystem. The line is duplicated
+// in the log buffer: its formatting is done by the logging thread.
+static void prv_emit(const char *line,
+                     size_t length)
+{
+    log_instance_t *instanceP;
+    uint8_t level;
+
+    prv_parseHeader(line, length, &instanceP, &level);
+
+    // Lines without a known part are logged by the "iowa" module
+    if (instanceP == NULL)
+    {
+        switch (level)
+        {
+        case LOG_LEVEL_ERR:
+            LOG_ERR("%s", log_strdup(line));
+            break;
+        case LOG_LEVEL_WRN:
+            LOG_WRN("%s", log_strdup(line));
+            break;
+        case LOG_LEVEL_DBG:
+            LOG_DBG("%s", log_strdup(line));
+            break;
+        default:
+            LOG_INF("%s", log_strdup(line));
+            break;
+        }
+        return;
+    }
+
+    switch (level)
+    {
+    case LOG_LEVEL_ERR:
+        LOG_INST_ERR(instanceP, "%s", log_strdup(line));
+        break;
+    case LOG_LEVEL_WRN:
+        LOG_INST_WRN(instanceP, "%s", log_strdup(line));
+        break;
+    case LOG_LEVEL_DBG:
+        LOG_INST_DBG(instanceP, "%s", log_strdup(line));
+        break;
+    default:
+        LOG_INST_INF(instanceP, "%s", log_strdup(line));
+        break;
+    }
+}
+
+// Returns the line buffer of the calling thread, or NULL if all of them
+// hold the line of another thread.
+static log_line_t * prv_getLine(void)
+{
+    k_tid_t threadId;
+    log_line_t *lineP;
+    size_t i;
+
+    threadId = k_current_get();
+    lineP = NULL;
+
+    (void)k_mutex_lock(&prv_lineMutex, K_FOREVER);
+    for (i = 0; i < ARRAY_SIZE(prv_lineArray); i++)
+    {
+        if (prv_lineArray[i].threadId == threadId)
+        {
+            lineP = prv_lineArray + i;
+            break;
+        }
+        if (lineP == NULL
+            && prv_lineArray[i].threadId == NULL)
+        {
+            lineP = prv_lineArray + i;
+        }
+    }
+    if (lineP != NULL)
+    {
+        lineP->threadId = threadId;
+    }
+    k_mutex_unlock(&prv_lineMutex);
+
+    return lineP;
+}
+
+static void prv_releaseLine(log_line_t *lineP)
+{
+    (void)k_mutex_lock(&prv_lineMutex, K_FOREVER);
+    lineP->threadId = NULL;
+    k_mutex_unlock(&prv_lineMutex);
+}
+
+// Outputs line, without its line ending.
+static void prv_output(char *line,
+                       size_t length)
+{
+    // The log backends add their own line ending
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == '\n'))
+    {
+        length--;
+    }
+    line[length] = 0;
+
+    if (length > 0)
+    {
+        prv_emit(line, length);
+    }
+}
+
+void client_log_trace(const char *format,
+                      va_list varArgs)
+{
+    char line[CONFIG_IOWA_LOG_LINE_SIZE];
+    log_line_t *lineP;
+    log_instance_t *instanceP;
+    uint8_t level;
+    bool headerPiece;
+    size_t length;
+    char *endP;
+    int result;
+
+    lineP = prv_getLine();
+    if (lineP == NULL)
+    {
+        // More threads than line buffers: the piece makes its own line
+        result = vsnprintk(line, sizeof(line), format, varArgs);
+        if (result > 0)
+        {
+            prv_output(line, MIN((size_t)result, sizeof(line) - 1));
+        }
+        return;
+    }
+
+    // The pieces of a filtered line are not formatted, until the one
+    // ending the line
+    if (lineP->filtered)
+    {
+        if (strchr(format, '\n') != NULL)
+        {
+            lineP->filtered = false;
+            prv_releaseLine(lineP);
+        }
+        return;
+    }
+
+    headerPiece = (lineP->length == 0);
+
+    if (lineP->length < sizeof(lineP->buffer) - 1)
+    {
+        result = vsnprintk(lineP->buffer + lineP->length, sizeof(lineP->buffer) - lineP->length, format, varArgs);
+        if (result > 0)
+        {
+            lineP->length = MIN(lineP->length + result, sizeof(lineP->buffer) - 1);
+        }
+    }
+
+    if (headerPiece)
+    {
+        prv_parseHeader(lineP->buffer, lineP->length, &instanceP, &level);
+        if (!prv_isEnabled(instanceP, level))
+        {
+            lineP->filtered = (memchr(lineP->buffer, '\n', lineP->length) == NULL);
+            lineP->length = 0;
+            if (!lineP->filtered)
+            {
+                prv_releaseLine(lineP);
+            }
+            return;
+        }
+    }
+
+    // Wait for the end of the line, unless the buffer is full
+    endP = memchr(lineP->buffer, '\n', lineP->length);
+    if (endP == NULL && lineP->length < sizeof(lineP->buffer) - 1)
+    {
+        return;
+    }
+
+    length = (endP != NULL) ? (size_t)(endP - lineP->buffer) : lineP->length;
+    memcpy(line, lineP->buffer, length);
+
+    // Keep what follows the end of the line for the next one
+    if (endP != NULL)
+    {
+        lineP->length -= length + 1;
+        memmove(lineP->buffer, endP + 1, lineP->length);
+    }
+    else
+    {
+        lineP->length = 0;
+    }
+
+    // A thread between two lines does not hold a buffer
+    if (lineP->length == 0)
+    {
+        prv_releaseLine(lineP);
+    }
+
+    prv_output(line, length);
+}
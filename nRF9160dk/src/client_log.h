@@ -0,0 +1,31 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Routing of the IOWA traces to the Zephyr
+ * logging subsystem.
+ *
+ * Each IOWA part is a log instance of the "iowa"
+ * module ("iowa.coap", "iowa.lwm2m"...) so that
+ * its level can be changed at runtime with the
+ * "log enable" and "log disable" shell commands.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_LOG_INCLUDE_
+#define _CLIENT_LOG_INCLUDE_
+
+#include <stdarg.h>
+
+// Called by iowa_system_trace(). The trace is formatted in the line buffer
+// of the calling thread until the end of its line, then handed to the
+// logging thread which outputs it.
+void client_log_trace(const char *format,
+                      va_list varArgs);
+
+#endif
@@ -0,0 +1,116 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the simulated LTE
+ * events of the host targets.
+ *
+ * The RRC state is driven by two timers: the
+ * inactivity timer releases the connection, and
+ * the TAU timer, started at each release, opens
+ * one for the periodic TAU. Traffic during the
+ * TAU connection just keeps it open, as the
+ * modem sends both at once.
+ *
+ **********************************************/
+
+#include "client_lte_sim.h"
+#include "client_lifetime.h"
+
+#include <zephyr.h>
+
+static struct k_spinlock prv_lock;
+static bool prv_attached;
+static bool prv_connected;
+
+static uint32_t prv_trafficWakeupCount;
+static uint32_t prv_tauWakeupCount;
+
+static void prv_inactivityTimerFn(struct k_timer *timerP);
+static void prv_tauTimerFn(struct k_timer *timerP);
+
+static K_TIMER_DEFINE(prv_inactivityTimer, prv_inactivityTimerFn, NULL);
+static K_TIMER_DEFINE(prv_tauTimer, prv_tauTimerFn, NULL);
+
+// Called under the lock
+static void prv_connect(void)
+{
+    k_timer_stop(&prv_tauTimer);
+    k_timer_start(&prv_inactivityTimer, K_MSEC(CONFIG_IOWA_LTE_SIM_INACTIVITY), K_NO_WAIT);
+    if (!prv_connected)
+    {
+        prv_connected = true;
+        client_lifetime_set_rrc(true);
+    }
+}
+
+static void prv_inactivityTimerFn(struct k_timer *timerP)
+{
+    k_spinlock_key_t key;
+
+    (void)timerP;
+
+    key = k_spin_lock(&prv_lock);
+    prv_connected = false;
+    client_lifetime_set_rrc(false);
+    if (CONFIG_IOWA_LTE_SIM_TAU > 0)
+    {
+        k_timer_start(&prv_tauTimer, K_SECONDS(CONFIG_IOWA_LTE_SIM_TAU), K_NO_WAIT);
+    }
+    k_spin_unlock(&prv_lock, key);
+}
+
+static void prv_tauTimerFn(struct k_timer *timerP)
+{
+    k_spinlock_key_t key;
+
+    (void)timerP;
+
+    key = k_spin_lock(&prv_lock);
+    prv_tauWakeupCount++;
+    prv_connect();
+    k_spin_unlock(&prv_lock, key);
+}
+
+void client_lte_sim_attach(void)
+{
+    k_spinlock_key_t key;
+
+    // Without PSM, the modem reports negative timers
+    client_lifetime_set_psm(CONFIG_IOWA_LTE_SIM_TAU > 0 ? CONFIG_IOWA_LTE_SIM_TAU : -1,
+                            CONFIG_IOWA_LTE_SIM_TAU > 0 ? CONFIG_IOWA_LTE_SIM_ACTIVE_TIME : -1);
+    client_lifetime_set_edrx(CONFIG_IOWA_LTE_SIM_EDRX, CONFIG_IOWA_LTE_SIM_EDRX > 0 ? CONFIG_IOWA_LTE_SIM_PTW : 0);
+
+    // The attach itself runs on an RRC connection
+    key = k_spin_lock(&prv_lock);
+    prv_attached = true;
+    prv_connect();
+    k_spin_unlock(&prv_lock, key);
+}
+
+void client_lte_sim_traffic(void)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_lock);
+    if (prv_attached)
+    {
+        if (!prv_connected)
+        {
+            prv_trafficWakeupCount++;
+        }
+        prv_connect();
+    }
+    k_spin_unlock(&prv_lock, key);
+}
+
+void client_lte_sim_print_stats(void)
+{
+    printk("LTE simulation: %u RRC connections opened by the traffic, %u by the periodic TAU\n",
+           prv_trafficWakeupCount, prv_tauWakeupCount);
+}
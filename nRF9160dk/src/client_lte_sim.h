@@ -0,0 +1,37 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Simulated LTE events, for the host targets.
+ *
+ * The host network has no radio: this emulates
+ * the events an LTE-M modem reports. The attach
+ * grants the PSM and eDRX timers of
+ * CONFIG_IOWA_LTE_SIM_*. Each datagram sent or
+ * received opens an RRC connection, released
+ * after CONFIG_IOWA_LTE_SIM_INACTIVITY ms
+ * without traffic, and the periodic TAU wakes
+ * the radio each CONFIG_IOWA_LTE_SIM_TAU
+ * seconds after a release.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_LTE_SIM_INCLUDE_
+#define _CLIENT_LTE_SIM_INCLUDE_
+
+// Called when the emulated attach completes. From any context.
+void client_lte_sim_attach(void);
+
+// Called by the platform for each datagram sent or received.
+void client_lte_sim_traffic(void);
+
+// Prints the RRC connections opened by the traffic and by the periodic
+// TAU.
+void client_lte_sim_print_stats(void);
+
+#endif
@@ -0,0 +1,283 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the memory allocator
+ * used by iowa_system_malloc() and
+ * iowa_system_free().
+ *
+ * A request is served by the smallest size class
+ * able to hold it, then by the larger ones if
+ * this class is exhausted, and finally by the
+ * private heap.
+ *
+ **********************************************/
+
+#include "client_memory.h"
+
+#include <zephyr.h>
+#include <string.h>
+
+// Blocks are aligned for any IOWA structure
+#define PRV_BLOCK_ALIGN 8
+
+K_MEM_SLAB_DEFINE(iowa_slab_16, 16, CONFIG_IOWA_MEMORY_SLAB_16_COUNT, PRV_BLOCK_ALIGN);
+K_MEM_SLAB_DEFINE(iowa_slab_32, 32, CONFIG_IOWA_MEMORY_SLAB_32_COUNT, PRV_BLOCK_ALIGN);
+K_MEM_SLAB_DEFINE(iowa_slab_64, 64, CONFIG_IOWA_MEMORY_SLAB_64_COUNT, PRV_BLOCK_ALIGN);
+K_MEM_SLAB_DEFINE(iowa_slab_128, 128, CONFIG_IOWA_MEMORY_SLAB_128_COUNT, PRV_BLOCK_ALIGN);
+K_MEM_SLAB_DEFINE(iowa_slab_256, 256, CONFIG_IOWA_MEMORY_SLAB_256_COUNT, PRV_BLOCK_ALIGN);
+
+K_HEAP_DEFINE(iowa_heap, CONFIG_IOWA_MEMORY_HEAP_SIZE);
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+// Heap blocks are prefixed with their size to account for the used bytes
+#define PRV_HEAP_HEADER_SIZE PRV_BLOCK_ALIGN
+#else
+#define PRV_HEAP_HEADER_SIZE 0
+#endif
+
+typedef struct
+{
+    struct k_mem_slab *slabP;
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+    uint32_t used;
+    uint32_t highWater;
+    uint32_t exhausted;
+#endif
+} memory_class_t;
+
+// Sorted by increasing block size
+static memory_class_t prv_classArray[] =
+{
+    { .slabP = &iowa_slab_16 },
+    { .slabP = &iowa_slab_32 },
+    { .slabP = &iowa_slab_64 },
+    { .slabP = &iowa_slab_128 },
+    { .slabP = &iowa_slab_256 },
+};
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+static struct k_spinlock prv_statsLock;
+
+static size_t prv_heapUsed;
+static size_t prv_heapHighWater;
+static uint32_t prv_heapFailures;
+
+static uint32_t prv_allocCount;
+static uint64_t prv_allocCycles;
+static uint32_t prv_allocMaxCycles;
+#endif
+
+static bool prv_isInSlab(struct k_mem_slab *slabP,
+                         void *pointer)
+{
+    return (char *)pointer >= slabP->buffer
+           && (char *)pointer < slabP->buffer + slabP->block_size * slabP->num_blocks;
+}
+
+static void * prv_heapAlloc(size_t size)
+{
+    uint8_t *pointer;
+
+    pointer = (uint8_t *)k_heap_alloc(&iowa_heap, size + PRV_HEAP_HEADER_SIZE, K_NO_WAIT);
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+    {
+        k_spinlock_key_t key;
+
+        key = k_spin_lock(&prv_statsLock);
+        if (pointer == NULL)
+        {
+            prv_heapFailures++;
+        }
+        else
+        {
+            memcpy(pointer, &size, sizeof(size_t));
+            pointer += PRV_HEAP_HEADER_SIZE;
+
+            prv_heapUsed += size;
+            if (prv_heapUsed > prv_heapHighWater)
+            {
+                prv_heapHighWater = prv_heapUsed;
+            }
+        }
+        k_spin_unlock(&prv_statsLock, key);
+    }
+#endif
+
+    return pointer;
+}
+
+static void prv_heapFree(void *pointer)
+{
+    uint8_t *blockP;
+
+    blockP = (uint8_t *)pointer - PRV_HEAP_HEADER_SIZE;
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+    {
+        k_spinlock_key_t key;
+        size_t size;
+
+        memcpy(&size, blockP, sizeof(size_t));
+
+        key = k_spin_lock(&prv_statsLock);
+        prv_heapUsed -= size;
+        k_spin_unlock(&prv_statsLock, key);
+    }
+#endif
+
+    k_heap_free(&iowa_heap, blockP);
+}
+
+void * client_memory_alloc(size_t size)
+{
+    void *pointer;
+    size_t i;
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+    uint32_t start;
+    uint32_t elapsed;
+    k_spinlock_key_t key;
+
+    start = k_cycle_get_32();
+#endif
+
+    pointer = NULL;
+
+    for (i = 0; i < ARRAY_SIZE(prv_classArray) && pointer == NULL; i++)
+    {
+        memory_class_t *classP;
+
+        classP = prv_classArray + i;
+        if (size > classP->slabP->block_size)
+        {
+            continue;
+        }
+
+        if (k_mem_slab_alloc(classP->slabP, &pointer, K_NO_WAIT) != 0)
+        {
+            pointer = NULL;
+        }
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+        key = k_spin_lock(&prv_statsLock);
+        if (pointer == NULL)
+        {
+            classP->exhausted++;
+        }
+        else
+        {
+            classP->used++;
+            if (classP->used > classP->highWater)
+            {
+                classP->highWater = classP->used;
+            }
+        }
+        k_spin_unlock(&prv_statsLock, key);
+#endif
+    }
+
+    if (pointer == NULL)
+    {
+        pointer = prv_heapAlloc(size);
+    }
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+    elapsed = k_cycle_get_32() - start;
+
+    key = k_spin_lock(&prv_statsLock);
+    prv_allocCount++;
+    prv_allocCycles += elapsed;
+    if (elapsed > prv_allocMaxCycles)
+    {
+        prv_allocMaxCycles = elapsed;
+    }
+    k_spin_unlock(&prv_statsLock, key);
+#endif
+
+    return pointer;
+}
+
+void client_memory_free(void *pointer)
+{
+    size_t i;
+
+    if (pointer == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(prv_classArray); i++)
+    {
+        if (prv_isInSlab(prv_classArray[i].slabP, pointer))
+        {
+            k_mem_slab_free(prv_classArray[i].slabP, &pointer);
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+            {
+                k_spinlock_key_t key;
+
+                key = k_spin_lock(&prv_statsLock);
+                prv_classArray[i].used--;
+                k_spin_unlock(&prv_statsLock, key);
+            }
+#endif
+            return;
+        }
+    }
+
+    prv_heapFree(pointer);
+}
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+size_t client_memory_get_used(void)
+{
+    size_t used;
+    size_t i;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_statsLock);
+    used = prv_heapUsed;
+    for (i = 0; i < ARRAY_SIZE(prv_classArray); i++)
+    {
+        used += prv_classArray[i].used * prv_classArray[i].slabP->block_size;
+    }
+    k_spin_unlock(&prv_statsLock, key);
+
+    return used;
+}
+
+void client_memory_print_stats(void)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(prv_classArray); i++)
+    {
+        printk("Memory: %u-byte class: used %u/%u, peak %u, exhausted %u times\n",
+               (unsigned int)prv_classArray[i].slabP->block_size,
+               prv_classArray[i].used,
+               prv_classArray[i].slabP->num_blocks,
+               prv_classArray[i].highWater,
+               prv_classArray[i].exhausted);
+    }
+
+    printk("Memory: heap: used %u/%u bytes, peak %u bytes, %u failures\n",
+           (unsigned int)prv_heapUsed,
+           CONFIG_IOWA_MEMORY_HEAP_SIZE,
+           (unsigned int)prv_heapHighWater,
+           prv_heapFailures);
+
+    if (prv_allocCount != 0)
+    {
+        printk("Memory: %u allocations, latency avg %u us, max %u us\n",
+               prv_allocCount,
+               k_cyc_to_us_floor32((uint32_t)(prv_allocCycles / prv_allocCount)),
+               k_cyc_to_us_floor32(prv_allocMaxCycles));
+    }
+}
+#endif
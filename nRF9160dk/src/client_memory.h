@@ -0,0 +1,37 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Memory allocator dedicated to the IOWA stack.
+ *
+ * Allocations are served from fixed size-class
+ * memory slabs, falling back to a private heap
+ * for larger or overflowing requests. Nothing is
+ * taken from the system heap.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_MEMORY_INCLUDE_
+#define _CLIENT_MEMORY_INCLUDE_
+
+#include <stddef.h>
+
+void * client_memory_alloc(size_t size);
+void client_memory_free(void *pointer);
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+// Returns the number of bytes currently allocated, rounded up to the
+// size classes.
+size_t client_memory_get_used(void);
+
+// Prints, for each size class and for the fallback heap, the current and
+// peak usage, the failures and the allocation latency.
+void client_memory_print_stats(void);
+#endif
+
+#endif
@@ -8,104 +8,500 @@
 /**********************************************
  *
  * This file implements the IOWA system
- * abstraction functions for Linux and Windows.
+ * abstraction functions for Zephyr.
  *
  * This is tailored for the LwM2M Client on nrf9160DK
- * TODO: TCP support to add
+ * (offloaded modem sockets) and also runs over the
+ * native network stack of native_posix and qemu_x86.
+ * The stream connections (CONFIG_IOWA_TCP) block
+ * the IOWA thread up to CONFIG_IOWA_TCP_CONNECT_TIMEOUT
+ * while connecting, and are kept open for a while
+ * after IOWA closes them to be reused.
+ * With CONFIG_IOWA_SEND_QUEUE, the datagram sockets
+ * do not block: what they can not take is
+ * queued until poll() reports them writable.
+ * With CONFIG_IOWA_RECV_BATCH, all the datagrams
+ * pending on a readable socket are read at once
+ * and handed to the stack one by one.
  *
  **********************************************/
 
 // IOWA header
 #include "iowa_platform.h"
+#include "client_platform.h"
+#include "client_memory.h"
+#include "client_probe.h"
+#if defined(CONFIG_IOWA_LOG_DEFERRED)
+#include "client_log.h"
+#endif
+#if defined(CONFIG_IOWA_DNS_CACHE)
+#include "client_dns.h"
+#endif
+#if defined(CONFIG_IOWA_WARM_START)
+#include "client_context.h"
+#endif
+#if defined(CONFIG_IOWA_LTE_SIM)
+#include "client_lte_sim.h"
+#endif
+#if defined(CONFIG_IOWA_SEND_QUEUE) || defined(CONFIG_IOWA_RECV_BATCH)
+// for IOWA_BUFFER_SIZE
+#include "iowa_config.h"
+#endif
 
 #include <zephyr.h>
 #include <stdio.h>
 
-#include <modem/lte_lc.h>
 #include <net/socket.h>
 #include <errno.h>
+#if defined(CONFIG_IOWA_TCP) || defined(CONFIG_IOWA_SEND_QUEUE) || defined(CONFIG_IOWA_RECV_BATCH)
+#include <fcntl.h>
+#include <string.h>
+#endif
 
-#include <modem/modem_key_mgmt.h>
 #include <net/tls_credentials.h>
+#if defined(CONFIG_REBOOT) && !defined(CONFIG_ARCH_POSIX)
+#include <sys/reboot.h>
+#endif
+#if defined(CONFIG_NET_STATISTICS_USER_API) && (defined(CONFIG_IOWA_TRAFFIC_STATS) || defined(CONFIG_IOWA_DTLS_STATS))
+// The native network stack counts every packet, security handshakes included
+#define PRV_NET_STATS
+#include <net/net_mgmt.h>
+#include <net/net_stats.h>
+#endif
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+// Upper bounds, in milliseconds, of the timeout lateness histogram buckets.
+// The last bucket counts everything above.
+static const int64_t prv_latenessBounds[] = { 1, 10, 100, 1000 };
+#define PLATFORM_LATENESS_BUCKETS (ARRAY_SIZE(prv_latenessBounds) + 1)
+#endif
+
+// First port tried for the wakeup socket
+#define PRV_WAKEUP_PORT 60000
+
+#if defined(CONFIG_IOWA_TCP)
+// Longest host name of a stream connection kept for reuse
+#define PRV_HOSTNAME_SIZE 64
+#define PRV_PORT_SIZE 8
+#endif
+
+// What the platform knows of an opened connection
+typedef struct
+{
+    iowa_connection_type_t type;
+#if defined(CONFIG_IOWA_TCP)
+    char hostname[PRV_HOSTNAME_SIZE];
+    char port[PRV_PORT_SIZE];
+#endif
+} connection_info_t;
+
+#if defined(CONFIG_IOWA_SEND_QUEUE) || defined(CONFIG_IOWA_RECV_BATCH)
+// get_platform_data() is called once per simulated client with the load
+// generator
+#if defined(CONFIG_IOWA_LOADGEN)
+#define PRV_PLATFORM_COUNT CONFIG_IOWA_LOADGEN_CLIENTS
+#else
+#define PRV_PLATFORM_COUNT 1
+#endif
+#endif
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+// A datagram the socket could not take yet
+typedef struct
+{
+    int sock;
+    int64_t queuedAt;
+    size_t length;
+    uint8_t *data;
+} queued_datagram_t;
+
+// The queued datagrams are copied in static buffers rather than on the
+// system heap: a full queue holds CONFIG_IOWA_SEND_QUEUE_DEPTH datagrams of
+// at most IOWA_BUFFER_SIZE bytes per platform data.
+#define PRV_QUEUE_BUFFER_COUNT (PRV_PLATFORM_COUNT * CONFIG_IOWA_SEND_QUEUE_DEPTH)
+
+static uint8_t prv_queueBuffers[PRV_QUEUE_BUFFER_COUNT][IOWA_BUFFER_SIZE];
+static ATOMIC_DEFINE(prv_queueBufferUsed, PRV_QUEUE_BUFFER_COUNT);
+#endif
+
+#if defined(CONFIG_IOWA_RECV_BATCH)
+// Header of a datagram in the receive buffer. A negative length is the
+// error returned by recv(), as -errno. A record whose socket is -1 has
+// been consumed.
+typedef struct
+{
+    int sock;
+    int length;
+} rx_record_t;
+
+// A datagram is only read when the buffer can take the largest one
+#define PRV_RX_RESERVE (sizeof(rx_record_t) + IOWA_BUFFER_SIZE)
+
+// The receive buffers are static, one per platform data, rather than part
+// of the platform data allocated from the system heap. The records are
+// aligned on an int.
+#define PRV_RX_BUFFER_SIZE ROUND_UP(CONFIG_IOWA_RECV_BATCH_SIZE, sizeof(int))
+
+static uint8_t prv_rxBuffers[PRV_PLATFORM_COUNT][PRV_RX_BUFFER_SIZE] __aligned(sizeof(int));
+static ATOMIC_DEFINE(prv_rxBufferUsed, PRV_PLATFORM_COUNT);
+#endif
+
+#if defined(PRV_NET_STATS)
+typedef struct
+{
+    uint32_t sentPackets;
+    uint32_t receivedPackets;
+    uint64_t bytes;
+} net_counters_t;
+#endif
 
 typedef struct
 {
     // a mutex for iowa_system_mutex_* functions
     struct k_mutex mutex;
 
-    // a socket to interrupt the select()
-    int sysSocket;
+    // a loopback socket to interrupt the select(), and the socket writing
+    // to it, both opened once
+    int wakeupSock;
+    int wakeupSender;
+    atomic_t wakeupPending;
+
+    // the sockets opened by iowa_system_connection_open(), kept ready to be
+    // passed to poll(), followed by the wakeup socket
+    struct pollfd pollArray[CONFIG_IOWA_MAX_CONNECTIONS + 1];
+    connection_info_t infoArray[CONFIG_IOWA_MAX_CONNECTIONS];
+    size_t pollCount;
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+    // oldest first, all sockets mixed
+    queued_datagram_t queue[CONFIG_IOWA_SEND_QUEUE_DEPTH];
+    size_t queueCount;
+
+    uint32_t sendCount;
+    uint32_t sendQueued;
+    uint32_t sendMerged;
+    uint32_t sendDropped;
+    // queue length seen by each send, summed
+    uint64_t queueOccupancy;
+    size_t queuePeak;
+    // duration of the send() calls, in cycles
+    uint32_t sendCalls;
+    uint64_t sendCycles;
+    uint32_t sendCyclesMax;
+    // time spent in the queue by the datagrams finally sent, in milliseconds
+    uint32_t queueDelayCount;
+    int64_t queueDelayTotal;
+    int64_t queueDelayMax;
+#endif
+
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    // datagrams read from the sockets, not yet handed to the stack
+    // one of prv_rxBuffers
+    uint8_t *rxBuffer;
+    size_t rxRead;
+    size_t rxUsed;
+
+    // a burst is the datagrams read in one pass, processed until the
+    // buffer is empty again
+    uint32_t burstStart;
+    uint32_t burstCount;
+    uint32_t burstDatagrams;
+    uint32_t burstMax;
+    uint32_t burstSavedPolls;
+    // time from the read to the processing of the last datagram, in cycles
+    uint64_t burstCycles;
+    uint32_t burstCyclesMax;
+#endif
+
+#if defined(CONFIG_IOWA_TCP)
+    // a stream connection closed by IOWA, kept open until parkedUntil
+    int parkedSock;
+    int64_t parkedUntil;
+    connection_info_t parkedInfo;
+#endif
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+    // interrupt-to-wakeup latency, in cycles
+    uint32_t wakeupStamp;
+    uint32_t wakeupCount;
+    uint32_t wakeupMin;
+    uint32_t wakeupMax;
+    uint64_t wakeupTotal;
+
+    // time spent in iowa_system_connection_select() outside of poll(), in cycles
+    uint32_t selectCount;
+    uint32_t selectWait;
+    uint64_t selectOverhead;
+    uint64_t selectWaitTotal;
+    size_t selectMaxConn;
+    // the same, by number of connections passed by IOWA
+    uint32_t connSelectCount[CONFIG_IOWA_MAX_CONNECTIONS + 1];
+    uint64_t connSelectOverhead[CONFIG_IOWA_MAX_CONNECTIONS + 1];
+
+    // distribution of the lateness of the select() timeouts
+    uint32_t latenessHisto[PLATFORM_LATENESS_BUCKETS];
+
+    // time spent by the stack and the step loop between two calls to
+    // iowa_system_connection_select(), in cycles
+    uint32_t selectReturn;
+    uint32_t stepCount;
+    uint64_t stepTotal;
+    uint32_t stepMax;
+#endif
+
+#if defined(CONFIG_IOWA_LOCK_STATS)
+    // number of times the mutex was taken, and found already taken
+    uint32_t lockCount;
+    uint32_t lockContention;
+#endif
+
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+    // datagrams and bytes exchanged with the servers
+    platform_traffic_t traffic;
+    int64_t lastTraffic;
+
+    // the radio is deemed active from each datagram until
+    // CONFIG_IOWA_TRAFFIC_RADIO_TAIL later
+    int64_t radioStart;
+    int64_t radioEnd;
+    int64_t radioTotal;
+    uint32_t radioWakeups;
+
+#if defined(CONFIG_IOWA_TCP)
+    // stream connections, connect() durations in milliseconds
+    uint32_t tcpConnectCount;
+    uint32_t tcpConnectFailures;
+    int64_t tcpConnectTotal;
+    uint32_t tcpReuseCount;
+#endif
+#if defined(PRV_NET_STATS)
+    // counters of the network stack at get_platform_data()
+    net_counters_t netBaseline;
+#endif
+#endif
+
+#if defined(CONFIG_IOWA_DTLS_STATS)
+    // the handshake in progress: the modem performs it in connect(), the
+    // native stack in the first send(), so it ends with the first send()
+    int handshakeSock;
+    int64_t handshakeStart;
+    uint64_t handshakeNetBytes;
+
+    // the completed handshakes, durations in milliseconds
+    uint32_t handshakeCount;
+    uint32_t handshakeFailures;
+    int64_t handshakeTotal;
+    int64_t handshakeMin;
+    int64_t handshakeMax;
+    uint64_t handshakeBytes;
+#endif
 } sample_platform_data_t;
 
-// This function creates a self-connected UDP socket which only purpose
-// is to interrupt the select
-static int prv_createSysSocket()
+#if defined(PRV_NET_STATS)
+// Reads the IPv4 packets and the bytes of all the interfaces.
+static void prv_getNetCounters(net_counters_t *countersP)
 {
-    int sysSock;
-    struct sockaddr_in sysAddr;
+    struct net_stats_ip ip;
+    struct net_stats_bytes bytes;
 
-    sysSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (sysSock  < 0)
+    memset(countersP, 0, sizeof(net_counters_t));
+
+    if (net_mgmt(NET_REQUEST_STATS_GET_IPV4, NULL, &ip, sizeof(ip)) == 0)
+    {
+        countersP->sentPackets = ip.sent;
+        countersP->receivedPackets = ip.recv;
+    }
+    if (net_mgmt(NET_REQUEST_STATS_GET_BYTES, NULL, &bytes, sizeof(bytes)) == 0)
     {
-       printk("prv_createSysSocket: Failed to create TCP/UDP socket: %d\n", errno);
-       return -1;
+        countersP->bytes = (uint64_t)bytes.sent + bytes.received;
     }
+}
+#endif
+
+// This function creates the loopback UDP socket whose only purpose is to
+// interrupt the poll(), and a socket connected to it. The first free port
+// from PRV_WAKEUP_PORT is used, each platform data having its own.
+static int prv_createWakeupSockets(sample_platform_data_t *dataP)
+{
+    struct sockaddr_in sysAddr;
+    uint16_t port;
 
-    memset((char *)& sysAddr, 0, sizeof(sysAddr));
+    dataP->wakeupSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (dataP->wakeupSock < 0)
+    {
+        printk("Failed to create the wakeup socket: %d\n", errno);
+        return -1;
+    }
 
+    memset(&sysAddr, 0, sizeof(sysAddr));
     sysAddr.sin_family = AF_INET;
-    sysAddr.sin_port = htons(60000);
-    sysAddr.sin_addr.s_addr =  htonl((127 << 24) | (0 << 16) | (0 << 8) | 1);
-    
-    //bind socket to port
-    if (bind(sysSock, (struct sockaddr *) &sysAddr, sizeof(sysAddr)) == -1)
+    sysAddr.sin_addr.s_addr = htonl((127 << 24) | (0 << 16) | (0 << 8) | 1);
+
+    for (port = PRV_WAKEUP_PORT; port != 0; port++)
     {
-        printk("Bind error\n");
-        goto error;
+        sysAddr.sin_port = htons(port);
+        if (bind(dataP->wakeupSock, (struct sockaddr *)&sysAddr, sizeof(sysAddr)) == 0)
+        {
+            break;
+        }
+        if (errno != EADDRINUSE)
+        {
+            port = 0;
+            break;
+        }
+    }
+    if (port == 0)
+    {
+        printk("Failed to bind the wakeup socket: %d\n", errno);
+        return -1;
     }
 
-    return sysSock;
+    dataP->wakeupSender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (dataP->wakeupSender < 0
+        || connect(dataP->wakeupSender, (struct sockaddr *)&sysAddr, sizeof(sysAddr)) == -1)
+    {
+        printk("Failed to connect the wakeup socket: %d\n", errno);
+        return -1;
+    }
 
-error:
-    close(sysSock);
+    return 0;
+}
+
+#if defined(CONFIG_IOWA_SEND_QUEUE) || defined(CONFIG_IOWA_RECV_BATCH)
+// Marks a free entry of the bitmap as used. Returns its index, or -1 if
+// all are used.
+static int prv_takeSlot(atomic_t *usedArray,
+                        size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!atomic_test_and_set_bit(usedArray, i))
+        {
+            return (int)i;
+        }
+    }
 
     return -1;
 }
+#endif
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+// Returns a free buffer of prv_queueBuffers, or NULL.
+static uint8_t * prv_takeQueueBuffer(void)
+{
+    int index;
+
+    index = prv_takeSlot(prv_queueBufferUsed, PRV_QUEUE_BUFFER_COUNT);
+    if (index < 0)
+    {
+        return NULL;
+    }
+
+    return prv_queueBuffers[index];
+}
+
+static void prv_releaseQueueBuffer(uint8_t *data)
+{
+    atomic_clear_bit(prv_queueBufferUsed, (data - prv_queueBuffers[0]) / IOWA_BUFFER_SIZE);
+}
+#endif
 
 void free_platform_data(void *userData)
 {
     sample_platform_data_t *dataP;
 
     dataP = (sample_platform_data_t *)userData;
+    if (dataP == NULL)
+    {
+        return;
+    }
 
-    if (dataP->sysSocket != -1)
+    if (dataP->wakeupSock != -1)
+    {
+        close(dataP->wakeupSock);
+    }
+    if (dataP->wakeupSender != -1)
+    {
+        close(dataP->wakeupSender);
+    }
+#if defined(CONFIG_IOWA_TCP)
+    if (dataP->parkedSock != -1)
+    {
+        close(dataP->parkedSock);
+    }
+#endif
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+    while (dataP->queueCount > 0)
     {
-        close(dataP->sysSocket);
+        dataP->queueCount--;
+        prv_releaseQueueBuffer(dataP->queue[dataP->queueCount].data);
     }
-    k_free(dataP);
+#endif
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    if (dataP->rxBuffer != NULL)
+    {
+        atomic_clear_bit(prv_rxBufferUsed, (dataP->rxBuffer - prv_rxBuffers[0]) / PRV_RX_BUFFER_SIZE);
+    }
+#endif
+    k_free(userData);
 }
 
 // This function initializes data used in the system abstraction functions.
 // The allocated stucture will be past as userData to the other functions in this file.
-void * get_platform_data()
+void * get_platform_data(void)
 {
     sample_platform_data_t *dataP;
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    int rxIndex;
+#endif
     dataP = (sample_platform_data_t *)k_malloc(sizeof(sample_platform_data_t));
     if (dataP == NULL)
     {
         return NULL;
     }
+    memset(dataP, 0, sizeof(sample_platform_data_t));
+    dataP->wakeupSock = -1;
+    dataP->wakeupSender = -1;
+#if defined(CONFIG_IOWA_TCP)
+    dataP->parkedSock = -1;
+#endif
 
     if (k_mutex_init(&(dataP->mutex)) != 0)
     {
         goto error;
     }
 
-    dataP->sysSocket = prv_createSysSocket();
-    if (dataP->sysSocket == -1)
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    rxIndex = prv_takeSlot(prv_rxBufferUsed, PRV_PLATFORM_COUNT);
+    if (rxIndex < 0)
+    {
+        printk("No receive buffer left\n");
+        goto error;
+    }
+    dataP->rxBuffer = prv_rxBuffers[rxIndex];
+#endif
+
+    // The wakeup sockets live as long as the platform data: interrupting the
+    // select() costs one send(), and the wait stays a single poll() on the
+    // modem side.
+    if (prv_createWakeupSockets(dataP) != 0)
     {
         goto error;
     }
+    atomic_clear(&(dataP->wakeupPending));
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+    dataP->wakeupMin = UINT32_MAX;
+#endif
+#if defined(CONFIG_IOWA_TRAFFIC_STATS) && defined(PRV_NET_STATS)
+    prv_getNetCounters(&(dataP->netBaseline));
+#endif
+#if defined(CONFIG_IOWA_DTLS_STATS)
+    dataP->handshakeSock = -1;
+    dataP->handshakeMin = INT64_MAX;
+#endif
 
     return (void *)dataP;
 
@@ -114,38 +510,298 @@ error:
     return NULL;
 }
 
-// We bind this function directly to malloc().
+#if defined(CONFIG_IOWA_SELECT_STATS)
+void platform_print_select_stats(void *userData)
+{
+    sample_platform_data_t *dataP;
+    size_t i;
+
+    dataP = (sample_platform_data_t *)userData;
+
+    if (dataP->selectCount != 0)
+    {
+        printk("Select: %u calls (%u per hour), up to %u connections, overhead avg %u us\n",
+               dataP->selectCount,
+               (uint32_t)((uint64_t)dataP->selectCount * MSEC_PER_SEC * 3600 / MAX(platform_gettime_ms(), 1)),
+               (unsigned int)dataP->selectMaxConn,
+               k_cyc_to_us_floor32((uint32_t)(dataP->selectOverhead / dataP->selectCount)));
+    }
+
+    for (i = 0; i < ARRAY_SIZE(dataP->connSelectCount); i++)
+    {
+        if (dataP->connSelectCount[i] != 0)
+        {
+            printk("Select with %u connections: %u calls, overhead avg %u us\n",
+                   (unsigned int)i,
+                   dataP->connSelectCount[i],
+                   k_cyc_to_us_floor32((uint32_t)(dataP->connSelectOverhead[i] / dataP->connSelectCount[i])));
+        }
+    }
+
+    if (dataP->stepCount != 0)
+    {
+        printk("Processing between selects: avg %u us, max %u us\n",
+               k_cyc_to_us_floor32((uint32_t)(dataP->stepTotal / dataP->stepCount)),
+               k_cyc_to_us_floor32(dataP->stepMax));
+    }
+
+    printk("Timeout lateness: <1 ms: %u, <10 ms: %u, <100 ms: %u, <1 s: %u, more: %u\n",
+           dataP->latenessHisto[0],
+           dataP->latenessHisto[1],
+           dataP->latenessHisto[2],
+           dataP->latenessHisto[3],
+           dataP->latenessHisto[4]);
+
+    if (dataP->wakeupCount == 0)
+    {
+        printk("Wakeup: no interruption\n");
+        return;
+    }
+
+    printk("Wakeup: %u interruptions, latency min %u us, max %u us, avg %u us\n",
+           dataP->wakeupCount,
+           k_cyc_to_us_floor32(dataP->wakeupMin),
+           k_cyc_to_us_floor32(dataP->wakeupMax),
+           k_cyc_to_us_floor32((uint32_t)(dataP->wakeupTotal / dataP->wakeupCount)));
+}
+#endif
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+uint64_t platform_get_wait_cycles(void *userData)
+{
+    return ((sample_platform_data_t *)userData)->selectWaitTotal;
+}
+#endif
+
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+void platform_get_traffic(void *userData,
+                          platform_traffic_t *trafficP)
+{
+    *trafficP = ((sample_platform_data_t *)userData)->traffic;
+}
+
+void platform_print_traffic_stats(void *userData)
+{
+    sample_platform_data_t *dataP;
+
+    dataP = (sample_platform_data_t *)userData;
+
+    printk("Traffic: sent %u datagrams (%u bytes), received %u datagrams (%u bytes)\n",
+           dataP->traffic.txDatagrams,
+           dataP->traffic.txBytes,
+           dataP->traffic.rxDatagrams,
+           dataP->traffic.rxBytes);
+
+#if defined(CONFIG_IOWA_TCP)
+    if (dataP->tcpConnectCount != 0)
+    {
+        printk("TCP: %u connections, %u failed, connect avg %u ms, %u reused\n",
+               dataP->tcpConnectCount,
+               dataP->tcpConnectFailures,
+               (uint32_t)(dataP->tcpConnectTotal / dataP->tcpConnectCount),
+               dataP->tcpReuseCount);
+    }
+#endif
+
+    if (dataP->traffic.cycles == 0)
+    {
+        return;
+    }
+
+    printk("Per wake cycle (%u cycles): sent %u datagrams (%u bytes), received %u datagrams (%u bytes)\n",
+           dataP->traffic.cycles,
+           dataP->traffic.txDatagrams / dataP->traffic.cycles,
+           dataP->traffic.txBytes / dataP->traffic.cycles,
+           dataP->traffic.rxDatagrams / dataP->traffic.cycles,
+           dataP->traffic.rxBytes / dataP->traffic.cycles);
+
+    printk("Radio: %u wakeups, estimated active %u ms (%u ms per cycle)\n",
+           dataP->radioWakeups,
+           (uint32_t)(dataP->radioTotal + dataP->radioEnd - dataP->radioStart),
+           (uint32_t)((dataP->radioTotal + dataP->radioEnd - dataP->radioStart) / dataP->traffic.cycles));
+
+#if defined(PRV_NET_STATS)
+    {
+        net_counters_t counters;
+
+        // Every received packet ends a round trip
+        prv_getNetCounters(&counters);
+        printk("Per wake cycle on the network: %u packets sent, %u received, %u bytes\n",
+               (counters.sentPackets - dataP->netBaseline.sentPackets) / dataP->traffic.cycles,
+               (counters.receivedPackets - dataP->netBaseline.receivedPackets) / dataP->traffic.cycles,
+               (uint32_t)((counters.bytes - dataP->netBaseline.bytes) / dataP->traffic.cycles));
+    }
+#endif
+}
+
+// Called for each datagram. A datagram sent after a silence starts a new
+// wake cycle.
+static void prv_markTraffic(sample_platform_data_t *dataP,
+                            bool sending)
+{
+    int64_t now;
+
+    now = platform_gettime_ms();
+    if (sending
+        && (dataP->traffic.cycles == 0 || now - dataP->lastTraffic >= CONFIG_IOWA_TRAFFIC_CYCLE_GAP))
+    {
+        dataP->traffic.cycles++;
+    }
+    dataP->lastTraffic = now;
+
+    if (dataP->radioWakeups == 0 || now > dataP->radioEnd)
+    {
+        dataP->radioTotal += dataP->radioEnd - dataP->radioStart;
+        dataP->radioStart = now;
+        dataP->radioWakeups++;
+    }
+    dataP->radioEnd = now + CONFIG_IOWA_TRAFFIC_RADIO_TAIL;
+}
+#endif
+
+#if defined(CONFIG_IOWA_DTLS_STATS)
+void platform_print_dtls_stats(void *userData)
+{
+    sample_platform_data_t *dataP;
+
+    dataP = (sample_platform_data_t *)userData;
+
+    if (dataP->handshakeCount == 0)
+    {
+        printk("DTLS: no handshake completed, %u failed\n", dataP->handshakeFailures);
+        return;
+    }
+
+    printk("DTLS: %u handshakes, %u failed, duration min %u ms, max %u ms, avg %u ms\n",
+           dataP->handshakeCount,
+           dataP->handshakeFailures,
+           (uint32_t)dataP->handshakeMin,
+           (uint32_t)dataP->handshakeMax,
+           (uint32_t)(dataP->handshakeTotal / dataP->handshakeCount));
+#if defined(CONFIG_NET_STATISTICS_USER_API)
+    printk("DTLS: %u bytes exchanged during the handshakes, avg %u bytes\n",
+           (uint32_t)dataP->handshakeBytes,
+           (uint32_t)(dataP->handshakeBytes / dataP->handshakeCount));
+#endif
+}
+#endif
+
+#if defined(CONFIG_IOWA_LOCK_STATS)
+void platform_print_lock_stats(void *userData)
+{
+    sample_platform_data_t *dataP;
+
+    dataP = (sample_platform_data_t *)userData;
+
+    printk("Lock: taken %u times, %u contended\n",
+           dataP->lockCount,
+           dataP->lockContention);
+}
+#endif
+
+#if defined(CONFIG_IOWA_MEMORY_POOL)
+// We use the allocator dedicated to IOWA.
+#define PRV_MALLOC client_memory_alloc
+#define PRV_FREE client_memory_free
+#else
+// We bind these functions directly to malloc() and free().
+#define PRV_MALLOC k_malloc
+#define PRV_FREE k_free
+#endif
+
 void * iowa_system_malloc(size_t size)
 {
-    return k_malloc(size);
+    void *pointer;
+    CLIENT_PROBE_START(start);
+
+    pointer = PRV_MALLOC(size);
+
+    CLIENT_PROBE_END(CLIENT_PROBE_MALLOC, start, pointer != NULL ? (int)size : -ENOMEM);
+
+    return pointer;
 }
 
-// We bind this function directly to free().
 void iowa_system_free(void *pointer)
 {
-    k_free(pointer);
+    CLIENT_PROBE_START(start);
+
+    PRV_FREE(pointer);
+
+    CLIENT_PROBE_END(CLIENT_PROBE_FREE, start, 0);
+}
+
+// We return the number of milliseconds since boot.
+int64_t platform_gettime_ms(void)
+{
+    return k_uptime_get();
 }
 
-// We return the number of seconds since Epoch.
+// We return the number of seconds since boot, on the same base as
+// platform_gettime_ms().
 int32_t iowa_system_gettime(void)
 {
-    return (int32_t) (k_uptime_get() / 1000);
+    int32_t now;
+    CLIENT_PROBE_START(start);
+
+    now = (int32_t)(platform_gettime_ms() / MSEC_PER_SEC);
+
+    CLIENT_PROBE_END(CLIENT_PROBE_GETTIME, start, 0);
+
+    return now;
 }
 
-// We fake a reboot by exiting the application.
+// The device is rebooted when it can be, the host targets fake it by
+// exiting the application. With CONFIG_IOWA_WARM_START, the context saved
+// at the registration lets the next start resume it.
 void iowa_system_reboot(void *userData)
 {
     (void)userData;
 
+#if defined(CONFIG_REBOOT) && !defined(CONFIG_ARCH_POSIX)
+    printk("\n\tRebooting.\n\n");
+    sys_reboot(SYS_REBOOT_WARM);
+#else
     fprintf(stdout, "\n\tFaking a reboot.\r\n\n");
     exit(0);
+#endif
+}
+
+#if defined(CONFIG_IOWA_WARM_START)
+// The context is kept with the settings subsystem by client_context.c.
+size_t iowa_system_store_context(void *userData,
+                                 uint8_t *bufferP,
+                                 size_t length)
+{
+    (void)userData;
+
+    return client_context_store(bufferP, length);
+}
+
+size_t iowa_system_retrieve_context(void *userData,
+                                    uint8_t **bufferP)
+{
+    (void)userData;
+
+    return client_context_retrieve(bufferP);
 }
+#endif
 
-// Traces are output on stderr.
+// Traces are handed to the deferred logging, or output on stdout.
 void iowa_system_trace(const char *format,
                        va_list varArgs)
 {
-    vprintf(format, varArgs);    
+    int length;
+    CLIENT_PROBE_START(start);
+
+#if defined(CONFIG_IOWA_LOG_DEFERRED)
+    client_log_trace(format, varArgs);
+    length = 0;
+#else
+    length = vprintf(format, varArgs);
+#endif
+
+    CLIENT_PROBE_END(CLIENT_PROBE_TRACE, start, length);
+    (void)length;
 }
 
 // For POSIX platforms, we use BSD sockets.
@@ -162,6 +818,14 @@ static void * prv_sockToPointer(int sock)
     return pointer;
 }
 
+#if defined(CONFIG_IOWA_PROBES)
+// Returns the error code recorded by the probes for a failed socket call.
+static int prv_errorCode(void)
+{
+    return errno != 0 ? -errno : -EIO;
+}
+#endif
+
 static int prv_pointerToSock(void *pointer)
 {
     int sock;
@@ -171,22 +835,745 @@ static int prv_pointerToSock(void *pointer)
     return sock - 1;
 }
 
-#if defined(CONFIG_MBEDTLS)
-/**@brief Add socket credentials according to security tag */
-static int socket_sectag_set(int fd, int sec_tag)
+// Returns the index of the socket in the poll array, or -1.
+static int prv_findPollFd(sample_platform_data_t *dataP,
+                          int sock)
 {
-    int err;
-    int verify;
-    sec_tag_t sec_tag_list[] = {sec_tag};
+    size_t i;
 
-    enum
+    for (i = 0; i < dataP->pollCount; i++)
     {
-        NONE = 0,
-        OPTIONAL = 1,
-        REQUIRED = 2,
-    };
-
-    verify = NONE;
+        if (dataP->pollArray[i].fd == sock)
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static void prv_addPollFd(sample_platform_data_t *dataP,
+                          int sock,
+                          const connection_info_t *infoP)
+{
+    dataP->pollArray[dataP->pollCount].fd = sock;
+    dataP->pollArray[dataP->pollCount].events = POLLIN;
+    dataP->pollArray[dataP->pollCount].revents = 0;
+    dataP->infoArray[dataP->pollCount] = *infoP;
+    dataP->pollCount++;
+}
+
+#if defined(CONFIG_IOWA_TCP)
+// Returns the type of an opened connection.
+static iowa_connection_type_t prv_getType(sample_platform_data_t *dataP,
+                                          int sock)
+{
+    int index;
+
+    index = prv_findPollFd(dataP, sock);
+
+    return index != -1 ? dataP->infoArray[index].type : IOWA_CONN_DATAGRAM;
+}
+#endif
+
+// Removes the socket from the poll array and copies its information in infoP.
+static void prv_removePollFd(sample_platform_data_t *dataP,
+                             int sock,
+                             connection_info_t *infoP)
+{
+    int index;
+
+    index = prv_findPollFd(dataP, sock);
+    if (index != -1)
+    {
+        *infoP = dataP->infoArray[index];
+
+        // The order does not matter: move the last entry in place
+        dataP->pollCount--;
+        dataP->pollArray[index] = dataP->pollArray[dataP->pollCount];
+        dataP->infoArray[index] = dataP->infoArray[dataP->pollCount];
+    }
+}
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+// Sets the socket in non-blocking mode.
+static void prv_setNonBlocking(int sock)
+{
+    int flags;
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1
+        || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        printk("Failed to set the socket in non-blocking mode, errno %d\n", errno);
+    }
+}
+
+// Watches or stops watching the socket for POLLOUT.
+static void prv_setPollOut(sample_platform_data_t *dataP,
+                           int sock,
+                           bool enable)
+{
+    int index;
+
+    index = prv_findPollFd(dataP, sock);
+    if (index == -1)
+    {
+        return;
+    }
+
+    if (enable)
+    {
+        dataP->pollArray[index].events |= POLLOUT;
+    }
+    else
+    {
+        dataP->pollArray[index].events &= ~POLLOUT;
+    }
+}
+
+// Returns true if the CoAP message is a non-confirmable notification, that is
+// a NON response carrying an Observe option. Its token is returned in
+// tokenP and tokenLenP.
+static bool prv_isNonNotification(const uint8_t *buffer,
+                                  size_t length,
+                                  const uint8_t **tokenP,
+                                  size_t *tokenLenP)
+{
+    size_t pos;
+    uint16_t number;
+
+    // Version 1, type NON, and a 2.xx code
+    if (length < 4
+        || (buffer[0] & 0xF0) != 0x50
+        || (buffer[1] >> 5) != 2)
+    {
+        return false;
+    }
+
+    *tokenLenP = buffer[0] & 0x0F;
+    *tokenP = buffer + 4;
+    if (*tokenLenP > 8
+        || 4 + *tokenLenP > length)
+    {
+        return false;
+    }
+    pos = 4 + *tokenLenP;
+    number = 0;
+
+    // The options are sorted: stop after the Observe option (6). A truncated
+    // option is not a notification.
+    while (pos < length && buffer[pos] != 0xFF && number < 6)
+    {
+        uint16_t delta;
+        uint16_t optionLength;
+
+        delta = buffer[pos] >> 4;
+        optionLength = buffer[pos] & 0x0F;
+        pos++;
+
+        if (delta == 13)
+        {
+            if (pos >= length)
+            {
+                return false;
+            }
+            delta = buffer[pos] + 13;
+            pos++;
+        }
+        else if (delta >= 14)
+        {
+            // Observe can not be after a 269+ delta
+            return false;
+        }
+
+        if (optionLength == 13)
+        {
+            if (pos >= length)
+            {
+                return false;
+            }
+            optionLength = buffer[pos] + 13;
+            pos++;
+        }
+        else if (optionLength == 14)
+        {
+            if (pos + 1 >= length)
+            {
+                return false;
+            }
+            optionLength = ((buffer[pos] << 8) | buffer[pos + 1]) + 269;
+            pos += 2;
+        }
+        else if (optionLength == 15)
+        {
+            return false;
+        }
+
+        if (optionLength > length - pos)
+        {
+            return false;
+        }
+
+        number += delta;
+        if (number == 6)
+        {
+            return true;
+        }
+        pos += optionLength;
+    }
+
+    return false;
+}
+
+// Frees the queued datagram and closes the gap.
+static void prv_removeQueued(sample_platform_data_t *dataP,
+                             size_t index)
+{
+    prv_releaseQueueBuffer(dataP->queue[index].data);
+
+    dataP->queueCount--;
+    memmove(dataP->queue + index, dataP->queue + index + 1, (dataP->queueCount - index) * sizeof(queued_datagram_t));
+}
+
+// Returns true if a datagram is queued for the socket.
+static bool prv_hasQueued(sample_platform_data_t *dataP,
+                          int sock)
+{
+    size_t i;
+
+    for (i = 0; i < dataP->queueCount; i++)
+    {
+        if (dataP->queue[i].sock == sock)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Queues a copy of the datagram. A NON notification replaces the queued one
+// with the same token: only the latest value matters. When the queue is full,
+// the oldest NON notification is dropped to make room, or the datagram itself
+// if there is none. Returns false if the datagram was dropped.
+static bool prv_enqueue(sample_platform_data_t *dataP,
+                        int sock,
+                        const uint8_t *buffer,
+                        size_t length)
+{
+    uint8_t *data;
+    const uint8_t *token;
+    size_t tokenLen;
+    bool notification;
+    size_t i;
+
+    if (length > IOWA_BUFFER_SIZE)
+    {
+        dataP->sendDropped++;
+        return false;
+    }
+
+    notification = prv_isNonNotification(buffer, length, &token, &tokenLen);
+    if (notification)
+    {
+        for (i = 0; i < dataP->queueCount; i++)
+        {
+            const uint8_t *queuedToken;
+            size_t queuedTokenLen;
+
+            if (dataP->queue[i].sock == sock
+                && prv_isNonNotification(dataP->queue[i].data, dataP->queue[i].length, &queuedToken, &queuedTokenLen)
+                && queuedTokenLen == tokenLen
+                && memcmp(queuedToken, token, tokenLen) == 0)
+            {
+                memcpy(dataP->queue[i].data, buffer, length);
+                dataP->queue[i].length = length;
+                dataP->sendMerged++;
+                return true;
+            }
+        }
+    }
+
+    if (dataP->queueCount == CONFIG_IOWA_SEND_QUEUE_DEPTH)
+    {
+        for (i = 0; i < dataP->queueCount; i++)
+        {
+            if (prv_isNonNotification(dataP->queue[i].data, dataP->queue[i].length, &token, &tokenLen))
+            {
+                break;
+            }
+        }
+        dataP->sendDropped++;
+        if (i == dataP->queueCount)
+        {
+            return false;
+        }
+        prv_removeQueued(dataP, i);
+    }
+
+    // Never NULL: each platform data holds at most
+    // CONFIG_IOWA_SEND_QUEUE_DEPTH buffers
+    data = prv_takeQueueBuffer();
+    if (data == NULL)
+    {
+        dataP->sendDropped++;
+        return false;
+    }
+    memcpy(data, buffer, length);
+
+    dataP->queue[dataP->queueCount].sock = sock;
+    dataP->queue[dataP->queueCount].queuedAt = platform_gettime_ms();
+    dataP->queue[dataP->queueCount].length = length;
+    dataP->queue[dataP->queueCount].data = data;
+    dataP->queueCount++;
+    dataP->sendQueued++;
+    if (dataP->queueCount > dataP->queuePeak)
+    {
+        dataP->queuePeak = dataP->queueCount;
+    }
+
+    prv_setPollOut(dataP, sock, true);
+
+    return true;
+}
+
+// Calls send() and measures it. Returns its result.
+static int prv_timedSend(sample_platform_data_t *dataP,
+                         int sock,
+                         const uint8_t *buffer,
+                         size_t length)
+{
+    uint32_t start;
+    uint32_t elapsed;
+    int result;
+
+    start = k_cycle_get_32();
+    result = send(sock, buffer, length, 0);
+    elapsed = k_cycle_get_32() - start;
+
+    dataP->sendCalls++;
+    dataP->sendCycles += elapsed;
+    if (elapsed > dataP->sendCyclesMax)
+    {
+        dataP->sendCyclesMax = elapsed;
+    }
+
+    return result;
+}
+
+// Sends the queued datagrams of the socket, oldest first, until it would
+// block again.
+static void prv_flushQueue(sample_platform_data_t *dataP,
+                           int sock)
+{
+    size_t i;
+    int64_t delay;
+
+    i = 0;
+    while (i < dataP->queueCount)
+    {
+        if (dataP->queue[i].sock != sock)
+        {
+            i++;
+            continue;
+        }
+
+        if (prv_timedSend(dataP, sock, dataP->queue[i].data, dataP->queue[i].length) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            // The datagram will never go: IOWA retransmits what needs to be
+            dataP->sendDropped++;
+        }
+        else
+        {
+            delay = platform_gettime_ms() - dataP->queue[i].queuedAt;
+            dataP->queueDelayCount++;
+            dataP->queueDelayTotal += delay;
+            if (delay > dataP->queueDelayMax)
+            {
+                dataP->queueDelayMax = delay;
+            }
+        }
+        prv_removeQueued(dataP, i);
+    }
+
+    prv_setPollOut(dataP, sock, false);
+}
+
+// Drops the queued datagrams of a closed socket.
+static void prv_dropQueue(sample_platform_data_t *dataP,
+                          int sock)
+{
+    size_t i;
+
+    i = 0;
+    while (i < dataP->queueCount)
+    {
+        if (dataP->queue[i].sock == sock)
+        {
+            prv_removeQueued(dataP, i);
+            dataP->sendDropped++;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// Sends the datagram, or queues it if the socket would block. Returns the
+// length of the datagram when it is queued: for IOWA, it is sent.
+static int prv_queueSend(sample_platform_data_t *dataP,
+                         int sock,
+                         uint8_t *buffer,
+                         size_t length)
+{
+    int result;
+
+    dataP->sendCount++;
+    dataP->queueOccupancy += dataP->queueCount;
+
+    // Nothing overtakes the datagrams already queued
+    prv_flushQueue(dataP, sock);
+    if (!prv_hasQueued(dataP, sock))
+    {
+        result = prv_timedSend(dataP, sock, buffer, length);
+        if (result >= 0
+            || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            return result;
+        }
+    }
+
+    if (!prv_enqueue(dataP, sock, buffer, length))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    return (int)length;
+}
+
+// Sends the queues of the sockets reported writable by poll(). Returns the
+// number of sockets with something else to report.
+static int prv_handleWritable(sample_platform_data_t *dataP)
+{
+    size_t i;
+    int result;
+
+    result = 0;
+    for (i = 0; i < dataP->pollCount; i++)
+    {
+        if (dataP->pollArray[i].revents & POLLOUT)
+        {
+            prv_flushQueue(dataP, dataP->pollArray[i].fd);
+        }
+        if (dataP->pollArray[i].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))
+        {
+            result++;
+        }
+    }
+
+    return result;
+}
+
+void platform_print_send_stats(void *userData)
+{
+    sample_platform_data_t *dataP;
+
+    dataP = (sample_platform_data_t *)userData;
+
+    if (dataP->sendCount == 0)
+    {
+        return;
+    }
+
+    printk("Send queue: %u datagrams, %u queued, %u merged, %u dropped, %u still queued\n",
+           dataP->sendCount,
+           dataP->sendQueued,
+           dataP->sendMerged,
+           dataP->sendDropped,
+           (uint32_t)dataP->queueCount);
+    printk("Send queue occupancy: avg %u.%02u, peak %u of %u\n",
+           (uint32_t)(dataP->queueOccupancy / dataP->sendCount),
+           (uint32_t)(dataP->queueOccupancy * 100 / dataP->sendCount % 100),
+           (uint32_t)dataP->queuePeak,
+           CONFIG_IOWA_SEND_QUEUE_DEPTH);
+    printk("send(): %u calls, avg %u us, max %u us\n",
+           dataP->sendCalls,
+           k_cyc_to_us_floor32((uint32_t)(dataP->sendCycles / MAX(dataP->sendCalls, 1))),
+           k_cyc_to_us_floor32(dataP->sendCyclesMax));
+    if (dataP->queueDelayCount != 0)
+    {
+        printk("Queued datagrams: %u sent after avg %u ms, max %u ms\n",
+               dataP->queueDelayCount,
+               (uint32_t)(dataP->queueDelayTotal / dataP->queueDelayCount),
+               (uint32_t)dataP->queueDelayMax);
+    }
+}
+#endif
+
+#if defined(CONFIG_IOWA_RECV_BATCH)
+// Returns the record at offset in the receive buffer.
+static rx_record_t * prv_rxRecord(sample_platform_data_t *dataP,
+                                  size_t offset)
+{
+    return (rx_record_t *)(dataP->rxBuffer + offset);
+}
+
+// Returns the offset of the record following the one at offset.
+static size_t prv_rxNext(sample_platform_data_t *dataP,
+                         size_t offset)
+{
+    rx_record_t *recordP;
+
+    recordP = prv_rxRecord(dataP, offset);
+
+    // Keep the headers aligned
+    return offset + ROUND_UP(sizeof(rx_record_t) + MAX(recordP->length, 0), sizeof(int));
+}
+
+// Returns the offset of the first record of the socket, or rxUsed.
+static size_t prv_rxFind(sample_platform_data_t *dataP,
+                         int sock)
+{
+    size_t offset;
+
+    for (offset = dataP->rxRead; offset < dataP->rxUsed; offset = prv_rxNext(dataP, offset))
+    {
+        if (prv_rxRecord(dataP, offset)->sock == sock)
+        {
+            break;
+        }
+    }
+
+    return offset;
+}
+
+// Skips the consumed records at the head of the buffer. When the buffer is
+// empty, the burst it held is over.
+static void prv_rxCompact(sample_platform_data_t *dataP)
+{
+    while (dataP->rxRead < dataP->rxUsed
+           && prv_rxRecord(dataP, dataP->rxRead)->sock == -1)
+    {
+        dataP->rxRead = prv_rxNext(dataP, dataP->rxRead);
+    }
+
+    if (dataP->rxRead == dataP->rxUsed
+        && dataP->rxUsed != 0)
+    {
+        uint32_t elapsed;
+
+        dataP->rxRead = 0;
+        dataP->rxUsed = 0;
+
+        elapsed = k_cycle_get_32() - dataP->burstStart;
+        dataP->burstCycles += elapsed;
+        if (elapsed > dataP->burstCyclesMax)
+        {
+            dataP->burstCyclesMax = elapsed;
+        }
+    }
+}
+
+// Reads all the datagrams pending on the socket, as long as the buffer can
+// take them. Returns the number of records added.
+static uint32_t prv_rxDrain(sample_platform_data_t *dataP,
+                            int sock)
+{
+    rx_record_t *recordP;
+    uint32_t count;
+    int result;
+
+    count = 0;
+    while (dataP->rxUsed + PRV_RX_RESERVE <= CONFIG_IOWA_RECV_BATCH_SIZE)
+    {
+        result = recv(sock, dataP->rxBuffer + dataP->rxUsed + sizeof(rx_record_t), IOWA_BUFFER_SIZE, MSG_DONTWAIT);
+        if (result < 0
+            && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+
+        recordP = prv_rxRecord(dataP, dataP->rxUsed);
+        recordP->sock = sock;
+        recordP->length = result >= 0 ? result : -errno;
+        dataP->rxUsed = prv_rxNext(dataP, dataP->rxUsed);
+        count++;
+
+        if (result < 0)
+        {
+            break;
+        }
+    }
+
+    return count;
+}
+
+// Reads the readable datagram sockets reported by poll().
+static void prv_rxDrainAll(sample_platform_data_t *dataP)
+{
+    size_t i;
+    uint32_t count;
+
+    if (dataP->rxUsed == 0)
+    {
+        dataP->burstStart = k_cycle_get_32();
+    }
+
+    count = 0;
+    for (i = 0; i < dataP->pollCount; i++)
+    {
+        if ((dataP->pollArray[i].revents & (POLLIN | POLLERR)) != 0
+            && dataP->infoArray[i].type == IOWA_CONN_DATAGRAM)
+        {
+            count += prv_rxDrain(dataP, dataP->pollArray[i].fd);
+        }
+    }
+
+    if (count != 0)
+    {
+        dataP->burstCount++;
+        dataP->burstDatagrams += count;
+        dataP->burstSavedPolls += count - 1;
+        if (count > dataP->burstMax)
+        {
+            dataP->burstMax = count;
+        }
+    }
+}
+
+// Reports the connections with buffered datagrams, without polling. Returns
+// their number.
+static int prv_rxReady(sample_platform_data_t *dataP,
+                       void **connArray,
+                       size_t connCount)
+{
+    size_t i;
+    int result;
+
+    result = 0;
+    for (i = 0; i < connCount; i++)
+    {
+        if (prv_rxFind(dataP, prv_pointerToSock(connArray[i])) != dataP->rxUsed)
+        {
+            result++;
+        }
+    }
+
+    if (result != 0)
+    {
+        for (i = 0; i < connCount; i++)
+        {
+            if (prv_rxFind(dataP, prv_pointerToSock(connArray[i])) == dataP->rxUsed)
+            {
+                connArray[i] = NULL;
+            }
+        }
+    }
+
+    return result;
+}
+
+// Copies the first buffered datagram of the socket. Returns its length, or
+// -1 with errno set. *foundP is false when nothing is buffered.
+static int prv_rxPop(sample_platform_data_t *dataP,
+                     int sock,
+                     uint8_t *buffer,
+                     size_t length,
+                     bool *foundP)
+{
+    size_t offset;
+    rx_record_t *recordP;
+    int result;
+
+    offset = prv_rxFind(dataP, sock);
+    if (offset == dataP->rxUsed)
+    {
+        *foundP = false;
+        return 0;
+    }
+    *foundP = true;
+
+    recordP = prv_rxRecord(dataP, offset);
+    if (recordP->length < 0)
+    {
+        errno = -recordP->length;
+        result = -1;
+    }
+    else
+    {
+        // Like recv(), truncate the datagram to the buffer
+        result = MIN((size_t)recordP->length, length);
+        memcpy(buffer, dataP->rxBuffer + offset + sizeof(rx_record_t), result);
+    }
+
+    recordP->sock = -1;
+    prv_rxCompact(dataP);
+
+    return result;
+}
+
+// Drops the buffered datagrams of a closed socket.
+static void prv_rxDrop(sample_platform_data_t *dataP,
+                       int sock)
+{
+    size_t offset;
+
+    for (offset = dataP->rxRead; offset < dataP->rxUsed; offset = prv_rxNext(dataP, offset))
+    {
+        if (prv_rxRecord(dataP, offset)->sock == sock)
+        {
+            prv_rxRecord(dataP, offset)->sock = -1;
+        }
+    }
+    prv_rxCompact(dataP);
+}
+
+void platform_print_recv_stats(void *userData)
+{
+    sample_platform_data_t *dataP;
+
+    dataP = (sample_platform_data_t *)userData;
+
+    if (dataP->burstCount == 0)
+    {
+        return;
+    }
+
+    printk("Receive batches: %u, %u datagrams (max %u per batch), %u poll() calls saved\n",
+           dataP->burstCount,
+           dataP->burstDatagrams,
+           dataP->burstMax,
+           dataP->burstSavedPolls);
+    printk("Batch processing: avg %u us, max %u us\n",
+           k_cyc_to_us_floor32((uint32_t)(dataP->burstCycles / dataP->burstCount)),
+           k_cyc_to_us_floor32(dataP->burstCyclesMax));
+}
+#endif
+
+#if defined(CONFIG_IOWA_DTLS)
+/**@brief Add socket credentials according to security tag */
+static int socket_sectag_set(int fd,
+                             int sec_tag)
+{
+    int err;
+    int verify;
+    sec_tag_t sec_tag_list[] = {sec_tag};
+
+    enum
+    {
+        NONE = 0,
+        OPTIONAL = 1,
+        REQUIRED = 2,
+    };
+
+    verify = NONE;
 
     err = setsockopt(fd, SOL_TLS, TLS_PEER_VERIFY, &verify, sizeof(verify));
     if (err)
@@ -204,18 +1591,302 @@ static int socket_sectag_set(int fd, int sec_tag)
         return -errno;
     }
 
+    // The session only saves handshakes: the socket still works without it
+#if defined(CONFIG_IOWA_DTLS_SESSION_CACHE) && defined(TLS_SESSION_CACHE)
+    {
+        int cache;
+
+        cache = TLS_SESSION_CACHE_ENABLED;
+        err = setsockopt(fd, SOL_TLS, TLS_SESSION_CACHE, &cache, sizeof(cache));
+        if (err)
+        {
+            printk("Failed to enable the session cache, errno %d\n", errno);
+        }
+    }
+#endif
+
     return 0;
 }
 
-#endif //(CONFIG_MBEDTLS)
+#endif //(CONFIG_IOWA_DTLS)
 
+#if defined(CONFIG_IOWA_DTLS_STATS)
+#if defined(PRV_NET_STATS)
+// Returns the bytes sent and received on all the interfaces, headers
+// included.
+static uint64_t prv_getNetBytes(void)
+{
+    net_counters_t counters;
 
-// We consider only UDP connections.
-// We open an UDP socket binded to the the remote address.
-void * iowa_system_connection_open(iowa_connection_type_t type,
-                                   char *hostname,
-                                   char *port,
-                                   void *userData)
+    prv_getNetCounters(&counters);
+
+    return counters.bytes;
+}
+#else
+// The offloaded sockets do not report their traffic
+#define prv_getNetBytes() 0
+#endif
+
+// IOWA opens its connections one by one: one handshake is measured at a time.
+static void prv_startHandshake(sample_platform_data_t *dataP,
+                               int sock)
+{
+    dataP->handshakeSock = sock;
+    dataP->handshakeStart = platform_gettime_ms();
+    dataP->handshakeNetBytes = prv_getNetBytes();
+}
+
+// Ends the handshake in progress on the socket, if any.
+static void prv_endHandshake(sample_platform_data_t *dataP,
+                             int sock,
+                             bool success)
+{
+    int64_t duration;
+    uint64_t bytes;
+
+    if (sock != dataP->handshakeSock)
+    {
+        return;
+    }
+    dataP->handshakeSock = -1;
+
+    duration = platform_gettime_ms() - dataP->handshakeStart;
+    bytes = prv_getNetBytes() - dataP->handshakeNetBytes;
+
+    if (!success)
+    {
+        dataP->handshakeFailures++;
+        printk("DTLS handshake failed after %u ms\n", (uint32_t)duration);
+        return;
+    }
+
+    dataP->handshakeCount++;
+    dataP->handshakeTotal += duration;
+    dataP->handshakeBytes += bytes;
+    if (duration < dataP->handshakeMin)
+    {
+        dataP->handshakeMin = duration;
+    }
+    if (duration > dataP->handshakeMax)
+    {
+        dataP->handshakeMax = duration;
+    }
+
+    printk("DTLS handshake: %u ms, %u bytes\n", (uint32_t)duration, (uint32_t)bytes);
+}
+#endif
+
+
+#if defined(CONFIG_IOWA_TCP)
+#if defined(CONFIG_IOWA_TCP_KEEPALIVE)
+// The keepalive probes detect a connection dropped by a NAT or by the
+// server while the device sleeps. Each option is set only when the network
+// stack knows it.
+static void prv_setKeepalive(int sock)
+{
+    int value;
+
+    value = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value)))
+    {
+        printk("Failed to enable the TCP keepalive, errno %d\n", errno);
+        return;
+    }
+#if defined(TCP_KEEPIDLE)
+    value = CONFIG_IOWA_TCP_KEEPALIVE_IDLE;
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &value, sizeof(value));
+#endif
+#if defined(TCP_KEEPINTVL)
+    value = CONFIG_IOWA_TCP_KEEPALIVE_INTERVAL;
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value));
+#endif
+#if defined(TCP_KEEPCNT)
+    value = CONFIG_IOWA_TCP_KEEPALIVE_COUNT;
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &value, sizeof(value));
+#endif
+}
+#endif
+
+// Connects a stream socket, blocking the IOWA thread up to
+// CONFIG_IOWA_TCP_CONNECT_TIMEOUT: the stack sends on the connection as
+// soon as it is open. The socket is left in blocking mode.
+// Returns 0 or -1.
+static int prv_connectStream(sample_platform_data_t *dataP,
+                             int sock,
+                             struct sockaddr *addr,
+                             socklen_t addrLen)
+{
+    int flags;
+    int result;
+    int64_t start;
+
+    start = platform_gettime_ms();
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1
+        || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        // Fall back to a blocking connect()
+        flags = -1;
+    }
+
+    result = connect(sock, addr, addrLen);
+    if (result == -1 && errno == EINPROGRESS)
+    {
+        struct pollfd pollFd;
+        int error;
+        socklen_t errorLen;
+
+        pollFd.fd = sock;
+        pollFd.events = POLLOUT;
+        pollFd.revents = 0;
+
+        error = ETIMEDOUT;
+        if (poll(&pollFd, 1, CONFIG_IOWA_TCP_CONNECT_TIMEOUT) == 1)
+        {
+            errorLen = sizeof(error);
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1)
+            {
+                error = errno;
+            }
+        }
+        if (error == 0)
+        {
+            result = 0;
+        }
+        else
+        {
+            printk("TCP connection failed, error %d\n", error);
+        }
+    }
+
+    if (flags != -1)
+    {
+        (void)fcntl(sock, F_SETFL, flags);
+    }
+
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+    if (result == 0)
+    {
+        dataP->tcpConnectCount++;
+        dataP->tcpConnectTotal += platform_gettime_ms() - start;
+    }
+    else
+    {
+        dataP->tcpConnectFailures++;
+    }
+#else
+    (void)dataP;
+    (void)start;
+#endif
+
+    return result;
+}
+
+// Closes the parked stream connection, if any.
+static void prv_dropParked(sample_platform_data_t *dataP)
+{
+    if (dataP->parkedSock != -1)
+    {
+        close(dataP->parkedSock);
+        dataP->parkedSock = -1;
+    }
+}
+
+// Keeps a stream connection closed by IOWA open for CONFIG_IOWA_TCP_REUSE_TIME
+// seconds: IOWA closes its connection to the server at the end of each
+// exchange and the next one would pay for a new TCP (and TLS) handshake.
+static void prv_park(sample_platform_data_t *dataP,
+                     int sock,
+                     const connection_info_t *infoP)
+{
+    prv_dropParked(dataP);
+
+    dataP->parkedSock = sock;
+    dataP->parkedUntil = platform_gettime_ms() + CONFIG_IOWA_TCP_REUSE_TIME * 1000;
+    dataP->parkedInfo = *infoP;
+}
+
+// Returns the parked stream connection to the host and port if it is still
+// alive, or -1.
+static int prv_unpark(sample_platform_data_t *dataP,
+                      const char *hostname,
+                      const char *port)
+{
+    int sock;
+    uint8_t byte;
+
+    if (dataP->parkedSock == -1)
+    {
+        return -1;
+    }
+
+    if (platform_gettime_ms() >= dataP->parkedUntil
+        || strcmp(hostname, dataP->parkedInfo.hostname) != 0
+        || strcmp(port, dataP->parkedInfo.port) != 0)
+    {
+        prv_dropParked(dataP);
+        return -1;
+    }
+
+    // A live idle connection has nothing to read. Data or an end of stream
+    // means the server moved on.
+    if (recv(dataP->parkedSock, &byte, 1, MSG_PEEK | MSG_DONTWAIT) != -1
+        || (errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        prv_dropParked(dataP);
+        return -1;
+    }
+
+    sock = dataP->parkedSock;
+    dataP->parkedSock = -1;
+
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+    dataP->tcpReuseCount++;
+#endif
+
+    return sock;
+}
+#endif
+
+// Connects the socket to the address. Returns 0 or -1.
+static int prv_connect(sample_platform_data_t *dataP,
+                       int sock,
+                       iowa_connection_type_t type,
+                       struct sockaddr *addr,
+                       socklen_t addrLen)
+{
+#if defined(CONFIG_IOWA_TCP)
+    if (type == IOWA_CONN_STREAM)
+    {
+#if defined(CONFIG_IOWA_TCP_KEEPALIVE)
+        prv_setKeepalive(sock);
+#endif
+        return prv_connectStream(dataP, sock, addr, addrLen);
+    }
+#else
+    (void)dataP;
+    (void)type;
+#endif
+
+    return connect(sock, addr, addrLen);
+}
+
+#if defined(CONFIG_IOWA_DNS_CACHE)
+// The server address is resolved once per CONFIG_IOWA_DNS_CACHE_TTL.
+#define PRV_GETADDRINFO client_dns_getaddrinfo
+#define PRV_FREEADDRINFO client_dns_freeaddrinfo
+#else
+#define PRV_GETADDRINFO getaddrinfo
+#define PRV_FREEADDRINFO freeaddrinfo
+#endif
+
+// We consider UDP connections, and TCP ones with CONFIG_IOWA_TCP.
+// We open a socket connected to the the remote address.
+static void * prv_open(sample_platform_data_t *dataP,
+                       iowa_connection_type_t type,
+                       char *hostname,
+                       char *port)
 {
 #ifdef _WIN32
     struct WSAData wd;
@@ -224,23 +1895,59 @@ void * iowa_system_connection_open(iowa_connection_type_t type,
     struct addrinfo *servinfo = NULL;
     struct addrinfo *p;
     int s;
-#if defined(CONFIG_MBEDTLS)
+    connection_info_t info;
+#if defined(CONFIG_IOWA_DTLS)
     int err;
 #endif
 
-    (void)userData;
+    switch (type)
+    {
+    case IOWA_CONN_DATAGRAM:
+        break;
+
+#if defined(CONFIG_IOWA_TCP)
+    case IOWA_CONN_STREAM:
+        if (strlen(hostname) >= PRV_HOSTNAME_SIZE
+            || strlen(port) >= PRV_PORT_SIZE)
+        {
+            printk("Server address too long\n");
+            return NULL;
+        }
+        break;
+#endif
+
+    default:
+        return NULL;
+    }
 
-    // let's consider only UDP connection in this sample
-    if (type != IOWA_CONN_DATAGRAM)
+    if (dataP->pollCount == CONFIG_IOWA_MAX_CONNECTIONS)
     {
+        printk("Too many connections opened\n");
         return NULL;
     }
 
+    memset(&info, 0, sizeof(info));
+    info.type = type;
+#if defined(CONFIG_IOWA_TCP)
+    if (type == IOWA_CONN_STREAM)
+    {
+        strcpy(info.hostname, hostname);
+        strcpy(info.port, port);
+
+        s = prv_unpark(dataP, hostname, port);
+        if (s != -1)
+        {
+            prv_addPollFd(dataP, s, &info);
+            return prv_sockToPointer(s);
+        }
+    }
+#endif
+
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_socktype = type == IOWA_CONN_STREAM ? SOCK_STREAM : SOCK_DGRAM;
 
-    if (0 != getaddrinfo(hostname, port, &hints, &servinfo)
+    if (0 != PRV_GETADDRINFO(hostname, port, &hints, &servinfo)
         || servinfo == NULL)
     {
         return NULL;
@@ -250,15 +1957,15 @@ void * iowa_system_connection_open(iowa_connection_type_t type,
     s = -1;
     for (p = servinfo; p != NULL && s == -1; p = p->ai_next)
     {
-#if defined(CONFIG_MBEDTLS)
-      p->ai_protocol = IPPROTO_DTLS_1_2;
+#if defined(CONFIG_IOWA_DTLS)
+      p->ai_protocol = type == IOWA_CONN_STREAM ? IPPROTO_TLS_1_2 : IPPROTO_DTLS_1_2;
 #else
-      p->ai_protocol = IPPROTO_UDP;
+      p->ai_protocol = type == IOWA_CONN_STREAM ? IPPROTO_TCP : IPPROTO_UDP;
 #endif
         s = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
         if (s >= 0)
         {
-#if defined(CONFIG_MBEDTLS)
+#if defined(CONFIG_IOWA_DTLS)
           err = socket_sectag_set(s, CONFIG_IOWA_BOARD_TLS_TAG);
           if (err)
           {
@@ -267,17 +1974,25 @@ void * iowa_system_connection_open(iowa_connection_type_t type,
           }
           else 
 #endif
-            if (-1 == connect(s, p->ai_addr, p->ai_addrlen))
             {
-                close(s);
-                s = -1;
+#if defined(CONFIG_IOWA_DTLS_STATS)
+                prv_startHandshake(dataP, s);
+#endif
+                if (-1 == prv_connect(dataP, s, type, p->ai_addr, p->ai_addrlen))
+                {
+#if defined(CONFIG_IOWA_DTLS_STATS)
+                    prv_endHandshake(dataP, s, false);
+#endif
+                    close(s);
+                    s = -1;
+                }
             }
         }
     }
 
     if (NULL != servinfo)
     {
-        freeaddrinfo(servinfo);
+        PRV_FREEADDRINFO(servinfo);
     }
 
     if (s < 0)
@@ -286,9 +2001,58 @@ void * iowa_system_connection_open(iowa_connection_type_t type,
         return NULL;
     }
 
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+    if (type == IOWA_CONN_DATAGRAM)
+    {
+        prv_setNonBlocking(s);
+    }
+#endif
+
+    prv_addPollFd(dataP, s, &info);
+
     return prv_sockToPointer(s);
 }
 
+void * iowa_system_connection_open(iowa_connection_type_t type,
+                                   char *hostname,
+                                   char *port,
+                                   void *userData)
+{
+    void *connP;
+    CLIENT_PROBE_START(start);
+
+    connP = prv_open((sample_platform_data_t *)userData, type, hostname, port);
+
+    CLIENT_PROBE_END(CLIENT_PROBE_OPEN, start, connP != NULL ? 0 : prv_errorCode());
+
+    return connP;
+}
+
+#if defined(CONFIG_IOWA_TCP)
+// A stream socket may accept only part of the message: IOWA expects it
+// written as a whole.
+static int prv_sendAll(int sock,
+                       uint8_t *buffer,
+                       size_t length)
+{
+    size_t offset;
+    ssize_t result;
+
+    offset = 0;
+    while (offset < length)
+    {
+        result = send(sock, buffer + offset, length - offset, 0);
+        if (result < 0)
+        {
+            return -1;
+        }
+        offset += result;
+    }
+
+    return (int)offset;
+}
+#endif
+
 // Since the socket is binded, we can use send() directly.
 int iowa_system_connection_send(void *connP,
                                 uint8_t *buffer,
@@ -297,12 +2061,54 @@ int iowa_system_connection_send(void *connP,
 {
     int nbSent;
     int sock;
+#if defined(CONFIG_IOWA_TRAFFIC_STATS) || defined(CONFIG_IOWA_DTLS_STATS) || defined(CONFIG_IOWA_TCP) || defined(CONFIG_IOWA_SEND_QUEUE)
+    sample_platform_data_t *dataP;
+#endif
+    CLIENT_PROBE_START(start);
 
+#if defined(CONFIG_IOWA_TRAFFIC_STATS) || defined(CONFIG_IOWA_DTLS_STATS) || defined(CONFIG_IOWA_TCP) || defined(CONFIG_IOWA_SEND_QUEUE)
+    dataP = (sample_platform_data_t *)userData;
+#else
     (void)userData;
+#endif
 
     sock = prv_pointerToSock(connP);
 
-    nbSent = send(sock, buffer, length, 0);
+#if defined(CONFIG_IOWA_TCP)
+    if (prv_getType(dataP, sock) == IOWA_CONN_STREAM)
+    {
+        nbSent = prv_sendAll(sock, buffer, length);
+    }
+    else
+#endif
+    {
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+        nbSent = prv_queueSend(dataP, sock, buffer, length);
+#else
+        nbSent = send(sock, buffer, length, 0);
+#endif
+    }
+
+    CLIENT_PROBE_END(CLIENT_PROBE_SEND, start, nbSent >= 0 ? nbSent : prv_errorCode());
+
+#if defined(CONFIG_IOWA_DTLS_STATS)
+    prv_endHandshake(dataP, sock, nbSent >= 0);
+#endif
+
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+    if (nbSent > 0)
+    {
+        prv_markTraffic(dataP, true);
+        dataP->traffic.txDatagrams++;
+        dataP->traffic.txBytes += nbSent;
+    }
+#endif
+#if defined(CONFIG_IOWA_LTE_SIM)
+    if (nbSent > 0)
+    {
+        client_lte_sim_traffic();
+    }
+#endif
 
     return nbSent;
 }
@@ -315,73 +2121,288 @@ int iowa_system_connection_recv(void *connP,
 {
     int numBytes;
     int sock;
+#if defined(CONFIG_IOWA_TRAFFIC_STATS) || defined(CONFIG_IOWA_TCP) || defined(CONFIG_IOWA_RECV_BATCH)
+    sample_platform_data_t *dataP;
+#endif
+    CLIENT_PROBE_START(start);
 
+#if defined(CONFIG_IOWA_TRAFFIC_STATS) || defined(CONFIG_IOWA_TCP) || defined(CONFIG_IOWA_RECV_BATCH)
+    dataP = (sample_platform_data_t *)userData;
+#else
     (void)userData;
+#endif
 
     sock = prv_pointerToSock(connP);
 
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    {
+        bool found;
+
+        numBytes = prv_rxPop(dataP, sock, buffer, length, &found);
+        if (!found)
+        {
+            numBytes = recv(sock, buffer, length, 0);
+        }
+    }
+#else
     numBytes = recv(sock, buffer, length, 0);
+#endif
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+    // The socket is non-blocking: a readable event consumed by the security
+    // layer, like a DTLS record without data, leaves nothing to read
+    if (numBytes == -1
+        && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        numBytes = 0;
+    }
+#endif
+
+#if defined(CONFIG_IOWA_TCP)
+    // The end of a stream is not an empty datagram: the server closed the
+    // connection
+    if (numBytes == 0
+        && length != 0
+        && prv_getType(dataP, sock) == IOWA_CONN_STREAM)
+    {
+        numBytes = -1;
+    }
+#endif
+
+    CLIENT_PROBE_END(CLIENT_PROBE_RECV, start, numBytes >= 0 ? numBytes : prv_errorCode());
+
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+    if (numBytes > 0)
+    {
+        prv_markTraffic(dataP, false);
+        dataP->traffic.rxDatagrams++;
+        dataP->traffic.rxBytes += numBytes;
+    }
+#endif
+#if defined(CONFIG_IOWA_LTE_SIM)
+    if (numBytes > 0)
+    {
+        client_lte_sim_traffic();
+    }
+#endif
 
     return numBytes;
 }
 
-// In this function, we use select on the sockets provided by IOWA
-// and on the sample_platform_data_t::pipeArray to be able to
-// interrupt the select() if required.
-int iowa_system_connection_select(void **connArray,
-                                  size_t connCount,
-                                  int32_t timeout,
-                                  void *userData)
+// Reads what was written to the wakeup socket.
+static void prv_readWakeupSock(sample_platform_data_t *dataP)
 {
-    struct timeval tv;
-    fd_set readfds;
-    size_t i;
-    int result;
-    sample_platform_data_t *dataP;
-    int maxFd;
-    int fd;
+    uint8_t buffer[1];
 
-    dataP = (sample_platform_data_t *)userData;
+    while (recv(dataP->wakeupSock, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+    {
+        // The bytes of interruptions racing this one are read too
+    }
+}
 
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
+// Consumes a pending interruption of the select().
+// Returns true if there was one.
+static bool prv_consumeWakeup(sample_platform_data_t *dataP)
+{
+    if (atomic_clear(&(dataP->wakeupPending)) == 0)
+    {
+        return false;
+    }
+    prv_readWakeupSock(dataP);
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+    {
+        uint32_t elapsed;
+
+        elapsed = k_cycle_get_32() - dataP->wakeupStamp;
+        dataP->wakeupCount++;
+        dataP->wakeupTotal += elapsed;
+        if (elapsed < dataP->wakeupMin)
+        {
+            dataP->wakeupMin = elapsed;
+        }
+        if (elapsed > dataP->wakeupMax)
+        {
+            dataP->wakeupMax = elapsed;
+        }
+    }
+#endif
 
-    FD_ZERO(&readfds);
+    return true;
+}
 
-    // we add an dummy socket to be able to interrupt the select()
-    FD_SET(dataP->sysSocket, &readfds);
-    maxFd = dataP->sysSocket;
+// Restricts the poll array to the connections IOWA asked for, and to the
+// sockets with datagrams to send. The other entries get a negative
+// descriptor, ignored by poll(), until prv_unmaskPollFds().
+static void prv_maskPollFds(sample_platform_data_t *dataP,
+                            void **connArray,
+                            size_t connCount)
+{
+    size_t i;
+    int index;
 
-    // Then the sockets requested by IOWA
+    for (i = 0; i < dataP->pollCount; i++)
+    {
+        dataP->pollArray[i].events &= ~POLLIN;
+        dataP->pollArray[i].revents = 0;
+    }
     for (i = 0; i < connCount; i++)
     {
-        fd = prv_pointerToSock(connArray[i]);
-        FD_SET(fd, &readfds);
-        if (fd > maxFd)
+        index = prv_findPollFd(dataP, prv_pointerToSock(connArray[i]));
+        if (index != -1)
+        {
+            dataP->pollArray[index].events |= POLLIN;
+        }
+    }
+    for (i = 0; i < dataP->pollCount; i++)
+    {
+        if (dataP->pollArray[i].events == 0)
+        {
+            dataP->pollArray[i].fd = ~dataP->pollArray[i].fd;
+        }
+    }
+}
+
+static void prv_unmaskPollFds(sample_platform_data_t *dataP)
+{
+    size_t i;
+
+    for (i = 0; i < dataP->pollCount; i++)
+    {
+        if (dataP->pollArray[i].fd < 0)
         {
-            maxFd = fd;
+            dataP->pollArray[i].fd = ~dataP->pollArray[i].fd;
         }
     }
+}
 
-    result = select(maxFd + 1, &readfds, NULL, NULL, &tv);
+// In this function, we poll() the sockets opened by iowa_system_connection_open().
+// The poll array is maintained by iowa_system_connection_open() and
+// iowa_system_connection_close() so there is nothing to rebuild here: the
+// wakeup socket is set after the last connection, and the whole timeout is
+// waited in one poll(). The connections IOWA did not pass are masked, they
+// would wake us up for nothing.
+static int prv_select(sample_platform_data_t *dataP,
+                      void **connArray,
+                      size_t connCount,
+                      int64_t timeoutMs)
+{
+    size_t i;
+    int result;
+    int index;
+    struct pollfd *wakeupFdP;
+    bool interrupted;
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+    int64_t pollStart;
+#endif
 
-    if (result > 0)
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    // The datagrams read in the previous pass come first
+    result = prv_rxReady(dataP, connArray, connCount);
+    if (result != 0)
     {
-        for (i = 0; i < connCount; i++)
+        return result;
+    }
+#endif
+
+    wakeupFdP = dataP->pollArray + dataP->pollCount;
+    wakeupFdP->fd = dataP->wakeupSock;
+    wakeupFdP->events = POLLIN;
+
+    result = 0;
+
+    do
+    {
+        if (prv_consumeWakeup(dataP))
+        {
+            break;
+        }
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+        pollStart = platform_gettime_ms();
+#endif
+        wakeupFdP->revents = 0;
+
+        prv_maskPollFds(dataP, connArray, connCount);
+#if defined(CONFIG_IOWA_SELECT_STATS)
         {
-            if (!FD_ISSET(prv_pointerToSock(connArray[i]), &readfds))
+            uint32_t start;
+
+            start = k_cycle_get_32();
+            result = poll(dataP->pollArray, dataP->pollCount + 1, (int)MIN(timeoutMs, INT32_MAX));
+            dataP->selectWait += k_cycle_get_32() - start;
+        }
+#else
+        result = poll(dataP->pollArray, dataP->pollCount + 1, (int)MIN(timeoutMs, INT32_MAX));
+#endif
+        prv_unmaskPollFds(dataP);
+
+        interrupted = false;
+        if (result > 0
+            && wakeupFdP->revents != 0)
+        {
+            // The stack is about to run anyway. A byte arriving after its
+            // interruption was consumed is read here as well.
+            if (!prv_consumeWakeup(dataP))
             {
-                connArray[i] = NULL;
+                prv_readWakeupSock(dataP);
             }
+            interrupted = true;
+            result--;
         }
-        if (FD_ISSET(dataP->sysSocket, &readfds))
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+        // A socket that became writable only wakes us up to send its queue
+        if (result > 0
+            && prv_handleWritable(dataP) == 0)
         {
-            uint8_t buffer[1];
-            struct sockaddr peerAddr;
-            socklen_t peerAddrLength;
+            result = 0;
+            timeoutMs -= platform_gettime_ms() - pollStart;
+            continue;
+        }
+#endif
+        break;
+    } while (!interrupted && timeoutMs > 0);
 
-            result--;
-            (void)recvfrom(dataP->sysSocket, buffer, 1, 0, &peerAddr, &peerAddrLength);
+    if (result > 0)
+    {
+#if defined(CONFIG_IOWA_RECV_BATCH)
+        prv_rxDrainAll(dataP);
+#endif
+
+        // IOWA watches all the connections it opened, but only report the
+        // ones it asked for.
+        result = 0;
+        for (i = 0; i < connCount; i++)
+        {
+            bool ready;
+
+            index = prv_findPollFd(dataP, prv_pointerToSock(connArray[i]));
+            if (index == -1)
+            {
+                ready = false;
+            }
+#if defined(CONFIG_IOWA_RECV_BATCH)
+            // What the datagram sockets had to say is now buffered
+            else if (dataP->infoArray[index].type == IOWA_CONN_DATAGRAM)
+            {
+                ready = prv_rxFind(dataP, dataP->pollArray[index].fd) != dataP->rxUsed
+                        || (dataP->pollArray[index].revents & (POLLHUP | POLLNVAL)) != 0;
+            }
+#endif
+            else
+            {
+                ready = (dataP->pollArray[index].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) != 0;
+            }
+
+            if (ready)
+            {
+                result++;
+            }
+            else
+            {
+                connArray[i] = NULL;
+            }
         }
     }
     else if (result < 0)
@@ -395,77 +2416,184 @@ int iowa_system_connection_select(void **connArray,
     return result;
 }
 
+// IOWA computes the timeout from iowa_system_gettime(), which truncates the
+// clock to the second. The stack deadline is then the start of the second
+// "now + timeout", not "now + timeout seconds": waiting for the whole timeout
+// would make the timers fire up to one second late.
+int iowa_system_connection_select(void **connArray,
+                                  size_t connCount,
+                                  int32_t timeout,
+                                  void *userData)
+{
+    sample_platform_data_t *dataP;
+    int result;
+    int64_t nowMs;
+    int64_t deadlineMs;
+#if defined(CONFIG_IOWA_SELECT_STATS)
+    uint32_t start;
+    uint32_t overhead;
+#endif
+    CLIENT_PROBE_START(probeStart);
+
+    dataP = (sample_platform_data_t *)userData;
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+    start = k_cycle_get_32();
+    dataP->selectWait = 0;
+
+    if (dataP->selectCount != 0)
+    {
+        uint32_t elapsed;
+
+        elapsed = start - dataP->selectReturn;
+        dataP->stepCount++;
+        dataP->stepTotal += elapsed;
+        if (elapsed > dataP->stepMax)
+        {
+            dataP->stepMax = elapsed;
+        }
+    }
+#endif
+
+    nowMs = platform_gettime_ms();
+    deadlineMs = (nowMs / MSEC_PER_SEC + timeout) * MSEC_PER_SEC;
+
+    result = prv_select(dataP, connArray, connCount, MAX(deadlineMs - nowMs, 0));
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+    nowMs = platform_gettime_ms();
+    if (result == 0 && nowMs >= deadlineMs)
+    {
+        size_t i;
+
+        for (i = 0; i < ARRAY_SIZE(prv_latenessBounds); i++)
+        {
+            if (nowMs - deadlineMs < prv_latenessBounds[i])
+            {
+                break;
+            }
+        }
+        dataP->latenessHisto[i]++;
+    }
+
+    // Remove the time spent in poll() to only keep the processing overhead
+    overhead = (k_cycle_get_32() - start) - dataP->selectWait;
+    dataP->selectCount++;
+    dataP->selectOverhead += overhead;
+    if (connCount <= CONFIG_IOWA_MAX_CONNECTIONS)
+    {
+        dataP->connSelectCount[connCount]++;
+        dataP->connSelectOverhead[connCount] += overhead;
+    }
+    dataP->selectWaitTotal += dataP->selectWait;
+    if (connCount > dataP->selectMaxConn)
+    {
+        dataP->selectMaxConn = connCount;
+    }
+    dataP->selectReturn = k_cycle_get_32();
+#endif
+
+    CLIENT_PROBE_END(CLIENT_PROBE_SELECT, probeStart, result >= 0 ? 0 : prv_errorCode());
+
+    return result;
+}
+
 void iowa_system_connection_close(void *connP,
                                   void *userData)
 {
     int sock;
+    sample_platform_data_t *dataP;
+    connection_info_t info;
+    CLIENT_PROBE_START(start);
 
-    (void)userData;
+    dataP = (sample_platform_data_t *)userData;
 
     sock = prv_pointerToSock(connP);
 
-    close(sock);
+    info.type = IOWA_CONN_DATAGRAM;
+    prv_removePollFd(dataP, sock, &info);
+#if defined(CONFIG_IOWA_DTLS_STATS)
+    // Closed before its first datagram: nothing to measure
+    if (dataP->handshakeSock == sock)
+    {
+        dataP->handshakeSock = -1;
+    }
+#endif
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+    prv_dropQueue(dataP, sock);
+#endif
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    prv_rxDrop(dataP, sock);
+#endif
+#if defined(CONFIG_IOWA_TCP)
+    if (info.type == IOWA_CONN_STREAM
+        && CONFIG_IOWA_TCP_REUSE_TIME > 0)
+    {
+        prv_park(dataP, sock, &info);
+    }
+    else
+#endif
+    {
+        close(sock);
+    }
+
+    CLIENT_PROBE_END(CLIENT_PROBE_CLOSE, start, 0);
 }
 
 // To make the call to select() in iowa_system_connection_select() stops,
-// we write data to the sysSocket if it's empty.
+// we write to the wakeup socket if no interruption is already pending.
+// This can be called from any thread and does not open any socket.
 void iowa_system_connection_interrupt_select(void *userData)
 {
     sample_platform_data_t *dataP;
     uint8_t buffer[1];
-    int len;
+    CLIENT_PROBE_START(start);
 
     dataP = (sample_platform_data_t *)userData;
 
-    if (dataP->sysSocket != -1)
+    if (atomic_set(&(dataP->wakeupPending), 1) == 0)
     {
-        int sysSock;
-        struct sockaddr_in sysAddr, realAddr;
-
-        sysSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-        if (sysSock == -1)
-        {
-            printk("-Failed to create socket: %d\n", errno);
-            return;
-        }
-
-        memset((char *)& sysAddr, 0, sizeof(sysAddr));
-
-        sysAddr.sin_family = AF_INET;
-        sysAddr.sin_port = htons(60000);
-        sysAddr.sin_addr.s_addr = htonl((127 << 24) | (0 << 16) | (0 << 8) | 1);
-
-        //bind socket to port
-        if (connect(sysSock, (struct sockaddr *) &sysAddr, sizeof(sysAddr)) == -1)
-        {
-            printk("- Failed to connect socket: %d\n", errno);
-            return;
-        }
-
+#if defined(CONFIG_IOWA_SELECT_STATS)
+        dataP->wakeupStamp = k_cycle_get_32();
+#endif
         buffer[0] = 'n';
-        send(sysSock, buffer, 1, 0);
-
-        (void)close(sysSock);
+        (void)send(dataP->wakeupSender, buffer, 1, MSG_DONTWAIT);
     }
+
+    CLIENT_PROBE_END(CLIENT_PROBE_INTERRUPT, start, 0);
 }
 
 void iowa_system_mutex_lock(void *userData)
 {
     sample_platform_data_t *dataP;
+    CLIENT_PROBE_START(start);
 
     dataP = (sample_platform_data_t *)userData;
 
-    k_mutex_lock(&(dataP->mutex), K_NO_WAIT);
+#if defined(CONFIG_IOWA_LOCK_STATS)
+    if (k_mutex_lock(&(dataP->mutex), K_NO_WAIT) != 0)
+    {
+        (void)k_mutex_lock(&(dataP->mutex), K_FOREVER);
+        dataP->lockContention++;
+    }
+    dataP->lockCount++;
+#else
+    (void)k_mutex_lock(&(dataP->mutex), K_FOREVER);
+#endif
 
+    CLIENT_PROBE_END(CLIENT_PROBE_LOCK, start, 0);
 }
 
 void iowa_system_mutex_unlock(void *userData)
 {
     sample_platform_data_t *dataP;
+    CLIENT_PROBE_START(start);
 
     dataP = (sample_platform_data_t *)userData;
 
     k_mutex_unlock(&(dataP->mutex));
+
+    CLIENT_PROBE_END(CLIENT_PROBE_UNLOCK, start, 0);
 }
 
 // This is not a proper way to generate a random vector, it only serves as an example here
@@ -474,6 +2602,7 @@ int iowa_system_random_vector_generator(uint8_t *randomBuffer,
                                         void *userData)
 {
     size_t i;
+    CLIENT_PROBE_START(start);
 
     (void)userData;
 
@@ -482,5 +2611,7 @@ int iowa_system_random_vector_generator(uint8_t *randomBuffer,
         randomBuffer[i] = rand() % 256;
     }
 
+    CLIENT_PROBE_END(CLIENT_PROBE_RANDOM, start, (int)size);
+
     return 0;
 }
@@ -0,0 +1,82 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Application side entry points of the IOWA
+ * system abstraction layer (client_platform.c).
+ *
+ **********************************************/
+
+#ifndef _CLIENT_PLATFORM_INCLUDE_
+#define _CLIENT_PLATFORM_INCLUDE_
+
+#include <stdint.h>
+
+// Allocates the data passed as userData to the iowa_system_* functions.
+void * get_platform_data(void);
+
+// Releases the data allocated by get_platform_data().
+void free_platform_data(void *userData);
+
+// Returns a monotonic time in milliseconds. iowa_system_gettime() is this
+// value in seconds.
+int64_t platform_gettime_ms(void);
+
+#if defined(CONFIG_IOWA_SELECT_STATS)
+// Returns the cycles spent waiting in poll() since get_platform_data().
+uint64_t platform_get_wait_cycles(void *userData);
+
+// Prints the processing overhead, the timeout lateness and the
+// interrupt-to-wakeup latency of iowa_system_connection_select().
+void platform_print_select_stats(void *userData);
+#endif
+
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+typedef struct
+{
+    uint32_t txDatagrams;
+    uint32_t txBytes;
+    uint32_t rxDatagrams;
+    uint32_t rxBytes;
+    // bursts of traffic separated by CONFIG_IOWA_TRAFFIC_CYCLE_GAP
+    uint32_t cycles;
+} platform_traffic_t;
+
+// Copies the traffic counters since get_platform_data().
+void platform_get_traffic(void *userData,
+                          platform_traffic_t *trafficP);
+
+// Prints the number of datagrams and bytes sent and received, and their
+// average per wake cycle.
+void platform_print_traffic_stats(void *userData);
+#endif
+
+#if defined(CONFIG_IOWA_DTLS_STATS)
+// Prints the number, the failures, the duration and, on the native network
+// stack, the bytes of the DTLS handshakes.
+void platform_print_dtls_stats(void *userData);
+#endif
+
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+// Prints the send queue occupancy, the merged and dropped datagrams, the
+// time spent in the queue and the duration of the send() calls.
+void platform_print_send_stats(void *userData);
+#endif
+
+#if defined(CONFIG_IOWA_RECV_BATCH)
+// Prints the number and size of the receive batches and the time taken by
+// the stack to process them.
+void platform_print_recv_stats(void *userData);
+#endif
+
+#if defined(CONFIG_IOWA_LOCK_STATS)
+// Prints how many times the IOWA mutex was taken and found already taken.
+void platform_print_lock_stats(void *userData);
+#endif
+
+#endif
@@ -0,0 +1,365 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the probes of the
+ * iowa_system_* functions, their shell commands
+ * and their LwM2M object.
+ *
+ **********************************************/
+
+#include "client_probe.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/byteorder.h>
+#if defined(CONFIG_IOWA_PROBES_SHELL)
+#include <shell/shell.h>
+#endif
+
+static const char * const prv_nameArray[CLIENT_PROBE_COUNT] =
+{
+    [CLIENT_PROBE_MALLOC]    = "malloc",
+    [CLIENT_PROBE_FREE]      = "free",
+    [CLIENT_PROBE_GETTIME]   = "gettime",
+    [CLIENT_PROBE_TRACE]     = "trace",
+    [CLIENT_PROBE_OPEN]      = "open",
+    [CLIENT_PROBE_SEND]      = "send",
+    [CLIENT_PROBE_RECV]      = "recv",
+    [CLIENT_PROBE_SELECT]    = "select",
+    [CLIENT_PROBE_CLOSE]     = "close",
+    [CLIENT_PROBE_INTERRUPT] = "interrupt",
+    [CLIENT_PROBE_LOCK]      = "lock",
+    [CLIENT_PROBE_UNLOCK]    = "unlock",
+    [CLIENT_PROBE_RANDOM]    = "random",
+};
+
+static struct k_spinlock prv_probeLock;
+static client_probe_t prv_probeArray[CLIENT_PROBE_COUNT];
+
+void client_probe_record(client_probe_id_t id,
+                         uint32_t start,
+                         int result)
+{
+    uint32_t elapsed;
+    uint32_t duration;
+    size_t bucket;
+    client_probe_t *probeP;
+    k_spinlock_key_t key;
+
+    elapsed = k_cycle_get_32() - start;
+
+    // Bucket n counts the durations in [2^(n-1), 2^n[ us
+    duration = k_cyc_to_us_floor32(elapsed);
+    if (duration == 0)
+    {
+        bucket = 0;
+    }
+    else
+    {
+        bucket = MIN(32 - __builtin_clz(duration), CLIENT_PROBE_HISTO_BUCKETS - 1);
+    }
+
+    probeP = prv_probeArray + id;
+
+    key = k_spin_lock(&prv_probeLock);
+    probeP->callCount++;
+    if (result < 0)
+    {
+        probeP->errorCount++;
+        probeP->lastError = result;
+    }
+    else
+    {
+        probeP->byteCount += result;
+    }
+    probeP->totalCycles += elapsed;
+    if (elapsed > probeP->maxCycles)
+    {
+        probeP->maxCycles = elapsed;
+    }
+    probeP->histo[bucket]++;
+    k_spin_unlock(&prv_probeLock, key);
+}
+
+const char * client_probe_get(client_probe_id_t id,
+                              client_probe_t *probeP)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_probeLock);
+    *probeP = prv_probeArray[id];
+    k_spin_unlock(&prv_probeLock, key);
+
+    return prv_nameArray[id];
+}
+
+void client_probe_reset(void)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&prv_probeLock);
+    memset(prv_probeArray, 0, sizeof(prv_probeArray));
+    k_spin_unlock(&prv_probeLock, key);
+}
+
+static uint32_t prv_getAverageUs(const client_probe_t *probeP)
+{
+    if (probeP->callCount == 0)
+    {
+        return 0;
+    }
+
+    return k_cyc_to_us_floor32((uint32_t)(probeP->totalCycles / probeP->callCount));
+}
+
+// Formats the counters of a probe on one line.
+static void prv_format(client_probe_id_t id,
+                       char *buffer,
+                       size_t size)
+{
+    client_probe_t probe;
+    const char *name;
+
+    name = client_probe_get(id, &probe);
+
+    snprintf(buffer, size, "%-10s %8u calls %6u errors (last %d) %10llu bytes, avg %u us, max %u us",
+             name,
+             probe.callCount,
+             probe.errorCount,
+             probe.lastError,
+             (unsigned long long)probe.byteCount,
+             prv_getAverageUs(&probe),
+             k_cyc_to_us_floor32(probe.maxCycles));
+}
+
+void client_probe_print(void)
+{
+    char line[128];
+    client_probe_id_t id;
+
+    for (id = 0; id < CLIENT_PROBE_COUNT; id++)
+    {
+        prv_format(id, line, sizeof(line));
+        printk("Probe: %s\n", line);
+    }
+}
+
+#if defined(CONFIG_IOWA_PROBES_SHELL)
+static int prv_cmdShow(const struct shell *shell,
+                       size_t argc,
+                       char **argv)
+{
+    char line[128];
+    client_probe_id_t id;
+
+    (void)argc;
+    (void)argv;
+
+    for (id = 0; id < CLIENT_PROBE_COUNT; id++)
+    {
+        prv_format(id, line, sizeof(line));
+        shell_print(shell, "%s", line);
+    }
+
+    return 0;
+}
+
+static int prv_cmdHisto(const struct shell *shell,
+                        size_t argc,
+                        char **argv)
+{
+    client_probe_t probe;
+    client_probe_id_t id;
+    const char *name;
+    size_t i;
+
+    for (id = 0; id < CLIENT_PROBE_COUNT; id++)
+    {
+        name = client_probe_get(id, &probe);
+        if (argc > 1 && strcmp(argv[1], name) != 0)
+        {
+            continue;
+        }
+
+        shell_print(shell, "%s:", name);
+        for (i = 0; i < CLIENT_PROBE_HISTO_BUCKETS; i++)
+        {
+            if (probe.histo[i] == 0)
+            {
+                continue;
+            }
+            if (i == CLIENT_PROBE_HISTO_BUCKETS - 1)
+            {
+                shell_print(shell, "  >= %7u us: %u", 1u << (i - 1), probe.histo[i]);
+            }
+            else
+            {
+                shell_print(shell, "  <  %7u us: %u", 1u << i, probe.histo[i]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int prv_cmdReset(const struct shell *shell,
+                        size_t argc,
+                        char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    client_probe_reset();
+    shell_print(shell, "Probes reset");
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_iowa_probes,
+    SHELL_CMD(show, NULL, "Show the counters of the iowa_system_* functions", prv_cmdShow),
+    SHELL_CMD_ARG(histo, NULL, "Show the duration histograms [function]", prv_cmdHisto, 1, 1),
+    SHELL_CMD(reset, NULL, "Reset the counters", prv_cmdReset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(iowa_probes, &sub_iowa_probes, "IOWA platform probes", NULL);
+#endif
+
+#if defined(CONFIG_IOWA_PROBES_OBJECT)
+// Resources of the probe object, one instance per probe
+#define PRV_RES_NAME        0
+#define PRV_RES_CALLS       1
+#define PRV_RES_ERRORS      2
+#define PRV_RES_LAST_ERROR  3
+#define PRV_RES_BYTES       4
+#define PRV_RES_AVERAGE     5
+#define PRV_RES_MAX         6
+#define PRV_RES_HISTOGRAM   7
+#define PRV_RES_RESET       8
+
+static iowa_lwm2m_resource_desc_t prv_resourceArray[] =
+{
+    { PRV_RES_NAME,       IOWA_LWM2M_TYPE_STRING,    IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_CALLS,      IOWA_LWM2M_TYPE_INTEGER,   IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_ERRORS,     IOWA_LWM2M_TYPE_INTEGER,   IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_LAST_ERROR, IOWA_LWM2M_TYPE_INTEGER,   IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_BYTES,      IOWA_LWM2M_TYPE_INTEGER,   IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_AVERAGE,    IOWA_LWM2M_TYPE_INTEGER,   IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_MAX,        IOWA_LWM2M_TYPE_INTEGER,   IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_HISTOGRAM,  IOWA_LWM2M_TYPE_OPAQUE,    IOWA_OPERATION_READ,    IOWA_RESOURCE_FLAG_MANDATORY },
+    { PRV_RES_RESET,      IOWA_LWM2M_TYPE_UNDEFINED, IOWA_OPERATION_EXECUTE, IOWA_RESOURCE_FLAG_NONE },
+};
+
+static uint16_t prv_instanceArray[CLIENT_PROBE_COUNT];
+
+// The histograms are read as arrays of little-endian 32-bit counters. They
+// must stay valid until the stack has serialized them.
+static uint8_t prv_histoBuffer[CLIENT_PROBE_COUNT][CLIENT_PROBE_HISTO_BUCKETS * sizeof(uint32_t)];
+
+static iowa_status_t prv_objectCb(iowa_dm_operation_t operation,
+                                  iowa_lwm2m_data_t *dataP,
+                                  size_t numData,
+                                  void *userData,
+                                  iowa_context_t contextP)
+{
+    size_t i;
+    size_t j;
+    client_probe_t probe;
+    const char *name;
+
+    (void)userData;
+    (void)contextP;
+
+    switch (operation)
+    {
+    case IOWA_DM_READ:
+        for (i = 0; i < numData; i++)
+        {
+            if (dataP[i].instanceID >= CLIENT_PROBE_COUNT)
+            {
+                return IOWA_COAP_404_NOT_FOUND;
+            }
+            name = client_probe_get((client_probe_id_t)dataP[i].instanceID, &probe);
+
+            switch (dataP[i].resourceID)
+            {
+            case PRV_RES_NAME:
+                dataP[i].value.asBuffer.buffer = (uint8_t *)name;
+                dataP[i].value.asBuffer.length = strlen(name);
+                break;
+            case PRV_RES_CALLS:
+                dataP[i].value.asInteger = probe.callCount;
+                break;
+            case PRV_RES_ERRORS:
+                dataP[i].value.asInteger = probe.errorCount;
+                break;
+            case PRV_RES_LAST_ERROR:
+                dataP[i].value.asInteger = probe.lastError;
+                break;
+            case PRV_RES_BYTES:
+                dataP[i].value.asInteger = (int64_t)probe.byteCount;
+                break;
+            case PRV_RES_AVERAGE:
+                dataP[i].value.asInteger = prv_getAverageUs(&probe);
+                break;
+            case PRV_RES_MAX:
+                dataP[i].value.asInteger = k_cyc_to_us_floor32(probe.maxCycles);
+                break;
+            case PRV_RES_HISTOGRAM:
+                for (j = 0; j < CLIENT_PROBE_HISTO_BUCKETS; j++)
+                {
+                    sys_put_le32(probe.histo[j], prv_histoBuffer[dataP[i].instanceID] + j * sizeof(uint32_t));
+                }
+                dataP[i].value.asBuffer.buffer = prv_histoBuffer[dataP[i].instanceID];
+                dataP[i].value.asBuffer.length = sizeof(prv_histoBuffer[0]);
+                break;
+            default:
+                return IOWA_COAP_404_NOT_FOUND;
+            }
+        }
+        break;
+
+    case IOWA_DM_EXECUTE:
+        // Resetting any instance resets all the probes
+        client_probe_reset();
+        break;
+
+    case IOWA_DM_FREE:
+        // Nothing was allocated
+        break;
+
+    default:
+        return IOWA_COAP_405_METHOD_NOT_ALLOWED;
+    }
+
+    return IOWA_COAP_NO_ERROR;
+}
+
+iowa_status_t client_probe_add_object(iowa_context_t contextP)
+{
+    uint16_t i;
+
+    for (i = 0; i < CLIENT_PROBE_COUNT; i++)
+    {
+        prv_instanceArray[i] = i;
+    }
+
+    return iowa_client_add_custom_object(contextP,
+                                         CONFIG_IOWA_PROBES_OBJECT_ID,
+                                         CLIENT_PROBE_COUNT, prv_instanceArray,
+                                         ARRAY_SIZE(prv_resourceArray), prv_resourceArray,
+                                         prv_objectCb, NULL, NULL,
+                                         NULL);
+}
+
+void client_probe_remove_object(iowa_context_t contextP)
+{
+    (void)iowa_client_remove_custom_object(contextP, CONFIG_IOWA_PROBES_OBJECT_ID);
+}
+#endif
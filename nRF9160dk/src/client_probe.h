@@ -0,0 +1,92 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Instrumentation of the iowa_system_* functions.
+ *
+ * Each function counts its calls, the bytes it
+ * handled, its errors and the distribution of its
+ * duration. The probes compile to nothing when
+ * CONFIG_IOWA_PROBES is not set.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_PROBE_INCLUDE_
+#define _CLIENT_PROBE_INCLUDE_
+
+#include "iowa_client.h"
+
+#include <zephyr.h>
+
+typedef enum
+{
+    CLIENT_PROBE_MALLOC = 0,
+    CLIENT_PROBE_FREE,
+    CLIENT_PROBE_GETTIME,
+    CLIENT_PROBE_TRACE,
+    CLIENT_PROBE_OPEN,
+    CLIENT_PROBE_SEND,
+    CLIENT_PROBE_RECV,
+    CLIENT_PROBE_SELECT,
+    CLIENT_PROBE_CLOSE,
+    CLIENT_PROBE_INTERRUPT,
+    CLIENT_PROBE_LOCK,
+    CLIENT_PROBE_UNLOCK,
+    CLIENT_PROBE_RANDOM,
+    CLIENT_PROBE_COUNT
+} client_probe_id_t;
+
+// Duration buckets: below 1 us, then below 2^n us. The last bucket
+// counts everything above.
+#define CLIENT_PROBE_HISTO_BUCKETS 20
+
+typedef struct
+{
+    uint32_t callCount;
+    uint32_t errorCount;
+    int lastError;
+    uint64_t byteCount;
+    uint64_t totalCycles;
+    uint32_t maxCycles;
+    uint32_t histo[CLIENT_PROBE_HISTO_BUCKETS];
+} client_probe_t;
+
+#if defined(CONFIG_IOWA_PROBES)
+
+#define CLIENT_PROBE_START(start) uint32_t start = k_cycle_get_32()
+
+// result is the number of bytes handled, or a negative error code.
+#define CLIENT_PROBE_END(id, start, result) client_probe_record((id), (start), (result))
+
+void client_probe_record(client_probe_id_t id,
+                         uint32_t start,
+                         int result);
+
+// Copies the counters of a probe. Returns its name.
+const char * client_probe_get(client_probe_id_t id,
+                              client_probe_t *probeP);
+
+void client_probe_reset(void);
+
+void client_probe_print(void);
+
+#if defined(CONFIG_IOWA_PROBES_OBJECT)
+// Exposes the probes as instances of the CONFIG_IOWA_PROBES_OBJECT_ID object.
+iowa_status_t client_probe_add_object(iowa_context_t contextP);
+
+void client_probe_remove_object(iowa_context_t contextP);
+#endif
+
+#else
+
+#define CLIENT_PROBE_START(start)
+#define CLIENT_PROBE_END(id, start, result)
+
+#endif
+
+#endif
@@ -0,0 +1,584 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * This file implements the store-and-forward
+ * log of the sensor samples.
+ *
+ * Each FCB entry is a record of up to
+ * CONFIG_IOWA_STORE_RAM_SAMPLES samples. The FCB
+ * writes its sectors in turn, which spreads the
+ * erases over the partition. The records are
+ * consumed in order: the cursor is the last
+ * record acknowledged by the server, and the
+ * sectors before the one of the cursor are
+ * erased. It is kept in RAM: after a reset, the
+ * records of the oldest sector already sent are
+ * sent again.
+ *
+ * When the log is full, its oldest sector is
+ * erased and its samples are lost.
+ *
+ * The samples taken before the real time was
+ * known are stamped with the uptime of their
+ * boot: sent after a reset, their times are
+ * wrong.
+ *
+ **********************************************/
+
+#include "client_store.h"
+#include "client_batch.h"
+
+#include <zephyr.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fs/fcb.h>
+#include <storage/flash_map.h>
+
+// The log has a partition of its own, "sample_log", defined by the
+// devicetree or by pm.yml.sample_log on the nRF9160 DK. Only the host targets
+// fall back on the scratch partition of their flash simulator: on a device,
+// MCUboot needs it to swap the images.
+#if FLASH_AREA_LABEL_EXISTS(sample_log)
+#define PRV_FLASH_AREA_ID FLASH_AREA_ID(sample_log)
+#elif defined(CONFIG_FLASH_SIMULATOR)
+#define PRV_FLASH_AREA_ID FLASH_AREA_ID(image_scratch)
+#else
+#error "CONFIG_IOWA_STORE needs a sample_log partition"
+#endif
+
+#define PRV_FCB_MAGIC   0x494F5741  // "IOWA"
+#define PRV_FCB_VERSION 1
+
+BUILD_ASSERT(CONFIG_IOWA_STORE_DRAIN_SAMPLES >= CONFIG_IOWA_STORE_RAM_SAMPLES,
+             "A record fits in a Send");
+
+// The records are multiples of 4 bytes, the write block size of the
+// nRF9160 flash and of the flash simulator.
+typedef struct
+{
+    uint16_t count;
+    uint16_t reserved;
+    iowa_ipso_timed_value_t valueArray[CONFIG_IOWA_STORE_RAM_SAMPLES];
+} store_record_t;
+
+#define PRV_RECORD_HEADER_SIZE offsetof(store_record_t, valueArray)
+
+static K_MUTEX_DEFINE(prv_storeMutex);
+static bool prv_ready;
+static bool prv_online;
+
+static struct fcb prv_fcb;
+static struct flash_sector prv_sectorArray[CONFIG_IOWA_STORE_SECTORS];
+// Last record consumed, fe_sector is NULL when none
+static struct fcb_entry prv_cursor;
+// Samples in the flash, not consumed
+static uint32_t prv_flashCount;
+
+// The RAM front record
+static store_record_t prv_front;
+
+// Send in progress
+static iowa_ipso_timed_value_t prv_sendArray[CONFIG_IOWA_STORE_DRAIN_SAMPLES];
+static bool prv_sending;
+static struct fcb_entry prv_sendCursor;     // last record of the Send
+static uint16_t prv_sendFlashCount;         // samples read from the flash
+static uint16_t prv_sendFrontCount;         // samples of the RAM record
+static int64_t prv_nextDrainTime;
+static int64_t prv_drainStart;              // 0 when the log is empty
+static uint32_t prv_drainStartCount;
+
+// Statistics
+static uint32_t prv_storedCount;
+static uint32_t prv_recordCount;
+static uint32_t prv_payloadBytes;           // sample bytes written to the flash
+static uint32_t prv_flashBytes;             // bytes programmed, FCB framing included
+static uint32_t prv_eraseCount;
+static uint32_t prv_droppedCount;
+static uint32_t prv_drainedCount;
+static uint32_t prv_sendCount;
+static uint32_t prv_sendFailureCount;
+static uint32_t prv_lastDrainCount;
+static int64_t prv_lastDrainDuration;
+
+// Bytes programmed by the FCB for an entry: length, data and CRC, each
+// padded to the write block size.
+static uint32_t prv_entrySize(uint16_t length)
+{
+    return ROUND_UP(length < 0x80 ? 1 : 2, prv_fcb.f_align)
+           + ROUND_UP(length, prv_fcb.f_align)
+           + ROUND_UP(1, prv_fcb.f_align);
+}
+
+// Returns the number of samples of a record, or a negative error code.
+static int prv_readCount(const struct flash_area *areaP,
+                         struct fcb_entry *locP)
+{
+    store_record_t header;
+    int err;
+
+    err = flash_area_read(areaP, FCB_ENTRY_FA_DATA_OFF((*locP)), &header, PRV_RECORD_HEADER_SIZE);
+    if (err != 0)
+    {
+        return err;
+    }
+    if (header.count > CONFIG_IOWA_STORE_RAM_SAMPLES
+        || locP->fe_data_len != PRV_RECORD_HEADER_SIZE + header.count * sizeof(iowa_ipso_timed_value_t))
+    {
+        return -EBADMSG;
+    }
+
+    return header.count;
+}
+
+static int prv_countCb(struct fcb_entry_ctx *entryCtxP,
+                       void *arg)
+{
+    int count;
+
+    count = prv_readCount(entryCtxP->fap, &entryCtxP->loc);
+    if (count > 0)
+    {
+        *(uint32_t *)arg += count;
+    }
+
+    return 0;
+}
+
+static void prv_rotate(void)
+{
+    int err;
+
+    err = fcb_rotate(&prv_fcb);
+    if (err != 0)
+    {
+        printk("Store: erasing a sector failed (%d)\n", err);
+        return;
+    }
+    prv_eraseCount++;
+}
+
+// Erases the sectors whose records are all consumed.
+static void prv_reclaim(void)
+{
+    if (prv_flashCount == 0)
+    {
+        while (!fcb_is_empty(&prv_fcb))
+        {
+            prv_rotate();
+        }
+        prv_cursor.fe_sector = NULL;
+        return;
+    }
+
+    while (prv_cursor.fe_sector != NULL
+           && prv_fcb.f_oldest != prv_cursor.fe_sector)
+    {
+        prv_rotate();
+    }
+}
+
+// Makes room when the log is full: the samples of the oldest sector not
+// consumed yet are lost.
+static void prv_dropOldest(void)
+{
+    struct flash_sector *oldestP;
+    struct fcb_entry loc;
+    uint32_t dropped;
+    int count;
+
+    oldestP = prv_fcb.f_oldest;
+    dropped = 0;
+
+    loc = prv_cursor;
+    if (loc.fe_sector != oldestP)
+    {
+        loc.fe_sector = NULL;
+    }
+    while (fcb_getnext(&prv_fcb, &loc) == 0
+           && loc.fe_sector == oldestP)
+    {
+        count = prv_readCount(prv_fcb.fap, &loc);
+        if (count > 0)
+        {
+            dropped += count;
+        }
+    }
+
+    prv_rotate();
+    if (prv_cursor.fe_sector == oldestP)
+    {
+        prv_cursor.fe_sector = NULL;
+    }
+    if (prv_sending)
+    {
+        // The records of the Send may be erased: do not consume them
+        prv_sendFlashCount = 0;
+    }
+    prv_flashCount -= MIN(dropped, prv_flashCount);
+    prv_droppedCount += dropped;
+}
+
+// Writes the RAM record to the flash.
+static void prv_writeFront(void)
+{
+    struct fcb_entry loc;
+    uint16_t length;
+    int err;
+
+    if (prv_front.count == 0)
+    {
+        return;
+    }
+
+    length = PRV_RECORD_HEADER_SIZE + prv_front.count * sizeof(iowa_ipso_timed_value_t);
+    err = fcb_append(&prv_fcb, length, &loc);
+    if (err == -ENOSPC)
+    {
+        prv_dropOldest();
+        err = fcb_append(&prv_fcb, length, &loc);
+    }
+    if (err == 0)
+    {
+        err = flash_area_write(prv_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), &prv_front, length);
+    }
+    if (err == 0)
+    {
+        err = fcb_append_finish(&prv_fcb, &loc);
+    }
+    if (err != 0)
+    {
+        printk("Store: writing %u samples failed (%d)\n", prv_front.count, err);
+        prv_droppedCount += prv_front.count;
+    }
+    else
+    {
+        prv_recordCount++;
+        prv_payloadBytes += prv_front.count * sizeof(iowa_ipso_timed_value_t);
+        prv_flashBytes += prv_entrySize(length);
+        prv_flashCount += prv_front.count;
+    }
+
+    if (prv_sending)
+    {
+        // Sent again from the flash if the Send succeeds
+        prv_sendFrontCount = 0;
+    }
+    prv_front.count = 0;
+}
+
+static bool prv_isDrainDue(void)
+{
+    return prv_ready
+           && prv_online
+           && !prv_sending
+           && prv_flashCount + prv_front.count != 0
+           && k_uptime_get() >= prv_nextDrainTime;
+}
+
+static void prv_sendResultCb(uint32_t shortId,
+                             iowa_dm_operation_t operation,
+                             iowa_status_t status,
+                             iowa_response_content_t *contentP,
+                             void *userDataP,
+                             iowa_context_t contextP)
+{
+    int64_t now;
+
+    (void)shortId;
+    (void)operation;
+    (void)contentP;
+    (void)userDataP;
+    (void)contextP;
+
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+
+    now = k_uptime_get();
+    prv_sending = false;
+    prv_nextDrainTime = now + CONFIG_IOWA_STORE_DRAIN_INTERVAL;
+
+    if ((status >> 5) != 2)
+    {
+        prv_sendFailureCount++;
+        k_mutex_unlock(&prv_storeMutex);
+        return;
+    }
+    prv_sendCount++;
+
+    if (prv_sendFlashCount != 0)
+    {
+        prv_cursor = prv_sendCursor;
+        prv_flashCount -= MIN(prv_sendFlashCount, prv_flashCount);
+        prv_drainedCount += prv_sendFlashCount;
+        prv_reclaim();
+    }
+    if (prv_sendFrontCount != 0)
+    {
+        prv_front.count -= prv_sendFrontCount;
+        memmove(prv_front.valueArray, prv_front.valueArray + prv_sendFrontCount, prv_front.count * sizeof(iowa_ipso_timed_value_t));
+        prv_drainedCount += prv_sendFrontCount;
+    }
+
+    if (prv_flashCount + prv_front.count == 0)
+    {
+        prv_lastDrainCount = prv_drainedCount - prv_drainStartCount;
+        prv_lastDrainDuration = now - prv_drainStart;
+        prv_drainStart = 0;
+    }
+
+    k_mutex_unlock(&prv_storeMutex);
+}
+
+int client_store_init(void)
+{
+    const struct flash_area *areaP;
+    uint32_t sectorCount;
+    int err;
+
+    // -ENOMEM: the area has more sectors, the first ones are used
+    sectorCount = CONFIG_IOWA_STORE_SECTORS;
+    err = flash_area_get_sectors(PRV_FLASH_AREA_ID, &sectorCount, prv_sectorArray);
+    if (err != 0
+        && err != -ENOMEM)
+    {
+        return err;
+    }
+
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+
+    prv_fcb.f_magic = PRV_FCB_MAGIC;
+    prv_fcb.f_version = PRV_FCB_VERSION;
+    prv_fcb.f_sector_cnt = sectorCount;
+    prv_fcb.f_scratch_cnt = 0;
+    prv_fcb.f_sectors = prv_sectorArray;
+
+    err = fcb_init(PRV_FLASH_AREA_ID, &prv_fcb);
+    if (err != 0)
+    {
+        // Not a log of this version: start a new one
+        printk("Store: erasing the log (%d)\n", err);
+        err = flash_area_open(PRV_FLASH_AREA_ID, &areaP);
+        if (err == 0)
+        {
+            err = flash_area_erase(areaP, 0, prv_sectorArray[sectorCount - 1].fs_off + prv_sectorArray[sectorCount - 1].fs_size);
+            flash_area_close(areaP);
+            prv_eraseCount += sectorCount;
+        }
+        if (err == 0)
+        {
+            err = fcb_init(PRV_FLASH_AREA_ID, &prv_fcb);
+        }
+    }
+
+    if (err == 0)
+    {
+        prv_flashCount = 0;
+        (void)fcb_walk(&prv_fcb, NULL, prv_countCb, &prv_flashCount);
+        prv_ready = true;
+        printk("Store: %u samples left in the log\n", prv_flashCount);
+    }
+
+    k_mutex_unlock(&prv_storeMutex);
+
+    return err;
+}
+
+void client_store_close(void)
+{
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+    if (prv_ready)
+    {
+        prv_writeFront();
+    }
+    k_mutex_unlock(&prv_storeMutex);
+}
+
+void client_store_set_online(bool online)
+{
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+    prv_online = online;
+    k_mutex_unlock(&prv_storeMutex);
+}
+
+bool client_store_is_capturing(void)
+{
+    bool capturing;
+
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+    // Once the Send in progress holds the rest of the log, the next
+    // samples go live: the drain would otherwise chase them forever.
+    capturing = prv_ready
+                && (!prv_online
+                    || (prv_flashCount + prv_front.count != 0
+                        && !(prv_sending && prv_flashCount == 0 && prv_sendFrontCount == prv_front.count)));
+    k_mutex_unlock(&prv_storeMutex);
+
+    return capturing;
+}
+
+void client_store_add(const iowa_ipso_timed_value_t *valueArray,
+                      size_t valueCount)
+{
+    size_t i;
+
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+
+    for (i = 0; i < valueCount; i++)
+    {
+        if (prv_front.count == CONFIG_IOWA_STORE_RAM_SAMPLES)
+        {
+            prv_writeFront();
+        }
+        prv_front.valueArray[prv_front.count] = valueArray[i];
+        prv_front.count++;
+        prv_storedCount++;
+    }
+
+    k_mutex_unlock(&prv_storeMutex);
+}
+
+bool client_store_drain_due(void)
+{
+    bool due;
+
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+    due = prv_isDrainDue();
+    k_mutex_unlock(&prv_storeMutex);
+
+    return due;
+}
+
+iowa_status_t client_store_drain(iowa_context_t contextP,
+                                 const iowa_lwm2m_uri_t *uriP,
+                                 uint16_t shortId)
+{
+    iowa_status_t result;
+    struct fcb_entry loc;
+    struct fcb_entry next;
+    size_t count;
+    int recordCount;
+    bool flashEnd;
+    int err;
+
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+
+    if (!prv_isDrainDue())
+    {
+        k_mutex_unlock(&prv_storeMutex);
+        return IOWA_COAP_NO_ERROR;
+    }
+
+    // Whole records, oldest first
+    count = 0;
+    flashEnd = false;
+    loc = prv_cursor;
+    while (true)
+    {
+        next = loc;
+        if (fcb_getnext(&prv_fcb, &next) != 0)
+        {
+            flashEnd = true;
+            break;
+        }
+        recordCount = prv_readCount(prv_fcb.fap, &next);
+        if (recordCount < 0)
+        {
+            printk("Store: reading a record failed (%d)\n", recordCount);
+            break;
+        }
+        if (count + recordCount > CONFIG_IOWA_STORE_DRAIN_SAMPLES)
+        {
+            break;
+        }
+        err = flash_area_read(prv_fcb.fap, FCB_ENTRY_FA_DATA_OFF(next) + PRV_RECORD_HEADER_SIZE,
+                              prv_sendArray + count, recordCount * sizeof(iowa_ipso_timed_value_t));
+        if (err != 0)
+        {
+            printk("Store: reading a record failed (%d)\n", err);
+            break;
+        }
+        count += recordCount;
+        loc = next;
+    }
+    prv_sendCursor = loc;
+    prv_sendFlashCount = count;
+
+    // Then the most recent samples, once the flash is drained
+    prv_sendFrontCount = 0;
+    if (flashEnd)
+    {
+        prv_sendFrontCount = MIN(prv_front.count, CONFIG_IOWA_STORE_DRAIN_SAMPLES - count);
+        memcpy(prv_sendArray + count, prv_front.valueArray, prv_sendFrontCount * sizeof(iowa_ipso_timed_value_t));
+        count += prv_sendFrontCount;
+    }
+
+    if (count == 0)
+    {
+        // Unreadable record
+        prv_nextDrainTime = k_uptime_get() + CONFIG_IOWA_STORE_DRAIN_INTERVAL;
+        k_mutex_unlock(&prv_storeMutex);
+        return IOWA_COAP_500_INTERNAL_SERVER_ERROR;
+    }
+
+    prv_sending = true;
+    if (prv_drainStart == 0)
+    {
+        prv_drainStart = k_uptime_get();
+        prv_drainStartCount = prv_drainedCount;
+    }
+
+    // The stack is called without the store mutex, which its callback takes
+    k_mutex_unlock(&prv_storeMutex);
+
+    result = client_batch_send(contextP, shortId, uriP, prv_sendArray, count, prv_sendResultCb, NULL);
+
+    if (result != IOWA_COAP_NO_ERROR)
+    {
+        k_mutex_lock(&prv_storeMutex, K_FOREVER);
+        prv_sending = false;
+        prv_sendFailureCount++;
+        prv_nextDrainTime = k_uptime_get() + CONFIG_IOWA_STORE_DRAIN_INTERVAL;
+        k_mutex_unlock(&prv_storeMutex);
+    }
+
+    return result;
+}
+
+void client_store_print_stats(void)
+{
+    uint32_t amplification;
+    uint32_t rate;
+
+    k_mutex_lock(&prv_storeMutex, K_FOREVER);
+
+    // In hundredths
+    amplification = 0;
+    if (prv_payloadBytes != 0)
+    {
+        amplification = (uint32_t)((uint64_t)prv_flashBytes * 100 / prv_payloadBytes);
+    }
+    rate = 0;
+    if (prv_lastDrainDuration > 0)
+    {
+        rate = (uint32_t)((uint64_t)prv_lastDrainCount * MSEC_PER_SEC / prv_lastDrainDuration);
+    }
+
+    printk("Store: %u samples stored, %u left (%u in flash), %u dropped\n",
+           prv_storedCount, prv_flashCount + prv_front.count, prv_flashCount, prv_droppedCount);
+    printk("Store flash: %u records, %u sample bytes, %u bytes programmed, write amplification %u.%02u, %u sector erases\n",
+           prv_recordCount, prv_payloadBytes, prv_flashBytes, amplification / 100, amplification % 100, prv_eraseCount);
+    printk("Store drain: %u samples in %u Sends, %u failed, last drain %u samples in %u ms (%u samples/s)\n",
+           prv_drainedCount, prv_sendCount, prv_sendFailureCount,
+           prv_lastDrainCount, (uint32_t)prv_lastDrainDuration, rate);
+    printk("Store RAM: %u bytes (record %u, Send buffer %u, FCB %u)\n",
+           (uint32_t)(sizeof(prv_front) + sizeof(prv_sendArray) + sizeof(prv_fcb) + sizeof(prv_sectorArray)),
+           (uint32_t)sizeof(prv_front), (uint32_t)sizeof(prv_sendArray), (uint32_t)(sizeof(prv_fcb) + sizeof(prv_sectorArray)));
+
+    k_mutex_unlock(&prv_storeMutex);
+}
@@ -0,0 +1,71 @@
+/**********************************************
+*
+* Copyright (c) 2016-2021 IoTerop.
+* All rights reserved.
+*
+**********************************************/
+
+/**********************************************
+ *
+ * Store-and-forward log of the sensor samples.
+ *
+ * While the client is not registered, or while
+ * older samples are still to be sent, the
+ * samples are queued in a RAM record of
+ * CONFIG_IOWA_STORE_RAM_SAMPLES samples, written
+ * to a flash circular buffer (FCB) when full.
+ * Once registered, the log is sent oldest first
+ * in LwM2M Sends of up to
+ * CONFIG_IOWA_STORE_DRAIN_SAMPLES samples, one
+ * at a time and at most one every
+ * CONFIG_IOWA_STORE_DRAIN_INTERVAL ms. A record
+ * is consumed when the server acknowledged its
+ * Send, and a flash sector is erased once all
+ * its records are consumed.
+ *
+ * The samples of the RAM record are lost on a
+ * power loss, client_store_close() saves them
+ * on a clean stop.
+ *
+ **********************************************/
+
+#ifndef _CLIENT_STORE_INCLUDE_
+#define _CLIENT_STORE_INCLUDE_
+
+#include "iowa_client.h"
+#include "iowa_ipso.h"
+
+#include <stdbool.h>
+
+// Mounts the flash log. The samples left by the previous run are sent
+// after the next registration. Returns 0 or a negative error code, in
+// which case the samples are never stored.
+int client_store_init(void);
+
+// Saves the RAM record to the flash.
+void client_store_close(void);
+
+// Tells whether the client is registered, from the IOWA events.
+void client_store_set_online(bool online);
+
+// Returns true when the next samples must go to the store: the client is
+// not registered or older samples are still to be sent.
+bool client_store_is_capturing(void);
+
+// Queues samples at the end of the log.
+void client_store_add(const iowa_ipso_timed_value_t *valueArray,
+                      size_t valueCount);
+
+// Returns true when client_store_drain() would send samples.
+bool client_store_drain_due(void);
+
+// Sends the oldest samples as timestamped values of the resource uriP, see
+// client_batch_send(). Returns an IOWA status.
+iowa_status_t client_store_drain(iowa_context_t contextP,
+                                 const iowa_lwm2m_uri_t *uriP,
+                                 uint16_t shortId);
+
+// Prints the write amplification, the drain throughput and the RAM used.
+void client_store_print_stats(void);
+
+#endif
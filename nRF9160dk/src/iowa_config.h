@@ -34,6 +34,12 @@
 // #define LWM2M_BIG_ENDIAN
 #define LWM2M_LITTLE_ENDIAN
 
+/**********************************************
+* The stack is called from several threads and
+* iowa_stop() is used to interrupt iowa_step().
+*/
+#define IOWA_THREAD_SUPPORT
+
 /************************************************
 * To specify the size of the static buffer used
 * to received datagram packets.
@@ -50,7 +56,11 @@
 * Support of transports.
 */
 #define IOWA_UDP_SUPPORT
+#if defined(CONFIG_IOWA_TCP)
+#define IOWA_TCP_SUPPORT
+#else
 // #define IOWA_TCP_SUPPORT
+#endif
 // #define IOWA_LORAWAN_SUPPORT
 // #define IOWA_SMS_SUPPORT
 
@@ -73,14 +83,54 @@
 *     - IOWA_PART_OBJECT
 *     - IOWA_PART_SECURITY
 *     - IOWA_PART_SYSTEM
+*
+* The level is selected by CONFIG_IOWA_TRACE_LEVEL_*.
+* The parts are filtered at runtime by the Zephyr
+* logging when CONFIG_IOWA_LOG_DEFERRED is set.
 */
+#if defined(CONFIG_IOWA_TRACE_LEVEL_ERROR)
+#define IOWA_LOG_LEVEL IOWA_LOG_LEVEL_ERROR
+#elif defined(CONFIG_IOWA_TRACE_LEVEL_WARNING)
+#define IOWA_LOG_LEVEL IOWA_LOG_LEVEL_WARNING
+#elif defined(CONFIG_IOWA_TRACE_LEVEL_INFO)
 #define IOWA_LOG_LEVEL IOWA_LOG_LEVEL_INFO
+#elif defined(CONFIG_IOWA_TRACE_LEVEL_TRACE)
+#define IOWA_LOG_LEVEL IOWA_LOG_LEVEL_TRACE
+#endif
 // #define IOWA_LOG_PART IOWA_PART_ALL
 
 /**********************************************
 * To enable LWM2M features.
 **********************************************/
 
+/**********************************************
+* To support the LwM2M 1.1 Send operation and
+* timestamped values, used to report batches
+* of samples.
+*/
+#if defined(CONFIG_IOWA_BATCH)
+#define LWM2M_VERSION_1_1_SUPPORT
+#define LWM2M_DATA_PUSH_SUPPORT
+#define LWM2M_SUPPORT_TIMESTAMP
+#endif
+
+/**********************************************
+* The Firmware Update object, in pull mode. The
+* download itself is done by client_fota.c.
+*/
+#if defined(CONFIG_IOWA_FOTA)
+#define IOWA_SUPPORT_FIRMWARE_UPDATE_OBJECT
+#endif
+
+/**********************************************
+* The context, the registration included, is
+* saved and loaded back by client_context.c for
+* the warm starts.
+*/
+#if defined(CONFIG_IOWA_WARM_START)
+#define IOWA_STORAGE_CONTEXT_SUPPORT
+#endif
+
 /**********************************************
 * To specify the LWM2M role of your device.
 * Several of them can be defined at the same time.
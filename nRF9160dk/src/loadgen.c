@@ -0,0 +1,401 @@
+/**********************************************
+ *
+ * Copyright (c) 2016-2021 IoTerop.
+ * All rights reserved.
+ *
+ * This program and the accompanying materials
+ * are made available under the terms of
+ * IoTerop’s IOWA License (LICENSE.TXT) which
+ * accompany this distribution.
+ *
+ **********************************************/
+
+/**************************************************
+ *
+ * Load generator: runs CONFIG_IOWA_LOADGEN_CLIENTS
+ * independent LwM2M Clients in one process against
+ * a local server (see scripts/lwm2m_server.py).
+ *
+ * Each client has its own IOWA context, platform
+ * data, sockets and iowa_step() thread. The main
+ * thread updates their sensors and reports the
+ * registration throughput, the notification
+ * latency, the heap used per client and the CPU
+ * time per datagram.
+ *
+ **************************************************/
+
+#include "iowa_client.h"
+#include "iowa_ipso.h"
+#include "iowa_platform.h"
+#include "client_platform.h"
+#include "client_memory.h"
+#include "client_probe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr.h>
+
+// LwM2M Server details
+#define SERVER_SHORT_ID CONFIG_IOWA_SERVER_SHORT_ID
+#define SERVER_LIFETIME CONFIG_IOWA_SERVER_LIFETIME
+#define SERVER_URI CONFIG_IOWA_SERVER_URI ":" CONFIG_IOWA_SERVER_PORT
+
+#define CLIENT_COUNT CONFIG_IOWA_LOADGEN_CLIENTS
+
+#define THREAD_STACK_SIZE KB(4)
+#define THREAD_PRIORITY K_PRIO_PREEMPT(1)
+
+// a structure to store data for each simulated client
+typedef struct
+{
+    char endpointName[40];
+    iowa_context_t iowaContext;
+    void *platformDataP;
+    iowa_sensor_t sensorId;
+    int64_t registeredTime;   // 0 until registered
+    int64_t updateTime;       // 0 when no update waits for its notification
+    uint64_t busyCycles;      // cycles in iowa_step() outside of poll()
+    uint32_t updateCount;
+    uint32_t notifyCount;
+} loadgen_client_t;
+
+static loadgen_client_t prv_clientArray[CLIENT_COUNT];
+
+static K_KERNEL_STACK_ARRAY_DEFINE(prv_stackArray, CLIENT_COUNT, THREAD_STACK_SIZE);
+static struct k_thread prv_threadArray[CLIENT_COUNT];
+
+static atomic_t prv_stop;
+static int64_t prv_startTime;
+
+// notification latencies in milliseconds, the updateTime of the clients,
+// set by the main thread and cleared by the client threads, and their
+// registeredTime, set by the client threads and read by the main thread
+static struct k_spinlock prv_latencyLock;
+static int32_t prv_latencyArray[CONFIG_IOWA_LOADGEN_MAX_SAMPLES];
+static size_t prv_latencyCount;
+static uint32_t prv_latencyDropped;
+
+/* ----------------------------------------------------
+*/
+static loadgen_client_t * prv_findClient(iowa_context_t contextP) {
+    size_t i;
+
+    for (i = 0; i < CLIENT_COUNT; i++) {
+        if (prv_clientArray[i].iowaContext == contextP) {
+            return prv_clientArray + i;
+        }
+    }
+
+    return NULL;
+}
+
+/* ----------------------------------------------------
+ * executed on the client thread, with the IOWA lock held
+*/
+static void prv_eventCb(iowa_event_t *eventP, void *userData, iowa_context_t contextP) {
+    loadgen_client_t *clientP;
+    int64_t now;
+    k_spinlock_key_t key;
+    (void)userData;
+
+    clientP = prv_findClient(contextP);
+    if (clientP == NULL) {
+        return;
+    }
+    now = k_uptime_get();
+
+    switch (eventP->eventType) {
+    case IOWA_EVENT_REG_REGISTERED:
+        key = k_spin_lock(&prv_latencyLock);
+        if (clientP->registeredTime == 0) {
+            clientP->registeredTime = now;
+        }
+        k_spin_unlock(&prv_latencyLock, key);
+        break;
+
+    case IOWA_EVENT_OBSERVATION_NOTIFICATION:
+        clientP->notifyCount++;
+        key = k_spin_lock(&prv_latencyLock);
+        if (clientP->updateTime != 0) {
+            if (prv_latencyCount < CONFIG_IOWA_LOADGEN_MAX_SAMPLES) {
+                prv_latencyArray[prv_latencyCount] = (int32_t)(now - clientP->updateTime);
+                prv_latencyCount++;
+            } else {
+                prv_latencyDropped++;
+            }
+            clientP->updateTime = 0;
+        }
+        k_spin_unlock(&prv_latencyLock, key);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* ----------------------------------------------------
+ * iowa_step() loop of one client
+*/
+static void prv_client_fn(void *p1, void *p2, void *p3) {
+    loadgen_client_t *clientP;
+    iowa_status_t result;
+    uint64_t waitStart;
+    uint32_t stepStart;
+    (void)p2;
+    (void)p3;
+
+    clientP = (loadgen_client_t *)p1;
+
+    while (!atomic_get(&prv_stop)) {
+        // Short steps keep the 32-bit cycle counter from wrapping
+        waitStart = platform_get_wait_cycles(clientP->platformDataP);
+        stepStart = k_cycle_get_32();
+
+        result = iowa_step(clientP->iowaContext, 1);
+
+        clientP->busyCycles += (k_cycle_get_32() - stepStart)
+                               - (platform_get_wait_cycles(clientP->platformDataP) - waitStart);
+
+        if (result != IOWA_COAP_NO_ERROR) {
+            printk("%s: iowa_step failed with (%u.%02u).\n", clientP->endpointName, (result & 0xFF) >> 5, (result & 0x1F));
+            break;
+        }
+    }
+}
+
+/* ----------------------------------------------------
+*/
+static int prv_compareLatency(const void *a, const void *b) {
+    int32_t left = *(const int32_t *)a;
+    int32_t right = *(const int32_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+/* ----------------------------------------------------
+*/
+static int prv_startClient(loadgen_client_t *clientP, size_t index) {
+    iowa_status_t result;
+    iowa_device_info_t devInfo;
+
+    snprintf(clientP->endpointName, sizeof(clientP->endpointName), "%s_%04u", CONFIG_IOWA_DEVICE_NAME, (unsigned int)index);
+
+    clientP->platformDataP = get_platform_data();
+    if (clientP->platformDataP == NULL) {
+        printk("%s: error initializing platform functions.\n", clientP->endpointName);
+        return -1;
+    }
+
+    clientP->iowaContext = iowa_init(clientP->platformDataP);
+    if (clientP->iowaContext == NULL) {
+        printk("%s: IOWA context initialization failed.\n", clientP->endpointName);
+        return -1;
+    }
+
+    memset(&devInfo, 0, sizeof(iowa_device_info_t));
+    devInfo.manufacturer = "IoTerop";
+    devInfo.deviceType = "IOWA load generator";
+    devInfo.modelNumber = "loadgen-001";
+    result = iowa_client_configure(clientP->iowaContext, clientP->endpointName, &devInfo, prv_eventCb);
+    if (result != IOWA_COAP_NO_ERROR) {
+        printk("%s: IOWA Client configuration failed (%u.%02u).\n", clientP->endpointName, (result & 0xFF) >> 5, (result & 0x1F));
+        return -1;
+    }
+
+    result = iowa_client_IPSO_add_sensor(clientP->iowaContext, IOWA_IPSO_VOLTAGE, 12.0, "V", "Test DC", 0.0, 24.0, &clientP->sensorId);
+    if (result != IOWA_COAP_NO_ERROR) {
+        printk("%s: adding a sensor failed (%u.%02u).\n", clientP->endpointName, (result & 0xFF) >> 5, (result & 0x1F));
+        return -1;
+    }
+
+    result = iowa_client_add_server(clientP->iowaContext, SERVER_SHORT_ID, SERVER_URI, SERVER_LIFETIME, 0, IOWA_SEC_NONE);
+    if (result != IOWA_COAP_NO_ERROR) {
+        printk("%s: adding a server failed (%u.%02u).\n", clientP->endpointName, (result & 0xFF) >> 5, (result & 0x1F));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ----------------------------------------------------
+ * update the sensor of every registered client
+*/
+static void prv_updateSensors(uint32_t round) {
+    size_t i;
+    int64_t now;
+    iowa_status_t result;
+    k_spinlock_key_t key;
+
+    now = k_uptime_get();
+
+    for (i = 0; i < CLIENT_COUNT; i++) {
+        loadgen_client_t *clientP = prv_clientArray + i;
+
+        // Only the first update since the last notification is timed
+        key = k_spin_lock(&prv_latencyLock);
+        if (clientP->registeredTime == 0) {
+            k_spin_unlock(&prv_latencyLock, key);
+            continue;
+        }
+        if (clientP->updateTime == 0) {
+            clientP->updateTime = now;
+        }
+        k_spin_unlock(&prv_latencyLock, key);
+        clientP->updateCount++;
+
+        // Alternate the values so that every update is notified
+        result = iowa_client_IPSO_update_value(clientP->iowaContext, clientP->sensorId, (float)((round + i) % 24));
+        if (result != IOWA_COAP_NO_ERROR) {
+            printk("%s: updating the sensor value failed (%u.%02u).\n", clientP->endpointName, (result & 0xFF) >> 5, (result & 0x1F));
+        }
+    }
+}
+
+/* ----------------------------------------------------
+*/
+static void prv_printReport(size_t startedCount, size_t heapUsed) {
+    size_t i;
+    size_t registeredCount;
+    int64_t lastRegistration;
+    uint32_t updateCount;
+    uint32_t notifyCount;
+    uint64_t busyCycles;
+    uint32_t datagramCount;
+    platform_traffic_t traffic;
+
+    registeredCount = 0;
+    lastRegistration = prv_startTime;
+    updateCount = 0;
+    notifyCount = 0;
+    busyCycles = 0;
+    datagramCount = 0;
+
+    for (i = 0; i < startedCount; i++) {
+        loadgen_client_t *clientP = prv_clientArray + i;
+        k_spinlock_key_t key;
+        int64_t registeredTime;
+
+        key = k_spin_lock(&prv_latencyLock);
+        registeredTime = clientP->registeredTime;
+        k_spin_unlock(&prv_latencyLock, key);
+
+        if (registeredTime != 0) {
+            registeredCount++;
+            if (registeredTime > lastRegistration) {
+                lastRegistration = registeredTime;
+            }
+        }
+        updateCount += clientP->updateCount;
+        notifyCount += clientP->notifyCount;
+        busyCycles += clientP->busyCycles;
+
+        platform_get_traffic(clientP->platformDataP, &traffic);
+        datagramCount += traffic.txDatagrams + traffic.rxDatagrams;
+    }
+
+    printk("Load: %u clients started, %u registered\n", (unsigned int)startedCount, (unsigned int)registeredCount);
+    if (registeredCount != 0 && lastRegistration > prv_startTime) {
+        printk("Load: registrations: %u ms to register all, %u per second\n",
+            (unsigned int)(lastRegistration - prv_startTime),
+            (unsigned int)(registeredCount * MSEC_PER_SEC / (lastRegistration - prv_startTime)));
+    }
+
+    printk("Load: %u updates, %u notifications\n", updateCount, notifyCount);
+    if (prv_latencyCount != 0) {
+        qsort(prv_latencyArray, prv_latencyCount, sizeof(int32_t), prv_compareLatency);
+        printk("Load: notify latency p50 %d ms, p90 %d ms, p99 %d ms, max %d ms (%u samples, %u not kept)\n",
+            prv_latencyArray[prv_latencyCount * 50 / 100],
+            prv_latencyArray[prv_latencyCount * 90 / 100],
+            prv_latencyArray[prv_latencyCount * 99 / 100],
+            prv_latencyArray[prv_latencyCount - 1],
+            (unsigned int)prv_latencyCount, prv_latencyDropped);
+    }
+
+    if (startedCount != 0) {
+        printk("Load: IOWA heap %u bytes per client\n", (unsigned int)(heapUsed / startedCount));
+    }
+
+    if (datagramCount != 0) {
+        printk("Load: %u datagrams, %u us of CPU per datagram\n",
+            datagramCount, k_cyc_to_us_floor32((uint32_t)(busyCycles / datagramCount)));
+    }
+}
+
+/* ---------------------------------------------------------------
+*/
+void main(void) {
+    size_t i;
+    size_t startedCount;
+    size_t heapBase;
+    size_t heapUsed;
+    uint32_t round;
+    int64_t stopTime;
+
+    printk("**************************************\n");
+    printk("** Iowa load generator              **\n");
+    printk("** (c)IoTerop 2021                  **\n");
+    printk("**************************************\n");
+    printk("Server:  %s\n", SERVER_URI);
+    printk("Clients: %u, update period %u ms\n", CLIENT_COUNT, CONFIG_IOWA_LOADGEN_UPDATE_PERIOD);
+
+    heapBase = client_memory_get_used();
+    prv_startTime = k_uptime_get();
+
+    // All the clients register at the same time
+    for (startedCount = 0; startedCount < CLIENT_COUNT; startedCount++) {
+        loadgen_client_t *clientP = prv_clientArray + startedCount;
+
+        if (prv_startClient(clientP, startedCount) != 0) {
+            if (clientP->iowaContext != NULL) {
+                iowa_close(clientP->iowaContext);
+            }
+            if (clientP->platformDataP != NULL) {
+                free_platform_data(clientP->platformDataP);
+            }
+            break;
+        }
+
+        k_thread_create(prv_threadArray + startedCount,
+            prv_stackArray[startedCount],
+            K_KERNEL_STACK_SIZEOF(prv_stackArray[startedCount]),
+            prv_client_fn,
+            clientP, NULL, NULL,
+            THREAD_PRIORITY, 0, K_NO_WAIT);
+    }
+
+    // Drive the sensors until the end of the test
+    stopTime = prv_startTime + CONFIG_IOWA_LOADGEN_DURATION * MSEC_PER_SEC;
+    round = 0;
+    while (k_uptime_get() < stopTime) {
+        k_sleep(K_MSEC(CONFIG_IOWA_LOADGEN_UPDATE_PERIOD));
+        prv_updateSensors(round);
+        round++;
+    }
+
+    // The heap is measured with all the clients registered and observed
+    heapUsed = client_memory_get_used() - heapBase;
+
+    printk("Stopping the clients.\n");
+    atomic_set(&prv_stop, 1);
+    for (i = 0; i < startedCount; i++) {
+        iowa_stop(prv_clientArray[i].iowaContext);
+    }
+    for (i = 0; i < startedCount; i++) {
+        (void)k_thread_join(prv_threadArray + i, K_FOREVER);
+    }
+
+    prv_printReport(startedCount, heapUsed);
+#if defined(CONFIG_IOWA_PROBES)
+    client_probe_print();
+#endif
+
+    for (i = 0; i < startedCount; i++) {
+        iowa_client_remove_server(prv_clientArray[i].iowaContext, SERVER_SHORT_ID);
+        iowa_close(prv_clientArray[i].iowaContext);
+        free_platform_data(prv_clientArray[i].platformDataP);
+    }
+
+    client_memory_print_stats();
+}
@@ -15,18 +15,65 @@
  * This is a very simple LwM2M Client demonstrating
  * IOWA ease-of-use over Nordic nrf9160DK
  *
+ * It also runs on native_posix and qemu_x86 to be
+ * exercised against a local server stand-in
+ * (see scripts/lwm2m_server.py).
+ *
  **************************************************/
 
 #include "iowa_client.h"
 #include "iowa_ipso.h"
+#include "iowa_platform.h"
+#include "client_platform.h"
+#include "client_memory.h"
+#include "client_probe.h"
+#if defined(CONFIG_IOWA_BATCH)
+#include "client_batch.h"
+#endif
+#if defined(CONFIG_IOWA_AGGREGATE)
+#include "client_aggregate.h"
+#endif
+#if defined(CONFIG_IOWA_FILTER)
+#include "client_filter.h"
+#endif
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+#include "client_command.h"
+#endif
+#if defined(CONFIG_IOWA_DNS_CACHE)
+#include "client_dns.h"
+#endif
+#if defined(CONFIG_IOWA_FOTA)
+#include "client_fota.h"
+#endif
+#if defined(CONFIG_IOWA_STORE)
+#include "client_store.h"
+#endif
+#if defined(CONFIG_IOWA_WARM_START)
+#include "client_context.h"
+#endif
+#if defined(CONFIG_IOWA_CREDENTIALS)
+#include "client_cred.h"
+#endif
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+#include "client_lifetime.h"
+#endif
+#if defined(CONFIG_IOWA_LTE_SIM)
+#include "client_lte_sim.h"
+#endif
 
+#if defined(CONFIG_LTE_LINK_CONTROL)
 #include <modem/lte_lc.h>
+#endif
 #include <net/socket.h>
 #include <stdio.h>
 #include <zephyr.h>
-
-#include <modem/modem_key_mgmt.h>
-#include <net/tls_credentials.h>
+#include <logging/log.h>
+#if defined(CONFIG_THREAD_ANALYZER)
+#include <debug/thread_analyzer.h>
+#endif
+#if defined(CONFIG_DATE_TIME)
+#include <date_time.h>
+#endif
 
 #if defined(EXIST_IN_KCONFIG)
 // Theses settings are defined in KConfig file
@@ -51,38 +98,112 @@
 #define SERVER_LIFETIME CONFIG_IOWA_SERVER_LIFETIME //default: 50
 #define SERVER_URI CONFIG_IOWA_SERVER_URI ":" CONFIG_IOWA_SERVER_PORT
 
+#if defined(CONFIG_IOWA_BATCH)
+// The batches are sent as values of the Sensor Value resource of the
+// voltage sensor, the only instance of its object
+static const iowa_lwm2m_uri_t volt_value_uri = { IOWA_IPSO_VOLTAGE, 0, 5700, IOWA_LWM2M_ID_ALL };
+#endif
+
 // Change the name for non secure device
-#if defined(CONFIG_MBEDTLS)
+#if defined(CONFIG_IOWA_DTLS)
   #define ENDPOINT_NAME CONFIG_IOWA_DEVICE_NAME
 #else
   #define ENDPOINT_NAME CONFIG_IOWA_DEVICE_NAME "_NoSec"  // add suffix to device name
 #endif
 
+#if defined(CONFIG_IOWA_WARM_START)
+// A saved context is only resumed with the same endpoint, server,
+// objects and lifetime
+#if defined(CONFIG_IOWA_PROBES_OBJECT)
+#define CONTEXT_PROBES_OBJECT "," STRINGIFY(CONFIG_IOWA_PROBES_OBJECT_ID)
+#else
+#define CONTEXT_PROBES_OBJECT ""
+#endif
+#if defined(CONFIG_IOWA_FOTA)
+#define CONTEXT_FOTA_OBJECT ",5"
+#else
+#define CONTEXT_FOTA_OBJECT ""
+#endif
+#define CONTEXT_LAYOUT ENDPOINT_NAME ";" SERVER_URI ";" STRINGIFY(SERVER_SHORT_ID) ";" \
+    STRINGIFY(IOWA_SEC_NONE) ";3316" CONTEXT_PROBES_OBJECT CONTEXT_FOTA_OBJECT
+#endif
+
+// The messages of the running client are deferred to the logging thread.
+// The banner and the final statistics are printed directly.
+LOG_MODULE_REGISTER(iowa_client, CONFIG_IOWA_LOG_LEVEL);
+
 static char client_identity[] = CONFIG_IOWA_PSK_IDENTITY ;
 static char client_psk[] = CONFIG_IOWA_PSK_KEY;       //Not in base64 
 
-// proto - client_platform.c
-extern void *get_platform_data();
-
 // a structure to store data for the measure task
 typedef struct
 {
     iowa_context_t iowaContext;
+    void *platformDataP;
     iowa_sensor_t voltSensorId;
+    uint32_t wakeupCount;
+#if defined(CONFIG_IOWA_BATCH)
+    client_batch_t voltBatch;
+#endif
+#if defined(CONFIG_IOWA_AGGREGATE)
+    client_aggregate_t voltAggregate;
+#endif
+#if defined(CONFIG_IOWA_FILTER)
+    client_filter_t voltFilter;
+#endif
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    client_command_queue_t commandQueue;
+#endif
 } measure_data_t;
 measure_data_t measureP;
 
-#define THREAD_STACK_SIZE KB(1)
+// boot phases, in k_uptime_get() time
+typedef struct
+{
+    int64_t attachStart;
+    int64_t initStart;
+    int64_t stackReady;
+    int64_t linkUp;
+    int64_t registered;
+    int64_t firstReport;
+} startup_times_t;
+static startup_times_t startupTimes;
+
+// Sized for the batch, the store drain and the Sends, see
+// overlay-analyzer.conf to check the stack used
+#define THREAD_STACK_SIZE CONFIG_IOWA_MEASURE_STACK_SIZE
 #define THREAD_PRIORITY K_PRIO_COOP(CONFIG_NUM_COOP_PRIORITIES - 1) //K_LOWEST_APPLICATION_THREAD_PRIO
 
 static K_KERNEL_STACK_DEFINE(measure_thread_stack, THREAD_STACK_SIZE);
 static struct k_thread measure_thread_data;
 static k_tid_t measure_thread_id;
 
+// sensor ready event, raised every CONFIG_IOWA_MEASURE_PERIOD ms
+static struct k_poll_signal measure_signal = K_POLL_SIGNAL_INITIALIZER(measure_signal);
+
+static void measure_timer_fn(struct k_timer *timer) {
+    (void)timer;
+
+    k_poll_signal_raise(&measure_signal, 0);
+}
+K_TIMER_DEFINE(measure_timer, measure_timer_fn, NULL);
+
+#if defined(CONFIG_IOWA_AGGREGATE)
+// end of the aggregation window, raised every CONFIG_IOWA_AGGREGATE_WINDOW s
+static struct k_poll_signal aggregate_signal = K_POLL_SIGNAL_INITIALIZER(aggregate_signal);
+
+static void aggregate_timer_fn(struct k_timer *timer) {
+    (void)timer;
+
+    k_poll_signal_raise(&aggregate_signal, 0);
+}
+K_TIMER_DEFINE(aggregate_timer, aggregate_timer_fn, NULL);
+#endif
+
 // notif. for cellular
 K_SEM_DEFINE(lte_connected, 0, 1);
 
-//#if defined(CONFIG_BSD_LIBRARY)
+#if defined(CONFIG_LTE_LINK_CONTROL)
 /* --------------------------------------------------------------- 
 */
 static void lte_handler(const struct lte_lc_evt *const evt) {
@@ -93,32 +214,34 @@ static void lte_handler(const struct lte_lc_evt *const evt) {
             break;
         }
 
-        printk("Network registration status: %s\n",
-            evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_HOME ? "Connected - home network" : "Connected - roaming\n");
+        LOG_INF("Network registration status: %s",
+            evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_HOME ? "Connected - home network" : "Connected - roaming");
         k_sem_give(&lte_connected);
         break;
     case LTE_LC_EVT_PSM_UPDATE:
-        printk("PSM parameter update: TAU: %d, Active time: %d\n",
+        LOG_INF("PSM parameter update: TAU: %d, Active time: %d",
             evt->psm_cfg.tau, evt->psm_cfg.active_time);
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+        client_lifetime_set_psm(evt->psm_cfg.tau, evt->psm_cfg.active_time);
+#endif
         break;
-    case LTE_LC_EVT_EDRX_UPDATE: {
-        char log_buf[60];
-        ssize_t len;
-
-        len = snprintf(log_buf, sizeof(log_buf),
-            "eDRX parameter update: eDRX: %f, PTW: %f\n",
-            evt->edrx_cfg.edrx, evt->edrx_cfg.ptw);
-        if (len > 0) {
-            printk("%s\n", log_buf);
-        }
+    case LTE_LC_EVT_EDRX_UPDATE:
+        // The logging does not format floats
+        LOG_INF("eDRX parameter update: eDRX: %d ms, PTW: %d ms",
+            (int)(evt->edrx_cfg.edrx * 1000), (int)(evt->edrx_cfg.ptw * 1000));
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+        client_lifetime_set_edrx((int32_t)(evt->edrx_cfg.edrx * 1000), (int32_t)(evt->edrx_cfg.ptw * 1000));
+#endif
         break;
-    }
     case LTE_LC_EVT_RRC_UPDATE:
-        printk("RRC mode: %s\n",
-            evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED ? "Connected" : "Idle\n");
+        LOG_INF("RRC mode: %s",
+            evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED ? "Connected" : "Idle");
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+        client_lifetime_set_rrc(evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED);
+#endif
         break;
     case LTE_LC_EVT_CELL_UPDATE:
-        printk("LTE cell changed: Cell ID: %d, Tracking area: %d\n",
+        LOG_INF("LTE cell changed: Cell ID: %d, Tracking area: %d",
             evt->cell.id, evt->cell.tac);
         break;
     default:
@@ -182,14 +305,71 @@ static int modem_configure(void) {
             return err;
         }
     }
+
+    return 0;
+}
+#else
+/* --------------------------------------------------------------- 
+ * Host targets: the network interface is configured at boot, the
+ * attach time of a modem can be emulated
+*/
+static void attach_timer_fn(struct k_timer *timer) {
+    (void)timer;
+
+#if defined(CONFIG_IOWA_LTE_SIM)
+    client_lte_sim_attach();
+#endif
+    k_sem_give(&lte_connected);
 }
-//#endif
+K_TIMER_DEFINE(attach_timer, attach_timer_fn, NULL);
+
+static int modem_configure(void) {
+    k_timer_start(&attach_timer, K_MSEC(CONFIG_IOWA_HOST_ATTACH_DELAY), K_NO_WAIT);
+
+    return 0;
+}
+#endif
+
+#if defined(CONFIG_IOWA_CREDENTIALS)
+#if CONFIG_IOWA_CREDENTIALS_ROTATION_TAG != 0
+BUILD_ASSERT(sizeof(CONFIG_IOWA_CREDENTIALS_ROTATION_IDENTITY) > 1
+             && sizeof(CONFIG_IOWA_CREDENTIALS_ROTATION_PSK) > 1,
+             "The rotation tag needs an identity and a PSK");
+#endif
+
+/* ---------------------------------------------------------------
+ * Write the PSK of the DTLS security tag, given in hexadecimal, and
+ * the one of the next server, when they changed. Only a failure on the
+ * tag of the current server is returned: the client can not connect
+ * without it.
+*/
+static int provision_credentials(void) {
+    client_cred_t credArray[CLIENT_CRED_MAX_TAGS];
+    int resultArray[CLIENT_CRED_MAX_TAGS];
+    size_t credCount;
+
+    credArray[0].secTag = CONFIG_IOWA_BOARD_TLS_TAG;
+    credArray[0].identity = client_identity;
+    credArray[0].pskHex = client_psk;
+    credCount = 1;
+#if CONFIG_IOWA_CREDENTIALS_ROTATION_TAG != 0
+    credArray[1].secTag = CONFIG_IOWA_CREDENTIALS_ROTATION_TAG;
+    credArray[1].identity = CONFIG_IOWA_CREDENTIALS_ROTATION_IDENTITY;
+    credArray[1].pskHex = CONFIG_IOWA_CREDENTIALS_ROTATION_PSK;
+    credCount = 2;
+#endif
+
+    (void)client_cred_provision(credArray, credCount, resultArray);
+
+    return resultArray[0];
+}
+#endif
 
 
 /* ----------------------------------------------------
  * handle the result notification
 */
-#ifndef CONFIG_IOWA_EVAL_VERSION 
+#if defined(CONFIG_IOWA_BATCH)
 static void prv_sendResultCb(uint32_t shortId,
     iowa_dm_operation_t operation,
     iowa_status_t status,
@@ -202,32 +382,479 @@ static void prv_sendResultCb(uint32_t shortId,
     (void)userDataP;
 
     if (operation == IOWA_DM_DATA_PUSH) {
-        printk("\tprv_sendResultCb():Send operation occurred: %u.%02u\n", (status & 0xFF) >> 5, (status & 0x1F));
+        LOG_INF("Send operation occurred: %u.%02u", (status & 0xFF) >> 5, (status & 0x1F));
+        if ((status >> 5) == 2) {
+            if (startupTimes.firstReport == 0) {
+                startupTimes.firstReport = k_uptime_get();
+            }
+#if defined(CONFIG_IOWA_WARM_START)
+            client_context_reported();
+#endif
+        }
     }
 }
 #endif
 /* ----------------------------------------------------
+ * time of the samples: Unix time once the modem got the network time,
+ * uptime before, both in seconds
 */
-static void send_measure_fn(void) {
+static int32_t sample_time(void) {
+#if defined(CONFIG_DATE_TIME)
+    int64_t unixTime;
+
+    if (date_time_now(&unixTime) == 0) {
+        return (int32_t)(unixTime / MSEC_PER_SEC);
+    }
+#endif
+    return iowa_system_gettime();
+}
+
+/* ----------------------------------------------------
+ * hand timestamped values of the voltage sensor to the stack
+*/
+static void publish_values(iowa_sensor_t sensorId, iowa_ipso_timed_value_t *valueArray, size_t valueCount) {
     iowa_status_t result;
-    iowa_sensor_uri_t sensorUri;
-    
-    sensorUri.id = measureP.voltSensorId;
-    sensorUri.resourceId = IOWA_LWM2M_ID_ALL;
+#if defined(CONFIG_IOWA_BATCH)
+    bool flush;
+    size_t i;
+
+    (void)sensorId;
+#endif
+
+#if defined(CONFIG_IOWA_STORE)
+    if (client_store_is_capturing()) {
+        // Offline, or older samples still to send: the queued values go
+        // first to keep the log in order
+        client_store_add(measureP.voltBatch.valueArray, measureP.voltBatch.count);
+        client_batch_clear(&measureP.voltBatch);
+        client_store_add(valueArray, valueCount);
+        return;
+    }
+#endif
+
+#if defined(CONFIG_IOWA_BATCH)
+    // Queue the values, the server only gets complete batches. Without new
+    // values, the queue is flushed once its oldest sample is too old.
+    flush = client_batch_is_due(&measureP.voltBatch, sample_time());
+    for (i = 0; i < valueCount; i++) {
+        flush |= client_batch_add(&measureP.voltBatch, valueArray[i].value, valueArray[i].timestamp);
+    }
+    if (!flush) {
+        return;
+    }
+
+    // The batch only goes in the Send: the Sensor Value is not updated, so
+    // that its observers do not get the samples a second time
+    LOG_INF("Send update to server...");
+    result = client_batch_flush(&measureP.voltBatch, measureP.iowaContext, SERVER_SHORT_ID, &volt_value_uri, prv_sendResultCb, NULL);
+    k_yield();
+    if (result != IOWA_COAP_NO_ERROR) {
+        LOG_ERR("Sending the voltage sensor values failed (%u.%02u).", (result & 0xFF) >> 5, (result & 0x1F));
+    }
+#else
+    if (valueCount == 0) {
+        return;
+    }
+    if (valueCount == 1) {
+        result = iowa_client_IPSO_update_value(measureP.iowaContext, sensorId, valueArray[0].value);
+    } else {
+        result = iowa_client_IPSO_update_values(measureP.iowaContext, sensorId, valueCount, valueArray);
+    }
+    k_yield();
+    if (result != IOWA_COAP_NO_ERROR) {
+        LOG_ERR("Updating the voltage sensor value failed (%u.%02u).", (result & 0xFF) >> 5, (result & 0x1F));
+    }
+#endif
+}
+
+#if defined(CONFIG_IOWA_AGGREGATE)
+/* ----------------------------------------------------
+ * replace the Min and Max Measured Values (5601/5602) of the voltage
+ * sensor by the extremes of the aggregation window
+*/
+static void publish_min_max(iowa_sensor_t sensorId, float minValue, float maxValue) {
+    iowa_status_t result;
+
+    // The stack resets both resources to the given values, the Sensor
+    // Value is left untouched
+    result = iowa_client_IPSO_update_min_max(measureP.iowaContext, sensorId, minValue, maxValue);
+    if (result != IOWA_COAP_NO_ERROR) {
+        LOG_ERR("Updating the voltage sensor extremes failed (%u.%02u).", (result & 0xFF) >> 5, (result & 0x1F));
+    }
+}
+#endif
+
+/* ----------------------------------------------------
+ * track the registration: the samples are stored while offline, the
+ * context is saved once registered
+*/
+static void prv_eventCb(iowa_event_t *eventP, void *userData, iowa_context_t contextP) {
+    (void)userData;
+    (void)contextP;
+
+    switch (eventP->eventType) {
+#if defined(CONFIG_IOWA_WARM_START)
+    case IOWA_EVENT_REG_REGISTERING:
+        client_context_registering();
+        break;
+#endif
+
+    case IOWA_EVENT_REG_REGISTERED:
+        if (startupTimes.registered == 0) {
+            startupTimes.registered = k_uptime_get();
+            LOG_INF("Registered %u ms after boot.", (uint32_t)startupTimes.registered);
+        }
+#if defined(CONFIG_IOWA_STORE)
+        client_store_set_online(true);
+#endif
+#if defined(CONFIG_IOWA_WARM_START)
+        client_context_registered(contextP);
+#endif
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+        client_lifetime_registered();
+#endif
+#if defined(CONFIG_IOWA_FOTA)
+        client_fota_registered(contextP);
+#endif
+        break;
+
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+    case IOWA_EVENT_REG_UPDATING:
+        client_lifetime_updating();
+        break;
+#endif
+
+#if defined(CONFIG_IOWA_STORE) || defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+    case IOWA_EVENT_REG_UNREGISTERED:
+    case IOWA_EVENT_REG_FAILED:
+    case IOWA_EVENT_REG_UPDATE_FAILED:
+#if defined(CONFIG_IOWA_STORE)
+        client_store_set_online(false);
+#endif
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+        client_lifetime_unregistered();
+#endif
+        break;
+#endif
+
+    default:
+        break;
+    }
+}
+
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+/* ----------------------------------------------------
+ * executed on the IOWA thread
+*/
+static void publish_command_handler(iowa_context_t contextP, const client_command_t *commandP) {
+    (void)contextP;
+
+    publish_values(commandP->sensorId, (iowa_ipso_timed_value_t *)commandP->valueArray, commandP->valueCount);
+}
+
+#if defined(CONFIG_IOWA_AGGREGATE)
+/* ----------------------------------------------------
+ * executed on the IOWA thread
+*/
+static void min_max_command_handler(iowa_context_t contextP, const client_command_t *commandP) {
+    (void)contextP;
+
+    publish_min_max(commandP->sensorId, commandP->valueArray[0].value, commandP->valueArray[1].value);
+}
+#endif
+
+#if defined(CONFIG_IOWA_STORE)
+/* ----------------------------------------------------
+ * executed on the IOWA thread
+*/
+static void drain_command_handler(iowa_context_t contextP, const client_command_t *commandP) {
+    (void)client_store_drain(contextP, &volt_value_uri, SERVER_SHORT_ID);
+}
+#endif
+
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+/* ----------------------------------------------------
+ * executed on the IOWA thread
+*/
+static void update_command_handler(iowa_context_t contextP, const client_command_t *commandP) {
+    (void)commandP;
+
+    client_lifetime_update(contextP, SERVER_SHORT_ID);
+}
+#endif
+#endif
+
+#if defined(CONFIG_IOWA_STORE)
+/* ----------------------------------------------------
+ * send the next samples of the store, once registered
+*/
+static void drain_store(void) {
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    client_command_t command;
+#endif
+
+    if (!client_store_drain_due()) {
+        return;
+    }
+
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    command.handler = drain_command_handler;
+    command.sensorId = measureP.voltSensorId;
+    command.valueCount = 0;
+
+    if (client_command_post(&measureP.commandQueue, &command) != 0) {
+        LOG_WRN("Command queue full, store drain delayed.");
+    }
+#else
+    (void)client_store_drain(measureP.iowaContext, &volt_value_uri, SERVER_SHORT_ID);
+#endif
+}
+#endif
+
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+/* ----------------------------------------------------
+ * renew the registration while the radio is awake anyway
+*/
+static void update_registration(void) {
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    client_command_t command;
+#endif
+
+    if (!client_lifetime_update_due(k_uptime_get())) {
+        return;
+    }
+
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    command.handler = update_command_handler;
+    command.sensorId = measureP.voltSensorId;
+    command.valueCount = 0;
+
+    if (client_command_post(&measureP.commandQueue, &command) != 0) {
+        // Not pending anymore: retried at the next wakeup
+        client_lifetime_update_dropped();
+        LOG_WRN("Command queue full, registration update delayed.");
+    }
+#else
+    client_lifetime_update(measureP.iowaContext, SERVER_SHORT_ID);
+#endif
+}
+#endif
+
+/* ----------------------------------------------------
+ * hand the values to the IOWA thread
+*/
+static void report_values(iowa_ipso_timed_value_t *valueArray, size_t valueCount) {
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    client_command_t command;
+
+    command.handler = publish_command_handler;
+    command.sensorId = measureP.voltSensorId;
+    command.valueCount = valueCount;
+    memcpy(command.valueArray, valueArray, valueCount * sizeof(iowa_ipso_timed_value_t));
+
+    if (client_command_post(&measureP.commandQueue, &command) != 0) {
+        LOG_WRN("Command queue full, values dropped.");
+    }
+#else
+    publish_values(measureP.voltSensorId, valueArray, valueCount);
+#endif
+}
+
+/* ----------------------------------------------------
+ * drop the samples the server would not care about
+*/
+static bool filter_sample(float value, int32_t timestamp) {
+#if defined(CONFIG_IOWA_FILTER)
+    return client_filter_accept(&measureP.voltFilter, value, timestamp);
+#else
+    (void)value;
+    (void)timestamp;
+    return true;
+#endif
+}
+
+#if defined(CONFIG_IOWA_AGGREGATE)
+/* ----------------------------------------------------
+ * hand the extremes of the window to the IOWA thread
+*/
+static void report_min_max(float minValue, float maxValue) {
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    client_command_t command;
+
+    command.handler = min_max_command_handler;
+    command.sensorId = measureP.voltSensorId;
+    command.valueCount = 2;
+    command.valueArray[0].value = minValue;
+    command.valueArray[1].value = maxValue;
+
+    if (client_command_post(&measureP.commandQueue, &command) != 0) {
+        LOG_WRN("Command queue full, extremes dropped.");
+    }
+#else
+    publish_min_max(measureP.voltSensorId, minValue, maxValue);
+#endif
+}
+
+/* ----------------------------------------------------
+ * publish the result of the aggregation window
+*/
+static void close_window(void) {
+    iowa_ipso_timed_value_t value;
+    float minValue;
+    float maxValue;
+
+    if (client_aggregate_close(&measureP.voltAggregate, sample_time(), &value, &minValue, &maxValue) == 0) {
+        return;
+    }
+
+    // The extremes go to their own resources, not to the Sensor Value
+    report_min_max(minValue, maxValue);
+
+    // The filter sees the window results, not the raw samples
+    if (filter_sample(value.value, value.timestamp)) {
+        report_values(&value, 1);
+    }
+}
+#endif
+
+/* ----------------------------------------------------
+*/
+static void send_measure_fn(void) {
+    iowa_ipso_timed_value_t valueArray[1];
+    size_t valueCount;
+    struct k_poll_event eventArray[3];
+    int eventCount;
+#if defined(CONFIG_IOWA_AGGREGATE)
+    int aggregateEvent;
+#endif
+
+    k_poll_event_init(&eventArray[0], K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &measure_signal);
+    eventCount = 1;
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+    // The radio woke up, or is about to
+    k_poll_event_init(&eventArray[1], K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, client_lifetime_get_signal());
+    eventCount = 2;
+#endif
+#if defined(CONFIG_IOWA_AGGREGATE)
+    aggregateEvent = eventCount;
+    k_poll_event_init(&eventArray[aggregateEvent], K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &aggregate_signal);
+    eventCount++;
+    k_timer_start(&aggregate_timer, K_SECONDS(CONFIG_IOWA_AGGREGATE_WINDOW), K_SECONDS(CONFIG_IOWA_AGGREGATE_WINDOW));
+#endif
+    k_timer_start(&measure_timer, K_MSEC(CONFIG_IOWA_MEASURE_PERIOD), K_MSEC(CONFIG_IOWA_MEASURE_PERIOD));
 
     while (1) {
+        // Sleep until the sensor is ready
+        (void)k_poll(eventArray, eventCount, K_FOREVER);
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+        if (eventArray[1].state != K_POLL_STATE_NOT_READY) {
+            eventArray[1].state = K_POLL_STATE_NOT_READY;
+            k_poll_signal_reset(client_lifetime_get_signal());
+            update_registration();
+        }
+#endif
+#if defined(CONFIG_IOWA_AGGREGATE)
+        if (eventArray[aggregateEvent].state != K_POLL_STATE_NOT_READY) {
+            eventArray[aggregateEvent].state = K_POLL_STATE_NOT_READY;
+            k_poll_signal_reset(&aggregate_signal);
+            close_window();
+        }
+#endif
+        if (eventArray[0].state == K_POLL_STATE_NOT_READY) {
+            continue;
+        }
+        eventArray[0].state = K_POLL_STATE_NOT_READY;
+        k_poll_signal_reset(&measure_signal);
+        measureP.wakeupCount++;
+
         if (measureP.voltSensorId > 0) {
             // Example: Update the sensor values with a random value
             float newValue = (float)(rand() % 100);
-            result = iowa_client_IPSO_update_value(measureP.iowaContext, measureP.voltSensorId, newValue);
-            k_yield();
-            if (result != IOWA_COAP_NO_ERROR) {
-                printk("Updating the voltage sensor value failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
+
+            valueCount = 0;
+#if defined(CONFIG_IOWA_AGGREGATE)
+            // Only the window results are published, by close_window()
+            client_aggregate_add(&measureP.voltAggregate, newValue);
+#else
+            valueArray[0].value = newValue;
+            valueArray[0].timestamp = sample_time();
+            if (filter_sample(valueArray[0].value, valueArray[0].timestamp)) {
+                valueCount = 1;
             }
-            printk("\n===> Thread: Voltage sensor value changed to %d.\n", (int)newValue);
+#endif
+#if defined(CONFIG_IOWA_BATCH)
+            // The samples already queued are sent even if no new one comes
+            if (valueCount != 0
+                || client_batch_is_due(&measureP.voltBatch, sample_time())) {
+                report_values(valueArray, valueCount);
+            }
+#else
+            if (valueCount != 0) {
+                report_values(valueArray, valueCount);
+            }
+#endif
+#if defined(CONFIG_IOWA_STORE)
+            drain_store();
+#endif
+
+            LOG_INF("Voltage sensor value changed to %d.", (int)newValue);
         }
-        k_msleep(1000);
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+        update_registration();
+#endif
+    }
+}
+
+/* --------------------------------------------------------------- 
+*/
+static void wait_link(void) {
+    k_sem_take(&lte_connected, K_FOREVER);
+    startupTimes.linkUp = k_uptime_get();
+    LOG_INF("Link up %u ms after boot.", (uint32_t)startupTimes.linkUp);
+}
+
+/* --------------------------------------------------------------- 
+ * print the boot phases and the initialization time hidden by the attach
+*/
+static void print_startup_stats(void) {
+    int64_t overlapEnd;
+
+    if (startupTimes.stackReady == 0 || startupTimes.linkUp == 0) {
+        printk("Startup: not completed\n");
+        return;
+    }
+
+    printk("Startup: attach started at %u ms, link up at %u ms, stack ready at %u ms (%u ms of initialization)\n",
+        (uint32_t)startupTimes.attachStart, (uint32_t)startupTimes.linkUp,
+        (uint32_t)startupTimes.stackReady, (uint32_t)(startupTimes.stackReady - startupTimes.initStart));
+    overlapEnd = MIN(startupTimes.stackReady, startupTimes.linkUp);
+    printk("Startup: %u ms of initialization during the attach\n",
+        (uint32_t)MAX(overlapEnd - startupTimes.initStart, 0));
+    if (startupTimes.registered != 0) {
+        printk("Startup: registered at %u ms, %u ms after the link was up\n",
+            (uint32_t)startupTimes.registered, (uint32_t)(startupTimes.registered - startupTimes.linkUp));
+    }
+    if (startupTimes.firstReport != 0) {
+        printk("Startup: first report acknowledged at %u ms\n", (uint32_t)startupTimes.firstReport);
+    }
+}
+
+/* --------------------------------------------------------------- 
+ * add the LwM2M Server, or resume the registration of the last run
+*/
+static iowa_status_t add_server(iowa_context_t iowaH, void *platformDataP, int32_t lifetime) {
+#if defined(CONFIG_IOWA_WARM_START)
+    char layout[sizeof(CONTEXT_LAYOUT) + 12];
+
+    snprintf(layout, sizeof(layout), "%s;%d", CONTEXT_LAYOUT, lifetime);
+    if (client_context_load(iowaH, platformDataP, layout) == IOWA_COAP_NO_ERROR) {
+        return IOWA_COAP_NO_ERROR;
     }
+#else
+    (void)platformDataP;
+#endif
+
+    return iowa_client_add_server(iowaH, SERVER_SHORT_ID, SERVER_URI, lifetime, 0, IOWA_SEC_NONE);
 }
 
 /* --------------------------------------------------------------- 
@@ -238,6 +865,7 @@ void main(void) {
     iowa_status_t result;
     iowa_device_info_t devInfo;
     void *platformDataP;
+    int32_t stepEnd;
 
     printk("**************************************\n");
     printk("** Iowa sample client for nrf9160DK **\n");
@@ -248,6 +876,19 @@ void main(void) {
 
     printk("Connecting celullar network...\n");
     measureP.voltSensorId = 0;
+#if defined(CONFIG_IOWA_BATCH)
+    client_batch_init(&measureP.voltBatch);
+#endif
+#if defined(CONFIG_IOWA_AGGREGATE)
+    client_aggregate_init(&measureP.voltAggregate);
+#endif
+#if defined(CONFIG_IOWA_FILTER)
+    client_filter_init(&measureP.voltFilter,
+        CONFIG_IOWA_FILTER_ABSOLUTE_DEADBAND / 1000.0f,
+        CONFIG_IOWA_FILTER_RELATIVE_DEADBAND / 1000.0f,
+        CONFIG_IOWA_FILTER_MIN_INTERVAL,
+        CONFIG_IOWA_FILTER_HYSTERESIS / 1000.0f);
+#endif
 
 #if defined(CONFIG_BSD_LIBRARY)
     err = configure_low_power();
@@ -256,14 +897,32 @@ void main(void) {
             err);
     }
 #endif
+#if defined(CONFIG_IOWA_CREDENTIALS)
+    // Before the attach: the modem only takes credentials while offline
+    if (provision_credentials() != 0) {
+        return;
+    }
+#endif
+    startupTimes.attachStart = k_uptime_get();
     modem_configure();
 
-    k_sem_take(&lte_connected, K_FOREVER);
+#if !defined(CONFIG_IOWA_PARALLEL_STARTUP)
+    wait_link();
+#endif
+    // Nothing below needs the network until the first iowa_step()
+    startupTimes.initStart = k_uptime_get();
+#if defined(CONFIG_IOWA_STORE)
+    // Mount the log, its samples are sent once registered
+    err = client_store_init();
+    if (err != 0) {
+        printk("Store-and-forward disabled (%d).\n", err);
+    }
+#endif
 
 
     // Application specific : initialize abstraction layer functions
     printk("Start IOWA lwm2m stack\n");
-#if defined(CONFIG_MBEDTLS)
+#if defined(CONFIG_IOWA_DTLS)
     printk("MBEDTLS version\n");
 #endif
 
@@ -282,6 +941,13 @@ void main(void) {
 
     // Save iowa context
     measureP.iowaContext = iowaH;
+    measureP.platformDataP = platformDataP;
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    client_command_init(&measureP.commandQueue, iowaH);
+#endif
+#if defined(CONFIG_IOWA_COMMAND_STRESS)
+    client_command_stress_start(&measureP.commandQueue);
+#endif
 
     // Start "send measure" thread
     measure_thread_id = k_thread_create(&measure_thread_data,
@@ -291,45 +957,193 @@ void main(void) {
         NULL, NULL, NULL,
         /* Lowest priority cooperative thread */
         THREAD_PRIORITY, 0, K_NO_WAIT);
+#if defined(CONFIG_THREAD_NAME)
+    k_thread_name_set(measure_thread_id, "measure");
+#endif
 
     // Configure the LwM2M Client
     memset(&devInfo, 0, sizeof(iowa_device_info_t));
     devInfo.manufacturer = "IoTerop";
     devInfo.deviceType = "IOWA nrf9160DK basic sample";
     devInfo.modelNumber = "nrf9160DK-001";
-    result = iowa_client_configure(iowaH, ENDPOINT_NAME, &devInfo, NULL);
+    result = iowa_client_configure(iowaH, ENDPOINT_NAME, &devInfo, prv_eventCb);
 
     if (result != IOWA_COAP_NO_ERROR) {
         printk("IOWA Client configuration failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
         goto cleanup;
     }
 
-    // Add a LwM2M Server to connect to
-    result = iowa_client_add_server(iowaH, SERVER_SHORT_ID, SERVER_URI, SERVER_LIFETIME, 0, IOWA_SEC_NONE);  
+    // Add an IPSO voltage sensor
+    result = iowa_client_IPSO_add_sensor(iowaH, IOWA_IPSO_VOLTAGE, 12.0, "V", "Test DC", 0.0, 24.0, &measureP.voltSensorId);
     if (result != IOWA_COAP_NO_ERROR) {
-        printk("Adding a server failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
+        printk("Adding a sensor failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
         goto cleanup;
     }
 
-    // Add an IPSO voltage sensor
-    result = iowa_client_IPSO_add_sensor(iowaH, IOWA_IPSO_VOLTAGE, 12.0, "V", "Test DC", 0.0, 24.0, &measureP.voltSensorId);
+#if defined(CONFIG_IOWA_PROBES_OBJECT)
+    // Let the server read the platform probes
+    result = client_probe_add_object(iowaH);
     if (result != IOWA_COAP_NO_ERROR) {
-        printk("Adding a sensor failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
+        printk("Adding the probe object failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
+        goto cleanup;
+    }
+#endif
+
+#if defined(CONFIG_IOWA_FOTA)
+    // Let the server update the firmware
+    result = client_fota_init(iowaH);
+    if (result != IOWA_COAP_NO_ERROR) {
+        printk("Adding the firmware update object failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
+        goto cleanup;
+    }
+#endif
+
+#if !defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+    // Add a LwM2M Server to connect to, once the objects are known: the
+    // context saved by the last run resumes its registration
+    result = add_server(iowaH, platformDataP, SERVER_LIFETIME);
+    if (result != IOWA_COAP_NO_ERROR) {
+        printk("Adding a server failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
         goto cleanup;
     }
+#endif
+    startupTimes.stackReady = k_uptime_get();
 
-    //IOWA stack runs for 2 minutes
-    result = iowa_step(iowaH, 240);
+#if defined(CONFIG_IOWA_PARALLEL_STARTUP)
+    // The registration starts as soon as the link is up
+    wait_link();
+#endif
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+    // The lifetime follows the timers granted by the attach
+    result = add_server(iowaH, platformDataP, client_lifetime_get(CONFIG_IOWA_LIFETIME_GRANT_WAIT));
     if (result != IOWA_COAP_NO_ERROR) {
-        printk("iowa_step failed with (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
+        printk("Adding a server failed (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
         goto cleanup;
     }
+#endif
+
+    //IOWA stack runs for 4 minutes
+    stepEnd = iowa_system_gettime() + 240;
+    do {
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+        // A command posted since the last drain may not stop the next
+        // iowa_step(): it is executed before entering it
+        if (client_command_pending(&measureP.commandQueue)) {
+            client_command_process(&measureP.commandQueue);
+        }
+#endif
+        result = iowa_step(iowaH, stepEnd - iowa_system_gettime());
+        if (result != IOWA_COAP_NO_ERROR) {
+            printk("iowa_step failed with (%u.%02u).\n", (result & 0xFF) >> 5, (result & 0x1F));
+            goto cleanup;
+        }
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+        // iowa_step() was stopped to execute the application commands
+        client_command_process(&measureP.commandQueue);
+#endif
+#if defined(CONFIG_IOWA_WARM_START)
+        client_context_process(iowaH);
+#endif
+    } while (iowa_system_gettime() < stepEnd);
 
 cleanup:
     printk("Leaving IOWA.\n");
 
+    k_timer_stop(&measure_timer);
+#if defined(CONFIG_IOWA_AGGREGATE)
+    k_timer_stop(&aggregate_timer);
+#endif
+#if defined(CONFIG_THREAD_ANALYZER)
+    // Stack used by each thread, while the measure thread still exists
+    thread_analyzer_print();
+#endif
     k_thread_abort(measure_thread_id);
+#if defined(CONFIG_IOWA_STORE)
+    client_store_close();
+#endif
 
+#if defined(CONFIG_IOWA_PROBES_OBJECT)
+    client_probe_remove_object(iowaH);
+#endif
+#if defined(CONFIG_IOWA_FOTA)
+    client_fota_close(iowaH);
+#endif
+#if defined(CONFIG_IOWA_WARM_START)
+    // Stay registered, the next start resumes with an Update
+    client_context_save(iowaH);
+#else
     iowa_client_remove_server(iowaH, SERVER_SHORT_ID);
+#endif
     iowa_close(iowaH);
+
+    print_startup_stats();
+    printk("Measure: %u wakeups\n", measureP.wakeupCount);
+#if defined(CONFIG_IOWA_SELECT_STATS)
+    platform_print_select_stats(platformDataP);
+#endif
+#if defined(CONFIG_IOWA_TRAFFIC_STATS)
+    platform_print_traffic_stats(platformDataP);
+#endif
+#if defined(CONFIG_IOWA_LOCK_STATS)
+    platform_print_lock_stats(platformDataP);
+#endif
+#if defined(CONFIG_IOWA_DTLS_STATS)
+    platform_print_dtls_stats(platformDataP);
+#endif
+#if defined(CONFIG_IOWA_SEND_QUEUE)
+    platform_print_send_stats(platformDataP);
+#endif
+#if defined(CONFIG_IOWA_RECV_BATCH)
+    platform_print_recv_stats(platformDataP);
+#endif
+#if defined(CONFIG_IOWA_PROBES)
+    client_probe_print();
+#endif
+#if defined(CONFIG_IOWA_DNS_CACHE)
+    client_dns_print_stats();
+#endif
+#if defined(CONFIG_IOWA_FOTA)
+    client_fota_print_stats();
+#endif
+#if defined(CONFIG_IOWA_STORE)
+    client_store_print_stats();
+#endif
+#if defined(CONFIG_IOWA_WARM_START)
+    client_context_print_stats();
+#endif
+#if defined(CONFIG_IOWA_CREDENTIALS)
+    client_cred_print_stats();
+#endif
+#if defined(CONFIG_IOWA_ADAPTIVE_LIFETIME)
+    client_lifetime_print_stats();
+#endif
+#if defined(CONFIG_IOWA_LTE_SIM)
+    client_lte_sim_print_stats();
+#endif
+#if defined(CONFIG_IOWA_COMMAND_QUEUE)
+    printk("Commands: %u posted, %u dropped, queue depth up to %u\n",
+        (uint32_t)atomic_get(&measureP.commandQueue.postedCount),
+        (uint32_t)atomic_get(&measureP.commandQueue.droppedCount),
+        (uint32_t)atomic_get(&measureP.commandQueue.maxDepth));
+#endif
+#if defined(CONFIG_IOWA_COMMAND_STRESS)
+    client_command_stress_print_stats();
+#endif
+#if defined(CONFIG_IOWA_BATCH)
+    printk("Batch: %u samples, %u flushes, %u dropped\n",
+        measureP.voltBatch.sampleCount, measureP.voltBatch.flushCount, measureP.voltBatch.droppedCount);
+#endif
+#if defined(CONFIG_IOWA_AGGREGATE)
+    printk("Aggregate: %u samples, %u windows\n",
+        measureP.voltAggregate.sampleCount, measureP.voltAggregate.windowCount);
+#endif
+#if defined(CONFIG_IOWA_FILTER)
+    printk("Filter: %u samples forwarded, %u suppressed\n",
+        measureP.voltFilter.forwardedCount, measureP.voltFilter.suppressedCount);
+#endif
+    free_platform_data(platformDataP);
+
+#if defined(CONFIG_IOWA_MEMORY_STATS)
+    client_memory_print_stats();
+#endif
 }
\ No newline at end of file